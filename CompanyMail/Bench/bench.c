@@ -0,0 +1,296 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "synthetic.h"
+#include "../filecopy.h"
+#include "../mailindex.h"
+#include "../metrics.h"
+#include "../userindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Times the mail paths users wait on against a tree filled by mailgen.
+// One tab separated line is printed per benchmark, after a header line:
+// benchmark, iterations, ops_per_sec, p50_usec, p99_usec, mb_per_sec.
+// Columns and names only ever get added to, so results can be compared across builds
+
+#define LOGIN_ITERATIONS 10000
+#define LIST_ITERATIONS 2000
+#define SEND_ITERATIONS 200
+#define SEND_FANOUT 16
+#define SEND_BODY_SIZE 2048
+#define COPY_ITERATIONS 20
+#define COPY_FILE_SIZE (16 * 1024 * 1024)
+
+const char* usersFilename = MAIL_ROOT "/Config/users";
+const char* adminFilename = MAIL_ROOT "/Config/admins";
+const char* userIndexFilename = MAIL_ROOT "/Config/users.idx";
+
+// Latencies of every iteration of one benchmark, in microseconds
+typedef struct benchSamples {
+	double* samples;
+	size_t count;
+	size_t capacity;
+	unsigned long long bytes;
+} benchSamples;
+
+static double nowUsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void addSample(benchSamples* bench, double start) {
+	if (bench->count == bench->capacity) {
+		bench->capacity = bench->capacity == 0 ? 1024 : bench->capacity * 2;
+		bench->samples = realloc(bench->samples, bench->capacity * sizeof(double));
+	}
+	bench->samples[bench->count++] = nowUsec() - start;
+}
+
+static int compareSamples(const void* a, const void* b) {
+	double first = *(const double*) a;
+	double second = *(const double*) b;
+
+	return (first > second) - (first < second);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const benchSamples* bench, unsigned int percent) {
+	size_t rank = (bench->count * percent + 99) / 100;
+
+	return bench->samples[rank > 0 ? rank - 1 : 0];
+}
+
+// Prints one result line and resets the samples for the next benchmark
+static void report(const char* name, benchSamples* bench) {
+	double total = 0;
+
+	for (size_t i = 0; i < bench->count; i++) {
+		total += bench->samples[i];
+	}
+
+	if (bench->count == 0 || total <= 0) {
+		printf("%s\t0\t0.0\t0.0\t0.0\t0.0\n", name);
+	}
+	else {
+		qsort(bench->samples, bench->count, sizeof(double), compareSamples);
+
+		printf("%s\t%zu\t%.1f\t%.1f\t%.1f\t%.1f\n", name, bench->count, bench->count / (total / 1e6),
+			percentile(bench, 50), percentile(bench, 99), bench->bytes / total);
+	}
+	fflush(stdout);
+
+	bench->count = 0;
+	bench->bytes = 0;
+}
+
+// The front end's startup: map the user table and find the caller's account
+static void benchLogin(const userIndex* userDirectory, benchSamples* bench) {
+	unsigned int seed = 1;
+
+	for (int i = 0; i < LOGIN_ITERATIONS; i++) {
+		uint32_t uid = userDirectory->records[rand_r(&seed) % userDirectory->header->numUsers].uid;
+		double start = nowUsec();
+
+		userIndex index;
+		if (loadUserIndex(&index, usersFilename, adminFilename, userIndexFilename) == 0) {
+			findUserByUid(&index, uid);
+			closeUserIndex(&index);
+		}
+		addSample(bench, start);
+	}
+	report("login_lookup", bench);
+}
+
+// Everything viewMail reads before it starts prompting
+static void benchUnreadList(paths* userPaths, size_t numUsers, benchSamples* bench) {
+	for (int i = 0; i < LIST_ITERATIONS; i++) {
+		double start = nowUsec();
+		size_t count;
+
+		free(readFolder(&userPaths[i % numUsers], 'u', &count));
+		addSample(bench, start);
+	}
+	report("unread_list", bench);
+}
+
+// Sends to a fixed group through the full delivery path
+static void benchSend(char (*usernames)[USERNAME_LENGTH], paths* userPaths, size_t numUsers, benchSamples* bench) {
+	const char* recipients[SEND_FANOUT];
+	unsigned int fanout = numUsers - 1 < SEND_FANOUT ? numUsers - 1 : SEND_FANOUT;
+
+	for (int i = 0; i < SEND_ITERATIONS; i++) {
+		size_t sender = i % numUsers;
+
+		for (unsigned int r = 0; r < fanout; r++) {
+			recipients[r] = usernames[(sender + 1 + r) % numUsers];
+		}
+
+		double start = nowUsec();
+		sendSynthetic(usernames[sender], &userPaths[sender], recipients, fanout, SEND_BODY_SIZE, 0);
+		addSample(bench, start);
+	}
+	report("send_fanout_16", bench);
+}
+
+// Reads half of each user's unread mail through markMessageRead(), as viewMail does
+static void benchMarkRead(char (*usernames)[USERNAME_LENGTH], paths* userPaths, size_t numUsers, benchSamples* bench) {
+	for (size_t u = 0; u < numUsers; u++) {
+		paths* currPaths = &userPaths[u];
+
+		mailboxHandle mailbox;
+		if (openMailbox(&mailbox, usernames[u], MAILBOX_UNREAD | MAILBOX_READ) != 0) {
+			closeMailbox(&mailbox);
+			continue;
+		}
+
+		indexCursor cursor;
+		readIndexCursor(currPaths->unreadCursor, currPaths->unreadIndex, &cursor);
+
+		size_t numUnread;
+		messageRecord* records = readMessageIndexFrom(currPaths->unreadIndex, cursor.position, &numUnread);
+
+		int lockFD = openat(mailbox.unreadFD, lockName + 1, O_RDONLY | O_CLOEXEC);
+		if (lockFD < 0) {
+			free(records);
+			closeMailbox(&mailbox);
+			continue;
+		}
+
+		for (size_t i = 0; i < numUnread; i += 2) {
+			messageRecord* record = &records[i];
+
+			if (record->flags & MESSAGE_FLAG_CONSUMED) {
+				continue;
+			}
+
+			double start = nowUsec();
+			markMessageRead(&mailbox, currPaths, lockFD, -1, record, true, cursor.position + i);
+			addSample(bench, start);
+		}
+		close(lockFD);
+		free(records);
+		closeMailbox(&mailbox);
+	}
+	report("unread_mark_read", bench);
+}
+
+// Deletes every other message in a folder of each user, then times the
+// compaction that viewOldMail and viewSentMail run afterwards
+static void benchDelete(paths* userPaths, size_t numUsers, char folder, benchSamples* bench) {
+	benchSamples compaction = {NULL, 0, 0, 0};
+
+	for (size_t u = 0; u < numUsers; u++) {
+		paths* currPaths = &userPaths[u];
+		const char* folderPath = folder == 'r' ? currPaths->readPath : currPaths->sentPath;
+		const char* indexPath = folder == 'r' ? currPaths->readIndex : currPaths->sentIndex;
+		const char* tombstonePath = folder == 'r' ? currPaths->readTombstones : currPaths->sentTombstones;
+
+		size_t count;
+		messageRecord* records = readLiveMessageIndex(indexPath, tombstonePath, &count);
+
+		for (size_t i = 0; i < count; i += 2) {
+			char* messagePath = malloc(strlen(folderPath) + strlen("/") + strlen(records[i].name) + strlen("_attachment") + 1);
+			double start = nowUsec();
+
+			sprintf(messagePath, "%s/%s", folderPath, records[i].name);
+			remove(messagePath);
+			if (recordHasAttachment(&records[i])) {
+				strcat(messagePath, "_attachment");
+				remove(messagePath);
+			}
+			appendTombstone(indexPath, tombstonePath, records[i].name);
+			addSample(bench, start);
+
+			free(messagePath);
+		}
+		free(records);
+
+		if (count > 0) {
+			double start = nowUsec();
+			compactTombstones(indexPath, tombstonePath);
+			addSample(&compaction, start);
+		}
+	}
+	report(folder == 'r' ? "read_delete" : "sent_delete", bench);
+	report(folder == 'r' ? "read_compact" : "sent_compact", &compaction);
+
+	free(compaction.samples);
+}
+
+// Copies a large file the way attachments are copied into drafts
+static void benchCopy(benchSamples* bench) {
+	const char* srcPath = MAIL_ROOT "/bench_copy_source";
+	const char* destPath = MAIL_ROOT "/bench_copy_dest";
+
+	if (writeFiller(srcPath, COPY_FILE_SIZE) != 0) {
+		report("copy_file", bench);
+		return;
+	}
+
+	for (int i = 0; i < COPY_ITERATIONS; i++) {
+		remove(destPath);
+
+		double start = nowUsec();
+		if (copyFile(srcPath, destPath, false) == 0) {
+			bench->bytes += COPY_FILE_SIZE;
+		}
+		addSample(bench, start);
+	}
+	report("copy_file", bench);
+
+	remove(srcPath);
+	remove(destPath);
+}
+
+int main(void) {
+	userIndex userDirectory;
+
+	if (loadUserIndex(&userDirectory, usersFilename, adminFilename, userIndexFilename) != 0
+			|| userDirectory.header->numUsers < 2) {
+		fprintf(stderr, "No generated mail found in %s, run mailgen first\n", MAIL_ROOT);
+		return 1;
+	}
+
+	size_t numUsers = userDirectory.header->numUsers;
+	char (*usernames)[USERNAME_LENGTH] = malloc(numUsers * USERNAME_LENGTH);
+	paths* userPaths = malloc(numUsers * sizeof(paths));
+
+	for (size_t i = 0; i < numUsers; i++) {
+		strcpy(usernames[i], userDirectory.records[i].username);
+		generatePaths(&userPaths[i], usernames[i]);
+	}
+
+	// Recording costs are part of what the front end pays, so they are measured too
+	openMetrics();
+
+	benchSamples bench = {NULL, 0, 0, 0};
+
+	printf("benchmark\titerations\tops_per_sec\tp50_usec\tp99_usec\tmb_per_sec\n");
+
+	benchLogin(&userDirectory, &bench);
+	benchUnreadList(userPaths, numUsers, &bench);
+	benchSend(usernames, userPaths, numUsers, &bench);
+	benchMarkRead(usernames, userPaths, numUsers, &bench);
+	benchDelete(userPaths, numUsers, 'r', &bench);
+	benchDelete(userPaths, numUsers, 's', &bench);
+	benchCopy(&bench);
+
+	for (size_t i = 0; i < numUsers; i++) {
+		freePaths(&userPaths[i]);
+	}
+	free(userPaths);
+	free(usernames);
+	free(bench.samples);
+	closeUserIndex(&userDirectory);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "synthetic.h"
+#include "../userindex.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fills an empty mail root with synthetic users and the mail they send each other.
+// Messages are mostly sent to one recipient, with an occasional larger fan-out,
+// and the given percentage carry an attachment. A fixed seed makes every run
+// with the same arguments build the same mailboxes
+
+#define GENERATOR_SEED 6240
+#define MAX_GENERATED_FANOUT 16
+#define MIN_BODY_SIZE 256
+#define MAX_BODY_SIZE 4096
+#define MIN_ATTACHMENT_SIZE 1024
+#define MAX_ATTACHMENT_SIZE (256 * 1024)
+
+const char* usersFilename = MAIL_ROOT "/Config/users";
+const char* adminFilename = MAIL_ROOT "/Config/admins";
+const char* userIndexFilename = MAIL_ROOT "/Config/users.idx";
+
+// Returns a value from min to max inclusive
+static unsigned int randomBetween(unsigned int* seed, unsigned int min, unsigned int max) {
+	return min + rand_r(seed) % (max - min + 1);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s <users> <messages> <attachment percent>\n", argv[0]);
+		return 1;
+	}
+
+	unsigned int numUsers = strtoul(argv[1], NULL, 10);
+	unsigned int numMessages = strtoul(argv[2], NULL, 10);
+	unsigned int attachPercent = strtoul(argv[3], NULL, 10);
+
+	if (numUsers < 2 || attachPercent > 100) {
+		fprintf(stderr, "At least 2 users and an attachment percent of at most 100 are needed\n");
+		return 1;
+	}
+
+	// An existing tree is never written into, so a real mail root cannot be clobbered
+	const char* dirsToCreate[] = {MAIL_ROOT, MAIL_ROOT "/Config", MAIL_ROOT "/mailboxes", MAIL_ROOT "/blobs"};
+
+	for (int i = 0; i < sizeof(dirsToCreate) / sizeof(dirsToCreate[0]); i++) {
+		if (mkdir(dirsToCreate[i], 0700) != 0) {
+			if (errno == EEXIST) {
+				fprintf(stderr, "%s already exists, remove it first\n", dirsToCreate[i]);
+			}
+			else {
+				perror("Error creating mail root");
+			}
+			return 1;
+		}
+	}
+
+	FILE* usersFile = fopen(usersFilename, "w");
+	FILE* adminFile = fopen(adminFilename, "w");
+
+	if (usersFile == NULL || adminFile == NULL) {
+		perror("Error writing user list");
+		return 1;
+	}
+
+	char (*usernames)[USERNAME_LENGTH] = malloc(numUsers * USERNAME_LENGTH);
+	paths* userPaths = malloc(numUsers * sizeof(paths));
+
+	for (unsigned int i = 0; i < numUsers; i++) {
+		syntheticUsername(i, usernames[i]);
+		fprintf(usersFile, "%s:%u\n", usernames[i], SYNTHETIC_FIRST_UID + i);
+
+		generatePaths(&userPaths[i], usernames[i]);
+		if (createMailbox(&userPaths[i]) != 0) {
+			return 1;
+		}
+	}
+	fprintf(adminFile, "%s\n", usernames[0]);
+
+	fclose(usersFile);
+	fclose(adminFile);
+
+	if (buildUserIndex(usersFilename, adminFilename, userIndexFilename) != 0) {
+		fprintf(stderr, "Error building user index\n");
+		return 1;
+	}
+
+	unsigned int seed = GENERATOR_SEED;
+	unsigned int numAttachments = 0;
+	unsigned long numFailures = 0;
+	const char* recipients[MAX_GENERATED_FANOUT];
+
+	for (unsigned int m = 0; m < numMessages; m++) {
+		unsigned int sender = rand_r(&seed) % numUsers;
+
+		// One message in ten goes to a larger group
+		unsigned int numRecipients = 1;
+		if (rand_r(&seed) % 10 == 0) {
+			numRecipients = randomBetween(&seed, 2, MAX_GENERATED_FANOUT < numUsers - 1 ? MAX_GENERATED_FANOUT : numUsers - 1);
+		}
+
+		// Recipients are a run of distinct users other than the sender
+		unsigned int first = rand_r(&seed) % (numUsers - 1);
+		for (unsigned int i = 0; i < numRecipients; i++) {
+			unsigned int recipient = (sender + 1 + (first + i) % (numUsers - 1)) % numUsers;
+			recipients[i] = usernames[recipient];
+		}
+
+		size_t bodySize = randomBetween(&seed, MIN_BODY_SIZE, MAX_BODY_SIZE);
+		size_t attachSize = 0;
+
+		if (rand_r(&seed) % 100 < attachPercent) {
+			attachSize = randomBetween(&seed, MIN_ATTACHMENT_SIZE, MAX_ATTACHMENT_SIZE);
+			numAttachments++;
+		}
+
+		int failures = sendSynthetic(usernames[sender], &userPaths[sender], recipients, numRecipients, bodySize, attachSize);
+		if (failures != 0) {
+			numFailures += failures < 0 ? numRecipients : failures;
+		}
+	}
+
+	printf("Generated %u users and %u messages (%u with attachments) in %s\n", numUsers, numMessages, numAttachments, MAIL_ROOT);
+
+	for (unsigned int i = 0; i < numUsers; i++) {
+		freePaths(&userPaths[i]);
+	}
+	free(userPaths);
+	free(usernames);
+
+	if (numFailures > 0) {
+		fprintf(stderr, "%lu deliveries failed\n", numFailures);
+		return 1;
+	}
+
+	return 0;
+}
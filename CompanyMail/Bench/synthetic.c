@@ -0,0 +1,129 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "synthetic.h"
+#include "../delivery.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void syntheticUsername(unsigned int i, char* username) {
+	sprintf(username, "%s%05u", SYNTHETIC_USER_PREFIX, i);
+}
+
+int createMailbox(const paths* userPaths) {
+	const char* dirsToCreate[] = {userPaths->userPath, userPaths->outboxPath, userPaths->sentPath,
+		userPaths->draftPath, userPaths->inboxPath, userPaths->unreadPath, userPaths->readPath};
+
+	for (int i = 0; i < sizeof(dirsToCreate) / sizeof(dirsToCreate[0]); i++) {
+		if (mkdir(dirsToCreate[i], 0700) != 0 && errno != EEXIST) {
+			perror("Error creating mailbox");
+			return -1;
+		}
+	}
+
+	FILE* lockFile = fopen(userPaths->unreadLock, "w");
+	if (lockFile == NULL) {
+		perror("Error creating unread lock");
+		return -1;
+	}
+	fclose(lockFile);
+
+	return 0;
+}
+
+int writeFiller(const char* path, size_t size) {
+	static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+	char buffer[8192];
+
+	for (size_t i = 0; i < sizeof(buffer); i++) {
+		buffer[i] = (i % 64 == 63) ? '\n' : text[i % (sizeof(text) - 1)];
+	}
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		perror("Error writing filler");
+		return -1;
+	}
+
+	while (size > 0) {
+		size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+
+		fwrite(buffer, 1, chunk, file);
+		size -= chunk;
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+int sendSynthetic(const char* sender, paths* senderPaths, const char** recipients,
+		unsigned int numRecipients, size_t bodySize, size_t attachSize) {
+	char* draftFilePath = malloc(strlen(senderPaths->draftPath) + strlen("/bench_.txt") + 11 + 1);
+	sprintf(draftFilePath, "%s/bench_%d.txt", senderPaths->draftPath, getpid());
+
+	char* draftAttachmentFilePath = malloc(strlen(senderPaths->draftPath) + strlen("/bench_.attach") + 11 + 1);
+	sprintf(draftAttachmentFilePath, "%s/bench_%d.attach", senderPaths->draftPath, getpid());
+
+	char* destinationsFilePath = malloc(strlen(senderPaths->draftPath) + strlen("/bench_destinations_.txt") + 11 + 1);
+	sprintf(destinationsFilePath, "%s/bench_destinations_%d.txt", senderPaths->draftPath, getpid());
+
+	int failures = -1;
+
+	FILE* destinationsFile = fopen(destinationsFilePath, "w");
+	FILE* draft = fopen(draftFilePath, "w");
+
+	if (destinationsFile == NULL || draft == NULL) {
+		perror("Error writing draft");
+		if (destinationsFile != NULL) {
+			fclose(destinationsFile);
+		}
+		if (draft != NULL) {
+			fclose(draft);
+		}
+		goto cleanup;
+	}
+
+	for (unsigned int i = 0; i < numRecipients; i++) {
+		fprintf(destinationsFile, "%s\n", recipients[i]);
+	}
+	fclose(destinationsFile);
+
+	fprintf(draft, "From: %s\n", sender);
+	fprintf(draft, "Subject: Synthetic message\n");
+	fprintf(draft, "Attachment: %s\n\n", attachSize > 0 ? "synthetic.txt" : "NONE");
+	fclose(draft);
+
+	// Body is filled in after the header so the message is bodySize bytes longer
+	FILE* body = fopen(draftFilePath, "a");
+	static const char line[] = "Synthetic body text for benchmarking mail delivery.\n";
+	for (size_t written = 0; written < bodySize; written += sizeof(line) - 1) {
+		fputs(line, body);
+	}
+	fclose(body);
+
+	if (attachSize > 0 && writeFiller(draftAttachmentFilePath, attachSize) != 0) {
+		remove(draftFilePath);
+		remove(destinationsFilePath);
+		goto cleanup;
+	}
+
+	deliveryResult* results = malloc(numRecipients * sizeof(deliveryResult));
+
+	failures = deliverDraft(sender, senderPaths, draftFilePath,
+		attachSize > 0 ? draftAttachmentFilePath : NULL,
+		destinationsFilePath, numRecipients, results);
+
+	free(results);
+
+cleanup:
+	free(draftFilePath);
+	free(draftAttachmentFilePath);
+	free(destinationsFilePath);
+
+	return failures;
+}
@@ -0,0 +1,34 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <stddef.h>
+
+#include "../mailbox.h"
+
+// Synthetic accounts are bench00000, bench00001, ... with UIDs from here up
+#define SYNTHETIC_USER_PREFIX "bench"
+#define SYNTHETIC_FIRST_UID 100000
+
+// Writes the name of synthetic user number i into username (33 chars)
+void syntheticUsername(unsigned int i, char* username);
+
+// Creates every folder of a user's mailbox along with the unread lock file.
+// Returns 0 on success, -1 on failure
+int createMailbox(const paths* userPaths);
+
+// Writes size bytes of printable filler text to a file.
+// Returns 0 on success, -1 on failure
+int writeFiller(const char* path, size_t size);
+
+// Sends a message through deliverDraft exactly as the front end does.
+// The body is bodySize bytes and an attachment of attachSize bytes is sent
+// along unless attachSize is 0.
+// Returns the number of recipients not delivered to, or -1 if the draft could not be written
+int sendSynthetic(const char* sender, paths* senderPaths, const char** recipients,
+		unsigned int numRecipients, size_t bodySize, size_t attachSize);
+
+#endif
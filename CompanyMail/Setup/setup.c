@@ -12,14 +12,19 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "../userindex.h"
+#include "../mailroot.h"
+#include "../terminal.h"
+
 int main(void) {
-    system("clear");
+    clearScreen();
 
     printf("Welcome to the Setup Utility for Company Mail\n");
     sleep(1);
 
-    const char* configDirectory = "/CompanyMail/Config";
-	const char* mailboxDir = "/CompanyMail/mailboxes";
+    const char* configDirectory = MAIL_ROOT "/Config";
+	const char* mailboxDir = MAIL_ROOT "/mailboxes";
+	const char* blobsDir = MAIL_ROOT "/blobs";
 
     // Check if config directory already exists
 	if (!access(configDirectory, F_OK)) {
@@ -52,6 +57,20 @@ int main(void) {
 
 		
 	}
+    // Check if blob store directory exists
+	if (!access(blobsDir, F_OK)) {
+		puts("directory exists");
+	}
+	else {
+		puts("DNE, creating...");
+
+		int status = mkdir(blobsDir, 0700);
+
+		if (status) {
+			printf("Error creating Directories");
+			exit(-1);
+		}
+	}
     
     printf("\nDetermining users on System\nPlease Wait...\n");
 
@@ -60,7 +79,7 @@ int main(void) {
 
     // Child process runs update users
 	if (!childID) {
-		execl("/CompanyMail/Setup/update_users", "/CompanyMail/Setup/update_users", NULL);
+		execl(MAIL_ROOT "/Setup/update_users", MAIL_ROOT "/Setup/update_users", NULL);
 	}
 	else {
 		wait(NULL);
@@ -73,15 +92,17 @@ int main(void) {
 
     bool promptAgain = true;
     char username[33];
-    char compareUsername[33];
 
-    FILE* userFile;
-    FILE* adminFile;
+    const char* usersFilename = MAIL_ROOT "/Config/users";
+    const char* adminFilename = MAIL_ROOT "/Config/admins";
+    const char* indexFilename = MAIL_ROOT "/Config/users.idx";
 
-    const char* usersFilename = "/CompanyMail/Config/users";
-    const char* adminFilename = "/CompanyMail/Config/admins";
+    userIndex userDirectory;
 
-    userFile = fopen(usersFilename, "r");
+    if (loadUserIndex(&userDirectory, usersFilename, adminFilename, indexFilename)) {
+        printf("Error loading user index");
+        exit(-1);
+    }
 
     // Choose admin account user
     do {
@@ -106,39 +127,18 @@ int main(void) {
             while ((c = getchar()) != '\n' && c != EOF);
 
             if(confirmChar == 'y') {
-                bool matchFound = false;
-                int  successfulIO;
-                char discard;
-                
-                // compares admin selection to users file to find match
-                do {
-                    successfulIO = fscanf(userFile, "%[^:]", compareUsername);
-                    while ((discard = fgetc(userFile)) != '\n' && discard != EOF);
-
-                    if (!strcmp(username, compareUsername)) {
-                        matchFound = true;
-                    }
-
-                } while (!matchFound && discard != EOF);
-
-                if (matchFound) {
+                // looks up admin selection in the user index
+                if (findUserByName(&userDirectory, username) != NULL) {
                     promptAgain = false;
                     confirmAgain = false;
                 }
                 else {
-                    fseek(userFile, SEEK_SET, 0);
                     printf("No user exists with username %s\n", username);
                     printf("\nHere is a listing of possible administrators and their corresponding UIDs:\n");
 
-                    do {
-                        successfulIO = fscanf(userFile, "%s", compareUsername);
-                        if (successfulIO != EOF) {
-                            printf("%s\n", compareUsername);
-                        }
-                        
-
-                    } while (successfulIO != EOF);
-                    fseek(userFile, SEEK_SET, 0);
+                    for (uint32_t i = 0; i < userDirectory.header->numUsers; i++) {
+                        printf("%s:%u\n", userDirectory.records[i].username, userDirectory.records[i].uid);
+                    }
 
                     confirmAgain = false;
                 }
@@ -154,11 +154,16 @@ int main(void) {
 
     } while (promptAgain);
 
-    fclose(userFile);
+    closeUserIndex(&userDirectory);
 
     // saves the admin selection
-    adminFile = fopen(adminFilename, "w");
+    FILE* adminFile = fopen(adminFilename, "w");
     fprintf(adminFile, "%s\n", username);
-    system("clear");
+    fclose(adminFile);
+
+    // Index records which accounts are admins, so it is rebuilt
+    buildUserIndex(usersFilename, adminFilename, indexFilename);
+
+    clearScreen();
     
 }
\ No newline at end of file
@@ -6,124 +6,374 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <string.h>
+
+#include "../userindex.h"
+#include "../mailroot.h"
 
 #define MAX_LINE_LENGTH 1024
-#define PATH_LIMIT 200
-#define NUM_USER_DIRS 7
 
-const char* mailDir = "/CompanyMail/mailboxes/";
+// Upper bound on threads creating mailboxes
+#define MAX_SETUP_WORKERS 16
 
-const char* outbox = "/outbox";
-const char* sent = "/sent";
-const char* drafts = "/drafts";
+// Range of regular accounts used if login.defs does not give one
+#define DEFAULT_UID_MIN 1000
+#define DEFAULT_UID_MAX 60000
 
-const char* inbox = "/inbox";
-const char* unread = "/unread";
-const char* readStr = "/read";
+const char* mailDir = MAIL_ROOT "/mailboxes";
+const char* usersFilename = MAIL_ROOT "/Config/users";
+const char* adminFilename = MAIL_ROOT "/Config/admins";
+const char* indexFilename = MAIL_ROOT "/Config/users.idx";
 
-const char* lockName = "/lock.lck";
+// Accounts dropped from the users file, one username:uid:time line each.
+// Their mailboxes are kept
+const char* removedFilename = MAIL_ROOT "/Config/removed_users";
 
+const char* loginDefsFilename = "/etc/login.defs";
 
-// Function sets up the inbox and outbox for each user w/ all necessary files
-void setupUserDir(char* username) {
-    char* userPath = malloc(strlen(mailDir) + strlen(username) + 1);
-    sprintf(userPath, "%s%s", mailDir, username);
+// Directories of a mailbox relative to its own directory, parents first
+const char* mailboxDirs[] = {"outbox", "outbox/sent", "outbox/drafts", "inbox", "inbox/unread", "inbox/read"};
+#define NUM_MAILBOX_DIRS 6
 
-    char* outboxPath = malloc(strlen(userPath) + strlen(outbox) + 1);
-    sprintf(outboxPath, "%s%s", userPath, outbox);
+const char* lockName = "inbox/unread/lock.lck";
 
-    char* sentPath = malloc(strlen(outboxPath) + strlen(sent) + 1);
-    sprintf(sentPath, "%s%s", outboxPath, sent);
+typedef struct account {
+    char username[USERNAME_LENGTH];
+    uid_t uid;
+} account;
 
-    char* draftPath = malloc(strlen(outboxPath) + strlen(drafts) + 1);
-    sprintf(draftPath, "%s%s", outboxPath, drafts);
-    
-    char* inboxPath = malloc(strlen(userPath) + strlen(inbox) + 1);
-    sprintf(inboxPath, "%s%s", userPath, inbox);
+// Mailboxes still to be made. Workers claim them in order through next
+typedef struct mailboxJob {
+    int rootFD;
+    account** accounts;
+    size_t count;
+    size_t next;
+    size_t failures;
+} mailboxJob;
+
+static int compareAccounts(const void* a, const void* b) {
+    return strcmp(((const account*) a)->username, ((const account*) b)->username);
+}
 
-    char* unreadPath = malloc(strlen(inboxPath) + strlen(unread) + 1);
-    sprintf(unreadPath, "%s%s", inboxPath, unread);
+// Reads UID_MIN and UID_MAX from login.defs, keeping the defaults for any it lacks
+void readUidRange(uid_t* uidMin, uid_t* uidMax) {
+    *uidMin = DEFAULT_UID_MIN;
+    *uidMax = DEFAULT_UID_MAX;
 
-    char* readPath = malloc(strlen(inboxPath) + strlen(readStr) + 1);
-    sprintf(readPath, "%s%s", inboxPath, readStr);
+    FILE* loginDefs = fopen(loginDefsFilename, "r");
+    if (loginDefs == NULL) {
+        return;
+    }
+
+    char line[MAX_LINE_LENGTH];
+    char key[32];
+    unsigned long value;
+
+    while (fgets(line, sizeof(line), loginDefs) != NULL) {
+        if (sscanf(line, "%31s %lu", key, &value) == 2) {
+            if (!strcmp(key, "UID_MIN")) {
+                *uidMin = value;
+            }
+            else if (!strcmp(key, "UID_MAX")) {
+                *uidMax = value;
+            }
+        }
+    }
+    fclose(loginDefs);
+}
 
-    char* dirsToCreate[] = {userPath, outboxPath, sentPath, draftPath, inboxPath, unreadPath, readPath};
+// Usernames become directory names and users file fields
+bool validUsername(const char* username) {
+    return username[0] != '\0' && username[0] != '.' && strlen(username) < USERNAME_LENGTH
+        && strpbrk(username, "/: \t\n") == NULL;
+}
+
+// Lists every regular account known to NSS, which covers /etc/passwd and any
+// directory services, sorted by username. The array must be freed
+account* readSystemAccounts(size_t* count) {
+    uid_t uidMin, uidMax;
+    readUidRange(&uidMin, &uidMax);
+
+    size_t capacity = 1024;
+    account* accounts = malloc(capacity * sizeof(account));
+    struct passwd* entry;
+
+    *count = 0;
+
+    setpwent();
+    while ((entry = getpwent()) != NULL) {
+        if (entry->pw_uid < uidMin || entry->pw_uid > uidMax || !validUsername(entry->pw_name)) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            accounts = realloc(accounts, capacity * sizeof(account));
+        }
+        strcpy(accounts[*count].username, entry->pw_name);
+        accounts[*count].uid = entry->pw_uid;
+        (*count)++;
+    }
+    endpwent();
+
+    qsort(accounts, *count, sizeof(account), compareAccounts);
+
+    // An account listed by more than one source keeps its first entry
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (kept == 0 || strcmp(accounts[kept - 1].username, accounts[i].username) != 0) {
+            accounts[kept++] = accounts[i];
+        }
+    }
+    *count = kept;
+
+    return accounts;
+}
+
+// Reads the current users file sorted by username. The array must be freed
+account* readUsersTable(size_t* count) {
+    size_t capacity = 1024;
+    account* accounts = malloc(capacity * sizeof(account));
+    char line[MAX_LINE_LENGTH];
+
+    *count = 0;
+
+    FILE* users = fopen(usersFilename, "r");
+    while (users != NULL && fgets(line, sizeof(line), users) != NULL) {
+        char* savePtr;
+        char* username = strtok_r(line, ":", &savePtr);
+        char* uidStr = strtok_r(NULL, "\n", &savePtr);
+
+        if (username == NULL || uidStr == NULL || !validUsername(username)) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            accounts = realloc(accounts, capacity * sizeof(account));
+        }
+        strcpy(accounts[*count].username, username);
+        accounts[*count].uid = strtoul(uidStr, NULL, 10);
+        (*count)++;
+    }
+    if (users != NULL) {
+        fclose(users);
+    }
+
+    qsort(accounts, *count, sizeof(account), compareAccounts);
+
+    return accounts;
+}
+
+// Makes whatever parts of one mailbox are missing, relative to the mailboxes directory.
+// Returns 0 on success, -1 on failure
+int createMailbox(int rootFD, const char* username) {
+    if (mkdirat(rootFD, username, 0600) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    int userFD = openat(rootFD, username, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (userFD < 0) {
+        return -1;
+    }
+
+    int status = 0;
+
+    for (int i = 0; i < NUM_MAILBOX_DIRS && status == 0; i++) {
+        if (mkdirat(userFD, mailboxDirs[i], 0600) != 0 && errno != EEXIST) {
+            status = -1;
+        }
+    }
 
-    // Checks for each directory and creates if necessary
-    for (int i = 0; i < NUM_USER_DIRS; i++) {
-        if (!access(dirsToCreate[i], F_OK)) {
-		    puts("directory exists");
-	    }
+    // Lock file for the unread folder
+    if (status == 0) {
+        int lockFD = openat(userFD, lockName, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+
+        if (lockFD < 0) {
+            status = -1;
+        }
         else {
-		    puts("DNE, creating...");
-            printf("Creating %s\n", dirsToCreate[i]);
-            usleep(1000);
+            close(lockFD);
+        }
+    }
+    close(userFD);
+
+    return status;
+}
+
+void* mailboxWorker(void* arg) {
+    mailboxJob* job = arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        if (createMailbox(job->rootFD, job->accounts[i]->username) != 0) {
+            fprintf(stderr, "Error creating mailbox for %s: %s\n", job->accounts[i]->username, strerror(errno));
+            __atomic_fetch_add(&job->failures, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
 
-		    int status = mkdir(dirsToCreate[i], 0600);
+// Creates mailboxes across a pool of threads.
+// Returns the number that could not be created
+size_t createMailboxes(int rootFD, account** accounts, size_t count) {
+    mailboxJob job = {rootFD, accounts, count, 0, 0};
 
-		    if (status) {
-			    printf("Error creating Directories");
-			    exit(-1);
-		    }
-	    }
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t numWorkers = numCores > 0 ? numCores : 1;
+
+    if (numWorkers > MAX_SETUP_WORKERS) {
+        numWorkers = MAX_SETUP_WORKERS;
+    }
+    if (numWorkers > count) {
+        numWorkers = count;
     }
 
-    // Lock files will be placed in unread directories
-    char* unreadLockPath = malloc(strlen(unreadPath) + strlen(lockName) + 1);
-    sprintf(unreadLockPath, "%s%s", unreadPath, lockName);
-    
-    FILE* lockFile = fopen(unreadLockPath, "w");
-    fclose(lockFile);
+    pthread_t workers[MAX_SETUP_WORKERS];
+    size_t numStarted = 0;
+
+    // The calling thread is one of the workers
+    for (size_t i = 1; i < numWorkers; i++) {
+        if (pthread_create(&workers[numStarted], NULL, mailboxWorker, &job) == 0) {
+            numStarted++;
+        }
+    }
 
-    free(unreadLockPath);
+    mailboxWorker(&job);
 
-    for (int i = 0; i < NUM_USER_DIRS; i++) {
-        free(dirsToCreate[i]);
+    for (size_t i = 0; i < numStarted; i++) {
+        pthread_join(workers[i], NULL);
     }
+
+    return job.failures;
 }
 
-int main(void) {
-    FILE* fileRead;
-    FILE* fileWrite;
-    char line[MAX_LINE_LENGTH];
+// Atomically replaces the users file
+int writeUsersTable(const account* accounts, size_t count) {
+    char tempFilename[strlen(usersFilename) + strlen(".tmp") + 1];
+    sprintf(tempFilename, "%s.tmp", usersFilename);
 
-    const char* filenameRead = "/etc/passwd";
-    const char* filenameWrite = "/CompanyMail/Config/users";
+    FILE* users = fopen(tempFilename, "w");
+    if (users == NULL) {
+        return -1;
+    }
 
-    fileRead = fopen(filenameRead, "r");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(users, "%s:%u\n", accounts[i].username, (unsigned int) accounts[i].uid);
+    }
 
-    if (fileRead == NULL) {
-        printf("Error opening file to Read");
-        return EXIT_FAILURE;
+    if (fclose(users) != 0 || rename(tempFilename, usersFilename) != 0) {
+        remove(tempFilename);
+        return -1;
     }
 
-    fileWrite = fopen(filenameWrite, "w");
+    return 0;
+}
+
+// Syncs the users file with the accounts on the system. Only accounts that
+// are new, or whose mailbox has gone missing, get mailboxes made. Accounts
+// that are gone are dropped from the users file and noted in removed_users
+int main(void) {
+    size_t numSystem, numTable;
+    account* systemAccounts = readSystemAccounts(&numSystem);
+    account* tableAccounts = readUsersTable(&numTable);
 
-    if (fileWrite == NULL) {
-        printf("Error opening file to Write");
+    int rootFD = open(mailDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFD < 0) {
+        perror("Error opening mailboxes directory");
         return EXIT_FAILURE;
     }
 
-    // Reads all actual users from /etc/passwd and adds to users file w/ UID
-    while (fgets(line, sizeof(line), fileRead) != NULL) {
+    account** toCreate = malloc((numSystem + 1) * sizeof(account*));
+    size_t numToCreate = 0;
+    size_t numAdded = 0, numChanged = 0, numRemoved = 0;
+
+    FILE* removed = NULL;
+    time_t now = time(NULL);
 
-        char *username = strtok(line, ":");
-        strtok(NULL, ":");
-        char *uid_str = strtok(NULL, ":");
+    // Both lists are sorted, so one pass pairs them up
+    size_t s = 0, t = 0;
 
-        if( username != NULL && uid_str != NULL) {
-            int uid = atoi(uid_str);
+    while (s < numSystem || t < numTable) {
+        int order = s == numSystem ? 1 : t == numTable ? -1 : strcmp(systemAccounts[s].username, tableAccounts[t].username);
+
+        if (order < 0) {
+            toCreate[numToCreate++] = &systemAccounts[s];
+            numAdded++;
+            s++;
+        }
+        else if (order > 0) {
+            if (removed == NULL) {
+                removed = fopen(removedFilename, "a");
+            }
+            if (removed != NULL) {
+                fprintf(removed, "%s:%u:%lld\n", tableAccounts[t].username, (unsigned int) tableAccounts[t].uid, (long long) now);
+            }
+            numRemoved++;
+            t++;
+        }
+        else {
+            if (systemAccounts[s].uid != tableAccounts[t].uid) {
+                numChanged++;
+            }
 
-            if (uid >= 1000 && uid <= 2000) {
-                setupUserDir(username);
-                fprintf(fileWrite, "%s:%s\n", username, uid_str);
+            // A known account only costs one stat, and is repaired if its mailbox is gone
+            struct stat userStat;
+            if (fstatat(rootFD, systemAccounts[s].username, &userStat, AT_SYMLINK_NOFOLLOW) != 0) {
+                toCreate[numToCreate++] = &systemAccounts[s];
             }
+            s++;
+            t++;
+        }
+    }
+    if (removed != NULL) {
+        fclose(removed);
+    }
+
+    size_t failures = createMailboxes(rootFD, toCreate, numToCreate);
+    close(rootFD);
+
+    int status = EXIT_SUCCESS;
+
+    // An unchanged users file keeps the existing index valid
+    if (numAdded > 0 || numChanged > 0 || numRemoved > 0) {
+        if (writeUsersTable(systemAccounts, numSystem) != 0) {
+            perror("Error writing users file");
+            status = EXIT_FAILURE;
+        }
+    }
+
+    // Rebuilds the hashed directory used for login and recipient lookups
+    userIndex index;
+    if (status == EXIT_SUCCESS) {
+        if (openUserIndex(&index, usersFilename, adminFilename, indexFilename) == 0) {
+            closeUserIndex(&index);
+        }
+        else if (buildUserIndex(usersFilename, adminFilename, indexFilename)) {
+            printf("Error building user index");
+            status = EXIT_FAILURE;
         }
     }
-    fclose(fileRead);
-    fclose(fileWrite);
 
-}
\ No newline at end of file
+    printf("%zu accounts: %zu added, %zu changed, %zu removed, %zu mailboxes created",
+        numSystem, numAdded, numChanged, numRemoved, numToCreate - failures);
+    if (failures > 0) {
+        printf(", %zu failed", failures);
+        status = EXIT_FAILURE;
+    }
+    printf("\n");
+
+    free(toCreate);
+    free(systemAccounts);
+    free(tableAccounts);
+
+    return status;
+}
@@ -0,0 +1,435 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "archive.h"
+#include "arena.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+_Static_assert(sizeof(archiveEntry) == 168, "archive entries are a fixed 168 bytes on disk");
+
+// What each part's file name adds to the message's name
+static const char* partSuffixes[ARCHIVE_NUM_PARTS] = {"", "_attachment", "_destinations.txt"};
+
+// Longest part file name
+#define PART_NAME_LENGTH (MESSAGE_NAME_LENGTH + sizeof("_destinations.txt"))
+
+void formatSegmentName(char* name, uint32_t segment) {
+	snprintf(name, ARCHIVE_SEGMENT_NAME_LENGTH, "segment_%06u.arc", segment);
+}
+
+// Reads a segment's number from its file name. Returns 0 if name is not a
+// segment. A segment left half written is flagged in partial
+static uint32_t parseSegmentName(const char* name, bool* partial) {
+	unsigned int segment;
+	int length = 0;
+
+	if (sscanf(name, "segment_%u.arc%n", &segment, &length) != 1 || length == 0 || segment == 0) {
+		return 0;
+	}
+
+	*partial = strcmp(name + length, ".tmp") == 0;
+
+	return *partial || name[length] == '\0' ? segment : 0;
+}
+
+// Orders entries by name. A name alone can be the key, as it starts an entry
+static int compareEntryNames(const void* a, const void* b) {
+	return strncmp(a, b, MESSAGE_NAME_LENGTH);
+}
+
+// Writes all of a buffer, retrying on short writes
+static int writeAll(int destFD, const void* buffer, size_t length) {
+	const char* position = buffer;
+
+	while (length > 0) {
+		ssize_t written = write(destFD, position, length);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		position += written;
+		length -= written;
+	}
+
+	return 0;
+}
+
+// Appends one part file to the end of the segment at position, compressed
+// if compress is true and that makes it smaller.
+// Returns 0 on success, 1 if the message has no such part, -1 on failure
+static int appendPart(int folderFD, const char* partName, int segmentFD, uint64_t* position, bool compress,
+		archiveEntry* entry, int part, archiveResult* result) {
+	int partFD = openat(folderFD, partName, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (partFD < 0) {
+		return errno == ENOENT ? 1 : -1;
+	}
+
+	struct stat partStat;
+	if (fstat(partFD, &partStat) != 0 || !S_ISREG(partStat.st_mode)) {
+		close(partFD);
+		return -1;
+	}
+
+	size_t length = partStat.st_size;
+	void* data = NULL;
+
+	if (length > 0) {
+		data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, partFD, 0);
+
+		if (data == MAP_FAILED) {
+			close(partFD);
+			return -1;
+		}
+		madvise(data, length, MADV_SEQUENTIAL);
+	}
+	close(partFD);
+
+	const void* stored = data;
+	size_t storedLength = length;
+	unsigned char* compressed = NULL;
+
+	// Kept as it was unless compression actually saves space
+	if (compress && length > 0) {
+		uLongf compressedLength = compressBound(length);
+		compressed = malloc(compressedLength);
+
+		if (compressed != NULL && compress2(compressed, &compressedLength, data, length, Z_DEFAULT_COMPRESSION) == Z_OK
+				&& compressedLength < length) {
+			stored = compressed;
+			storedLength = compressedLength;
+		}
+	}
+
+	int status = writeAll(segmentFD, stored, storedLength);
+
+	if (status == 0) {
+		entry->offset[part] = *position;
+		entry->length[part] = length;
+		entry->storedLength[part] = storedLength;
+		*position += storedLength;
+
+		result->numFiles++;
+		result->bytesIn += length;
+	}
+
+	free(compressed);
+	if (data != NULL) {
+		munmap(data, length);
+	}
+
+	return status;
+}
+
+// Writes every unarchived record from before cutoff into a new segment and
+// points the records at it. Records whose message file is missing are left
+// alone. The segment only appears under its name once it is complete and on
+// disk. Returns 0 on success, -1 on failure
+static int writeSegment(int folderFD, uint32_t segment, messageRecord* records, size_t count, int64_t cutoff,
+		bool compress, archiveResult* result) {
+	char segmentName[ARCHIVE_SEGMENT_NAME_LENGTH];
+	char tempName[ARCHIVE_SEGMENT_NAME_LENGTH + strlen(".tmp")];
+
+	formatSegmentName(segmentName, segment);
+	sprintf(tempName, "%s.tmp", segmentName);
+
+	int segmentFD = openat(folderFD, tempName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (segmentFD < 0) {
+		return -1;
+	}
+
+	archiveHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = ARCHIVE_MAGIC;
+	header.version = ARCHIVE_VERSION;
+	header.flags = compress ? ARCHIVE_FLAG_COMPRESSED : 0;
+	header.created = time(NULL);
+
+	archiveEntry* entries = malloc((count > 0 ? count : 1) * sizeof(archiveEntry));
+
+	// The header is written last, once the table's offset is known
+	uint64_t position = sizeof(header);
+	bool written = entries != NULL && lseek(segmentFD, position, SEEK_SET) == position;
+
+	for (size_t i = 0; written && i < count; i++) {
+		messageRecord* record = &records[i];
+
+		if ((record->flags & MESSAGE_FLAG_ARCHIVED) || record->timestamp >= cutoff) {
+			continue;
+		}
+
+		archiveEntry* entry = &entries[header.numEntries];
+		memset(entry, 0, sizeof(archiveEntry));
+		memcpy(entry->name, record->name, MESSAGE_NAME_LENGTH);
+
+		char partName[PART_NAME_LENGTH];
+		int status = 0;
+
+		for (int part = 0; part < ARCHIVE_NUM_PARTS && status >= 0; part++) {
+			sprintf(partName, "%s%s", record->name, partSuffixes[part]);
+			status = appendPart(folderFD, partName, segmentFD, &position, compress, entry, part, result);
+
+			// Without its message file there is nothing to archive
+			if (part == ARCHIVE_PART_MESSAGE && status == 1) {
+				break;
+			}
+		}
+
+		if (status < 0) {
+			written = false;
+		}
+		else if (entry->offset[ARCHIVE_PART_MESSAGE] != 0) {
+			record->flags |= MESSAGE_FLAG_ARCHIVED;
+			record->segment = segment;
+			header.numEntries++;
+		}
+	}
+
+	// Sorted so a message is found with a binary search
+	if (written) {
+		qsort(entries, header.numEntries, sizeof(archiveEntry), compareEntryNames);
+		header.tableOffset = position;
+
+		written = writeAll(segmentFD, entries, header.numEntries * sizeof(archiveEntry)) == 0
+			&& pwrite(segmentFD, &header, sizeof(header), 0) == sizeof(header);
+	}
+
+	// The loose files are removed once the segment is in place, so it must reach the disk first
+	written = written && fsync(segmentFD) == 0;
+
+	if (close(segmentFD) != 0) {
+		written = false;
+	}
+	free(entries);
+
+	if (!written || header.numEntries == 0 || renameat(folderFD, tempName, folderFD, segmentName) != 0) {
+		unlinkat(folderFD, tempName, 0);
+		return written && header.numEntries == 0 ? 0 : -1;
+	}
+	fsync(folderFD);
+
+	result->numMessages = header.numEntries;
+	result->bytesOut = position + header.numEntries * sizeof(archiveEntry);
+
+	return 0;
+}
+
+int archiveFolder(const paths* userPaths, char folder, int64_t cutoff, bool compress, archiveResult* result) {
+	memset(result, 0, sizeof(archiveResult));
+
+	const char* folderPath = folder == 'r' ? userPaths->readPath : userPaths->sentPath;
+	const char* indexPath = folder == 'r' ? userPaths->readIndex : userPaths->sentIndex;
+	const char* tombstonePath = folder == 'r' ? userPaths->readTombstones : userPaths->sentTombstones;
+
+	int folderFD = open(folderPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (folderFD < 0) {
+		return -1;
+	}
+
+	// Appends and deletions wait while the index is rewritten, as for compaction
+	uint64_t lockedAt;
+	int indexFD = openLockedIndex(indexPath, O_RDONLY, LOCK_EX, &lockedAt);
+	if (indexFD < 0) {
+		close(folderFD);
+		return -1;
+	}
+
+	// The segments already here number the new one. With the lock held, a
+	// segment still being written was left by an archiver that died
+	uint32_t* segments = NULL;
+	size_t numSegments = 0;
+	uint32_t lastSegment = 0;
+
+	int scanFD = dup(folderFD);
+	DIR* folderDir = scanFD >= 0 ? fdopendir(scanFD) : NULL;
+	struct dirent* folderEntry;
+
+	while (folderDir != NULL && (folderEntry = readdir(folderDir)) != NULL) {
+		bool partial = false;
+		uint32_t segment = parseSegmentName(folderEntry->d_name, &partial);
+
+		if (segment == 0) {
+			continue;
+		}
+		if (partial) {
+			unlinkat(folderFD, folderEntry->d_name, 0);
+			continue;
+		}
+
+		if ((numSegments & (numSegments - 1)) == 0) {
+			segments = realloc(segments, (numSegments > 0 ? numSegments * 2 : 1) * sizeof(uint32_t));
+		}
+		segments[numSegments++] = segment;
+
+		if (segment > lastSegment) {
+			lastSegment = segment;
+		}
+	}
+	if (folderDir != NULL) {
+		closedir(folderDir);
+	}
+	else if (scanFD >= 0) {
+		close(scanFD);
+	}
+
+	size_t count;
+	messageRecord* records = readLiveMessageIndex(indexPath, tombstonePath, &count);
+	uint32_t segment = lastSegment + 1;
+	int status = writeSegment(folderFD, segment, records, count, cutoff, compress, result);
+
+	// Rewriting the index drops deleted records, so their tombstones go with it
+	struct stat tombstoneStat;
+	bool hasTombstones = stat(tombstonePath, &tombstoneStat) == 0;
+
+	if (status == 0 && (result->numMessages > 0 || hasTombstones)) {
+		status = writeMessageIndex(indexPath, records, count);
+
+		if (status == 0) {
+			remove(tombstonePath);
+		}
+		else if (result->numMessages > 0) {
+			char segmentName[ARCHIVE_SEGMENT_NAME_LENGTH];
+			formatSegmentName(segmentName, segment);
+			unlinkat(folderFD, segmentName, 0);
+			result->numMessages = 0;
+		}
+	}
+	closeLockedIndex(indexFD, lockedAt);
+
+	if (status == 0) {
+		// The index now reads archived messages from the segment
+		char partName[PART_NAME_LENGTH];
+
+		for (size_t i = 0; result->numMessages > 0 && i < count; i++) {
+			if ((records[i].flags & MESSAGE_FLAG_ARCHIVED) && records[i].segment == segment) {
+				for (int part = 0; part < ARCHIVE_NUM_PARTS; part++) {
+					sprintf(partName, "%s%s", records[i].name, partSuffixes[part]);
+					unlinkat(folderFD, partName, 0);
+				}
+			}
+		}
+
+		// A segment whose messages have all been deleted is removed whole
+		for (size_t i = 0; i < numSegments; i++) {
+			bool referenced = false;
+
+			for (size_t j = 0; !referenced && j < count; j++) {
+				referenced = (records[j].flags & MESSAGE_FLAG_ARCHIVED) && records[j].segment == segments[i];
+			}
+
+			char segmentName[ARCHIVE_SEGMENT_NAME_LENGTH];
+			formatSegmentName(segmentName, segments[i]);
+
+			if (!referenced && unlinkat(folderFD, segmentName, 0) == 0) {
+				result->numSegmentsRemoved++;
+			}
+		}
+	}
+
+	free(records);
+	free(segments);
+	close(folderFD);
+
+	return status;
+}
+
+int openArchivedPart(const char* folderPath, const messageRecord* record, int part) {
+	if (!(record->flags & MESSAGE_FLAG_ARCHIVED) || part < 0 || part >= ARCHIVE_NUM_PARTS) {
+		return -1;
+	}
+
+	char segmentName[ARCHIVE_SEGMENT_NAME_LENGTH];
+	pathBuilder segmentPath;
+
+	formatSegmentName(segmentName, record->segment);
+	if (setPathFolder(&segmentPath, folderPath) != 0 || buildPath(&segmentPath, segmentName, NULL) == NULL) {
+		return -1;
+	}
+
+	int segmentFD = open(segmentPath.path, O_RDONLY | O_CLOEXEC);
+	if (segmentFD < 0) {
+		return -1;
+	}
+
+	struct stat segmentStat;
+	if (fstat(segmentFD, &segmentStat) != 0 || segmentStat.st_size < sizeof(archiveHeader)) {
+		close(segmentFD);
+		return -1;
+	}
+
+	// Only the pages of the table and of the one part are read
+	size_t segmentSize = segmentStat.st_size;
+	const char* segmentMap = mmap(NULL, segmentSize, PROT_READ, MAP_SHARED, segmentFD, 0);
+	close(segmentFD);
+
+	if (segmentMap == MAP_FAILED) {
+		return -1;
+	}
+
+	const archiveHeader* header = (const archiveHeader*) segmentMap;
+	const archiveEntry* entry = NULL;
+
+	if (header->magic == ARCHIVE_MAGIC && header->version == ARCHIVE_VERSION && header->tableOffset <= segmentSize
+			&& (segmentSize - header->tableOffset) / sizeof(archiveEntry) >= header->numEntries) {
+		entry = bsearch(record->name, segmentMap + header->tableOffset, header->numEntries, sizeof(archiveEntry), compareEntryNames);
+	}
+
+	int partFD = -1;
+
+	if (entry != NULL && entry->offset[part] != 0 && entry->offset[part] <= header->tableOffset
+			&& entry->storedLength[part] <= header->tableOffset - entry->offset[part]) {
+		const char* stored = segmentMap + entry->offset[part];
+		size_t length = entry->length[part];
+		size_t storedLength = entry->storedLength[part];
+
+		partFD = memfd_create(record->name, 0);
+
+		if (partFD >= 0 && storedLength == length) {
+			if (writeAll(partFD, stored, length) != 0 || lseek(partFD, 0, SEEK_SET) != 0) {
+				close(partFD);
+				partFD = -1;
+			}
+		}
+		// Compressed parts are inflated straight into the anonymous file
+		else if (partFD >= 0) {
+			char* content = MAP_FAILED;
+			uLongf inflatedLength = length;
+
+			if (ftruncate(partFD, length) == 0) {
+				content = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, partFD, 0);
+			}
+
+			bool inflated = content != MAP_FAILED
+				&& uncompress((Bytef*) content, &inflatedLength, (const Bytef*) stored, storedLength) == Z_OK
+				&& inflatedLength == length;
+
+			if (content != MAP_FAILED) {
+				munmap(content, length);
+			}
+			if (!inflated) {
+				close(partFD);
+				partFD = -1;
+			}
+		}
+	}
+	munmap((void*) segmentMap, segmentSize);
+
+	return partFD;
+}
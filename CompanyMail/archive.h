@@ -0,0 +1,86 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mailbox.h"
+#include "mailindex.h"
+
+#define ARCHIVE_MAGIC 0x5343524d
+#define ARCHIVE_VERSION 1
+
+// Set in a segment's flags if its parts may be compressed
+#define ARCHIVE_FLAG_COMPRESSED 0x1
+
+// Days read and sent mail stays as loose files unless told otherwise
+#define ARCHIVE_DEFAULT_DAYS 90
+
+// Parts of an archived message. A read message has no destinations
+#define ARCHIVE_PART_MESSAGE 0
+#define ARCHIVE_PART_ATTACHMENT 1
+#define ARCHIVE_PART_DESTINATIONS 2
+#define ARCHIVE_NUM_PARTS 3
+
+// Segments are named segment_<number>.arc in the folder they archive.
+// Message names never hold a '.', so the two cannot collide
+#define ARCHIVE_SEGMENT_NAME_LENGTH 32
+
+// Old read and sent mail is packed into segments, each written once by
+// archiveFolder() and never changed after. A segment is this header, then the
+// parts of each message one after another, then a table of numEntries entries
+// sorted by name at tableOffset. An archived message's record in the folder
+// index has MESSAGE_FLAG_ARCHIVED set and its segment number in segment, so
+// it is found with one binary search of that segment's table.
+// created is when the segment was written, in seconds since the epoch.
+typedef struct archiveHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numEntries;
+	uint32_t flags;
+	uint64_t tableOffset;
+	int64_t created;
+} archiveHeader;
+
+// Where a message's parts are in its segment. A part the message does not have
+// has offset 0. A part is compressed with zlib if its storedLength is less
+// than its length, otherwise it is stored as it was
+typedef struct archiveEntry {
+	char name[MESSAGE_NAME_LENGTH];
+	uint64_t offset[ARCHIVE_NUM_PARTS];
+	uint64_t length[ARCHIVE_NUM_PARTS];
+	uint64_t storedLength[ARCHIVE_NUM_PARTS];
+} archiveEntry;
+
+// What one archiveFolder() call did
+typedef struct archiveResult {
+	size_t numMessages;
+	size_t numFiles;
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	size_t numSegmentsRemoved;
+} archiveResult;
+
+// Writes the file name of a segment into name, which must hold ARCHIVE_SEGMENT_NAME_LENGTH chars
+void formatSegmentName(char* name, uint32_t segment);
+
+// Packs every message in a read ('r') or sent ('s') folder from before cutoff,
+// in nanoseconds since the epoch, into a new segment, compressing each part
+// if compress is true. The index is rewritten to point at the segment, then
+// the loose files are removed. Deleted messages are dropped from the index
+// at the same time, and segments no message refers to any more are removed.
+// Returns 0 on success, -1 on failure, with what was done in result
+int archiveFolder(const paths* userPaths, char folder, int64_t cutoff, bool compress, archiveResult* result);
+
+// Opens one part of an archived message, as an anonymous file holding its
+// content. The descriptor is inherited by children so it can be handed to an
+// editor as /proc/self/fd/<fd>, and must be closed.
+// Returns the descriptor, or -1 if the part could not be read
+int openArchivedPart(const char* folderPath, const messageRecord* record, int part);
+
+#endif
@@ -0,0 +1,125 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+void initArena(arena* memory, size_t blockSize) {
+	memory->current = NULL;
+	memory->blockSize = blockSize;
+}
+
+void* arenaAlloc(arena* memory, size_t size) {
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+	arenaBlock* block = memory->current;
+
+	if (block == NULL || block->capacity - block->used < size) {
+		size_t capacity = size > memory->blockSize ? size : memory->blockSize;
+
+		block = malloc(sizeof(arenaBlock) + capacity);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->previous = memory->current;
+		block->capacity = capacity;
+		block->used = 0;
+		memory->current = block;
+	}
+
+	void* allocation = block->data + block->used;
+	block->used += size;
+
+	return allocation;
+}
+
+char* arenaPrintf(arena* memory, const char* format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if (length < 0) {
+		return NULL;
+	}
+
+	char* string = arenaAlloc(memory, length + 1);
+	if (string == NULL) {
+		return NULL;
+	}
+
+	va_start(args, format);
+	vsnprintf(string, length + 1, format, args);
+	va_end(args);
+
+	return string;
+}
+
+arenaMark markArena(const arena* memory) {
+	arenaMark mark = {memory->current, memory->current != NULL ? memory->current->used : 0};
+	return mark;
+}
+
+void resetArena(arena* memory, arenaMark mark) {
+	// Blocks chained after the mark are released, except the first block of all
+	while (memory->current != mark.block && memory->current->previous != NULL) {
+		arenaBlock* block = memory->current;
+
+		memory->current = block->previous;
+		free(block);
+	}
+
+	if (memory->current != NULL) {
+		memory->current->used = memory->current == mark.block ? mark.used : 0;
+	}
+}
+
+void freeArena(arena* memory) {
+	while (memory->current != NULL) {
+		arenaBlock* block = memory->current;
+
+		memory->current = block->previous;
+		free(block);
+	}
+}
+
+int setPathFolder(pathBuilder* builder, const char* folder) {
+	size_t length = strlen(folder);
+
+	if (length + 1 >= sizeof(builder->path)) {
+		builder->folderLength = 0;
+		builder->path[0] = '\0';
+		return -1;
+	}
+
+	memcpy(builder->path, folder, length);
+	builder->path[length] = '/';
+	builder->folderLength = length + 1;
+
+	return 0;
+}
+
+const char* buildPath(pathBuilder* builder, const char* name, const char* suffix) {
+	size_t nameLength = strlen(name);
+	size_t suffixLength = suffix != NULL ? strlen(suffix) : 0;
+
+	if (builder->folderLength == 0 || builder->folderLength + nameLength + suffixLength >= sizeof(builder->path)) {
+		return NULL;
+	}
+
+	char* end = builder->path + builder->folderLength;
+
+	memcpy(end, name, nameLength);
+	if (suffixLength > 0) {
+		memcpy(end + nameLength, suffix, suffixLength);
+	}
+	end[nameLength + suffixLength] = '\0';
+
+	return builder->path;
+}
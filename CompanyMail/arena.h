@@ -0,0 +1,73 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <limits.h>
+
+// Every allocation is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+
+// Block size used for a listing or a send
+#define ARENA_BLOCK_SIZE (64 << 10)
+
+// One block of an arena. Blocks are chained newest first
+typedef struct arenaBlock {
+	struct arenaBlock* previous;
+	size_t capacity;
+	size_t used;
+	_Alignas(ARENA_ALIGNMENT) char data[];
+} arenaBlock;
+
+// A bump allocator scoped to one piece of work, such as a listing or a send.
+// Allocations are never freed one at a time: the arena is rewound to a mark
+// or freed as a whole. A full block chains another, so nothing moves
+typedef struct arena {
+	arenaBlock* current;
+	size_t blockSize;
+} arena;
+
+// A point an arena can be rewound to
+typedef struct arenaMark {
+	arenaBlock* block;
+	size_t used;
+} arenaMark;
+
+// Sets up an empty arena. No memory is taken until the first allocation
+void initArena(arena* memory, size_t blockSize);
+
+// Returns size bytes from the arena, or NULL if no memory is left
+void* arenaAlloc(arena* memory, size_t size);
+
+// Formats a string into the arena.
+// Returns the string, or NULL if no memory is left
+char* arenaPrintf(arena* memory, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Returns the arena's current position
+arenaMark markArena(const arena* memory);
+
+// Releases everything allocated since mark. The first block is kept, so a
+// loop that rewinds after each item allocates nothing once it has warmed up
+void resetArena(arena* memory, arenaMark mark);
+
+// Releases every block of an arena
+void freeArena(arena* memory);
+
+// A file path built in a fixed buffer: the folder is copied in once, then
+// each file's name is written after it in place
+typedef struct pathBuilder {
+	char path[PATH_MAX];
+	size_t folderLength;
+} pathBuilder;
+
+// Starts paths in folder. Returns 0 on success, -1 if the folder is too long
+int setPathFolder(pathBuilder* builder, const char* folder);
+
+// Builds <folder>/<name><suffix>, with suffix optional.
+// Returns the path, valid until the next call, or NULL if it is too long
+const char* buildPath(pathBuilder* builder, const char* name, const char* suffix);
+
+#endif
@@ -0,0 +1,295 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "blobstore.h"
+#include "mailbox.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BUFFER_SIZE (1 << 20)
+
+// Generations tried before a file is left out of the store
+#define MAX_BLOB_GENERATIONS 64
+
+// SHA-256 state
+typedef struct sha256Context {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+	size_t blockLength;
+} sha256Context;
+
+static const uint32_t sha256Constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Init(sha256Context* context) {
+	static const uint32_t initialState[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(context->state, initialState, sizeof(initialState));
+	context->length = 0;
+	context->blockLength = 0;
+}
+
+static void sha256Block(sha256Context* context, const uint8_t* block) {
+	uint32_t w[64];
+
+	for (int i = 0; i < 16; i++) {
+		w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16
+			| (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = context->state[0], b = context->state[1], c = context->state[2], d = context->state[3];
+	uint32_t e = context->state[4], f = context->state[5], g = context->state[6], h = context->state[7];
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256Constants[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	context->state[0] += a;
+	context->state[1] += b;
+	context->state[2] += c;
+	context->state[3] += d;
+	context->state[4] += e;
+	context->state[5] += f;
+	context->state[6] += g;
+	context->state[7] += h;
+}
+
+static void sha256Update(sha256Context* context, const uint8_t* data, size_t length) {
+	context->length += length;
+
+	while (length > 0) {
+		size_t take = 64 - context->blockLength < length ? 64 - context->blockLength : length;
+
+		memcpy(context->block + context->blockLength, data, take);
+		context->blockLength += take;
+		data += take;
+		length -= take;
+
+		if (context->blockLength == 64) {
+			sha256Block(context, context->block);
+			context->blockLength = 0;
+		}
+	}
+}
+
+static void sha256Final(sha256Context* context, uint8_t digest[32]) {
+	uint64_t bitLength = context->length * 8;
+	uint8_t padding = 0x80;
+
+	sha256Update(context, &padding, 1);
+	padding = 0;
+	while (context->blockLength != 56) {
+		sha256Update(context, &padding, 1);
+	}
+
+	uint8_t lengthBytes[8];
+	for (int i = 0; i < 8; i++) {
+		lengthBytes[i] = bitLength >> (56 - i * 8);
+	}
+	sha256Update(context, lengthBytes, 8);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = context->state[i] >> 24;
+		digest[i * 4 + 1] = context->state[i] >> 16;
+		digest[i * 4 + 2] = context->state[i] >> 8;
+		digest[i * 4 + 3] = context->state[i];
+	}
+}
+
+// Hashes a file into a hex string of BLOB_HASH_LENGTH chars
+static int hashFile(const char* filePath, char* hex) {
+	int fileFD = open(filePath, O_RDONLY);
+	if (fileFD < 0) {
+		return -1;
+	}
+
+	uint8_t* buffer = malloc(HASH_BUFFER_SIZE);
+	sha256Context context;
+	ssize_t bytesRead;
+
+	sha256Init(&context);
+	while ((bytesRead = read(fileFD, buffer, HASH_BUFFER_SIZE)) != 0) {
+		if (bytesRead < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(buffer);
+			close(fileFD);
+			return -1;
+		}
+		sha256Update(&context, buffer, bytesRead);
+	}
+	free(buffer);
+	close(fileFD);
+
+	uint8_t digest[32];
+	sha256Final(&context, digest);
+
+	for (int i = 0; i < 32; i++) {
+		sprintf(hex + i * 2, "%02x", digest[i]);
+	}
+
+	return 0;
+}
+
+int ingestBlob(const char* filePath, unsigned int extraLinks) {
+	char hex[BLOB_HASH_LENGTH + 1];
+
+	if (hashFile(filePath, hex) != 0) {
+		return -1;
+	}
+
+	// Fan out directory keeps any one directory small
+	char* fanoutDir = malloc(strlen(blobDir) + 2 + 1);
+	sprintf(fanoutDir, "%s%.2s", blobDir, hex);
+	mkdir(blobDir, 0700);
+	mkdir(fanoutDir, 0700);
+
+	long linkLimit = pathconf(fanoutDir, _PC_LINK_MAX);
+	if (linkLimit <= 0) {
+		linkLimit = 65000;
+	}
+
+	char* blobPath = malloc(strlen(fanoutDir) + strlen("/") + BLOB_HASH_LENGTH + strlen("-") + 11 + 1);
+	char* tempPath = malloc(strlen(filePath) + strlen(".blob") + 1);
+	sprintf(tempPath, "%s.blob", filePath);
+
+	int status = -1;
+
+	for (int generation = 0; generation < MAX_BLOB_GENERATIONS && status != 0; generation++) {
+		if (generation == 0) {
+			sprintf(blobPath, "%s/%s", fanoutDir, hex);
+		}
+		else {
+			sprintf(blobPath, "%s/%s-%d", fanoutDir, hex, generation);
+		}
+
+		// Linking the blob first pins it, so collection cannot remove it underneath us
+		if (link(blobPath, tempPath) == 0) {
+			struct stat blobStat;
+
+			// A blob close to the link limit is left for the next generation
+			if (stat(tempPath, &blobStat) != 0 || blobStat.st_nlink + extraLinks + 1 >= linkLimit) {
+				remove(tempPath);
+				continue;
+			}
+
+			// The file is swapped for the shared blob in one step
+			if (rename(tempPath, filePath) == 0) {
+				status = 0;
+			}
+			else {
+				remove(tempPath);
+				break;
+			}
+		}
+		else if (errno == ENOENT) {
+			// First copy of this content becomes the blob
+			if (link(filePath, blobPath) == 0) {
+				status = 0;
+			}
+			else if (errno == EEXIST) {
+				// Stored by someone else meanwhile, so try this generation again
+				generation--;
+			}
+			else {
+				break;
+			}
+		}
+		else if (errno != EMLINK) {
+			break;
+		}
+	}
+
+	free(fanoutDir);
+	free(blobPath);
+	free(tempPath);
+
+	return status;
+}
+
+unsigned long collectBlobs(unsigned long long* bytesFreed) {
+	unsigned long removed = 0;
+
+	DIR* storeDir = opendir(blobDir);
+	if (storeDir == NULL) {
+		return 0;
+	}
+
+	struct dirent* fanoutEntry;
+
+	while ((fanoutEntry = readdir(storeDir)) != NULL) {
+		if (fanoutEntry->d_name[0] == '.') {
+			continue;
+		}
+
+		int fanoutFD = openat(dirfd(storeDir), fanoutEntry->d_name, O_RDONLY | O_DIRECTORY);
+		if (fanoutFD < 0) {
+			continue;
+		}
+
+		DIR* fanoutDir = fdopendir(fanoutFD);
+		if (fanoutDir == NULL) {
+			close(fanoutFD);
+			continue;
+		}
+
+		struct dirent* blobEntry;
+
+		while ((blobEntry = readdir(fanoutDir)) != NULL) {
+			struct stat blobStat;
+
+			if (blobEntry->d_name[0] == '.' || fstatat(fanoutFD, blobEntry->d_name, &blobStat, AT_SYMLINK_NOFOLLOW) != 0) {
+				continue;
+			}
+
+			// Only the store's own link is left
+			if (S_ISREG(blobStat.st_mode) && blobStat.st_nlink == 1
+					&& unlinkat(fanoutFD, blobEntry->d_name, 0) == 0) {
+				removed++;
+				*bytesFreed += blobStat.st_size;
+			}
+		}
+		closedir(fanoutDir);
+	}
+	closedir(storeDir);
+
+	return removed;
+}
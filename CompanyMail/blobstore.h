@@ -0,0 +1,28 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+// Blobs are stored as <blobDir>/<first 2 hex digits>/<sha256 hex>[-<generation>].
+// Every mailbox entry holding a blob's content is a hard link to the blob,
+// so the blob's link count minus one is its reference count. Removing a
+// mailbox entry drops a reference. A blob whose only link is the store's
+// own is unreferenced and is removed by collectBlobs().
+// Generations are used once a blob nears the filesystem's link limit.
+
+// Length of a SHA-256 digest in hex
+#define BLOB_HASH_LENGTH 64
+
+// Replaces the file at filePath with a link to the blob holding the same
+// content, adding the file to the store if no such blob exists yet.
+// extraLinks is how many more links the caller is about to make to the file.
+// Returns 0 on success, -1 if the file was left as it was
+int ingestBlob(const char* filePath, unsigned int extraLinks);
+
+// Removes every blob that no mailbox entry links to any more.
+// Returns the number of blobs removed and adds their size to bytesFreed
+unsigned long collectBlobs(unsigned long long* bytesFreed);
+
+#endif
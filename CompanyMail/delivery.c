@@ -0,0 +1,786 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "delivery.h"
+#include "arena.h"
+#include "blobstore.h"
+#include "uring.h"
+#include "mailindex.h"
+#include "metrics.h"
+#include "trace.h"
+#include "searchindex.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Shared state for the workers of one send.
+// Workers claim destinations by atomically advancing nextDestination.
+// The draft and its attachment are also named relative to the draft folder
+// descriptors, so links into each mailbox never walk the sender's path.
+// terms is NULL if the message's search terms could not be found.
+typedef struct deliveryJob {
+	const char* draftFilePath;
+	const char* draftAttachmentFilePath;
+	int draftDirFD;
+	const char* draftName;
+	int attachmentDirFD;
+	const char* draftAttachmentName;
+	const char* messageName;
+	const char* attachmentName;
+	const messageRecord* record;
+	const searchTerms* terms;
+	bool maildir;
+	deliveryResult* results;
+	unsigned int numDestinations;
+	unsigned int nextDestination;
+} deliveryJob;
+
+// Errors that another attempt cannot fix
+static bool isPermanentError(int error) {
+	return error == ENOENT || error == EEXIST || error == ENOTDIR || error == ENAMETOOLONG;
+}
+
+// Delivers the message maildir-style. Links are made in the destination's tmp
+// folder and renamed into new, attachment first, so a reader never sees a
+// message without its attachment. No lock is taken.
+// Returns 0 on success, otherwise the errno of the failing step
+static int deliverToMaildir(const deliveryJob* job, const mailboxHandle* destMailbox) {
+	int error = 0;
+
+	// Folders are made on first delivery
+	if ((mkdirat(destMailbox->inboxFD, tmpStr + 1, 0600) != 0 && errno != EEXIST)
+			|| (mkdirat(destMailbox->inboxFD, newStr + 1, 0600) != 0 && errno != EEXIST)) {
+		return errno;
+	}
+
+	int tmpFD = openat(destMailbox->inboxFD, tmpStr + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	int newFD = openat(destMailbox->inboxFD, newStr + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	if (tmpFD < 0 || newFD < 0) {
+		error = errno;
+	}
+	else if (linkat(job->draftDirFD, job->draftName, tmpFD, job->messageName, 0) != 0) {
+		error = errno;
+	}
+	else if (job->attachmentName != NULL
+			&& linkat(job->attachmentDirFD, job->draftAttachmentName, tmpFD, job->attachmentName, 0) != 0) {
+		error = errno;
+		unlinkat(tmpFD, job->messageName, 0);
+	}
+	else if (job->attachmentName != NULL && renameat(tmpFD, job->attachmentName, newFD, job->attachmentName) != 0) {
+		error = errno;
+		unlinkat(tmpFD, job->messageName, 0);
+		unlinkat(tmpFD, job->attachmentName, 0);
+	}
+	// The message appears in new in one step
+	else if (renameat(tmpFD, job->messageName, newFD, job->messageName) != 0) {
+		error = errno;
+		unlinkat(tmpFD, job->messageName, 0);
+		if (job->attachmentName != NULL) {
+			unlinkat(newFD, job->attachmentName, 0);
+		}
+	}
+
+	if (tmpFD >= 0) {
+		close(tmpFD);
+	}
+	if (newFD >= 0) {
+		close(newFD);
+	}
+
+	return error;
+}
+
+// Delivers the message to one destination's unread folder.
+// Either the message, its attachment, and its index entry are all added or none are.
+// Returns 0 on success, otherwise the errno of the failing step
+static int deliverToDestination(const deliveryJob* job, const char* destUsername) {
+	mailboxHandle destMailbox;
+	int error = 0;
+
+	// A missing mailbox fails here with ENOENT
+	if (openMailbox(&destMailbox, destUsername, job->maildir ? MAILBOX_INBOX : MAILBOX_UNREAD) != 0) {
+		error = errno;
+		closeMailbox(&destMailbox);
+		return error;
+	}
+
+	if (job->maildir) {
+		error = deliverToMaildir(job, &destMailbox);
+		closeMailbox(&destMailbox);
+		return error;
+	}
+
+	int unreadFD = destMailbox.unreadFD;
+	int lockFD = openat(unreadFD, lockName + 1, O_RDONLY | O_CLOEXEC);
+
+	if (lockFD < 0) {
+		error = errno;
+		closeMailbox(&destMailbox);
+		return error;
+	}
+
+	// Appends are single writes, so senders and readers share the lock.
+	// Only compacting the destination's unread index makes a sender wait
+	uint64_t lockedAt = timedLock(lockFD, LOCK_SH);
+
+	// Link created in destination unread directory before it is logged
+	TRACE_BEGIN(TRACE_LINK);
+	if (linkat(job->draftDirFD, job->draftName, unreadFD, job->messageName, 0) != 0) {
+		error = errno;
+		TRACE_END(TRACE_LINK);
+	}
+	// Attachment link created if necessary
+	else if (job->attachmentName != NULL
+			&& linkat(job->attachmentDirFD, job->draftAttachmentName, unreadFD, job->attachmentName, 0) != 0) {
+		error = errno;
+		unlinkat(unreadFD, job->messageName, 0);
+		TRACE_END(TRACE_LINK);
+	}
+	else {
+		TRACE_END(TRACE_LINK);
+
+		// Entry added
+		if (appendMessageRecordAt(unreadFD, indexName + 1, job->record) != 0) {
+			error = errno != 0 ? errno : EIO;
+		}
+
+		// Links are undone so a retry starts clean
+		if (error) {
+			unlinkat(unreadFD, job->messageName, 0);
+			if (job->attachmentName != NULL) {
+				unlinkat(unreadFD, job->attachmentName, 0);
+			}
+		}
+	}
+
+	// Lock released
+	timedUnlock(lockFD, lockedAt);
+
+	close(lockFD);
+	closeMailbox(&destMailbox);
+
+	return error;
+}
+
+// Steps of a batched delivery, kept in the low byte of each entry's user data
+enum {
+	STEP_OPEN_LOCK,
+	STEP_OPEN_INDEX,
+	STEP_MKDIR_TMP,
+	STEP_MKDIR_NEW,
+	STEP_OPEN_TMP,
+	STEP_OPEN_NEW,
+	STEP_LINK_MESSAGE,
+	STEP_LINK_ATTACHMENT,
+	STEP_RENAME_ATTACHMENT,
+	STEP_RENAME_MESSAGE,
+	STEP_APPEND,
+	STEP_CLOSE
+};
+
+// One destination of a batched delivery. Every step is relative to the
+// destination's opened mailbox, as for synchronous delivery. Links are made
+// in unread, or in tmp for maildir-style delivery, which then renames them
+// into new. doneSteps has a bit set for every step that succeeded, and
+// lockedAt is when lockFD was locked, or 0 if it never was
+typedef struct batchDestination {
+	mailboxHandle mailbox;
+	int tmpFD;
+	int newFD;
+	int lockFD;
+	uint64_t lockedAt;
+	unsigned int doneSteps;
+	int error;
+} batchDestination;
+
+// Completion handler. Keeps the first real error of each destination
+static void recordBatchCompletion(void* context, uint64_t userData, int32_t result) {
+	batchDestination* destination = &((batchDestination*) context)[userData >> 8];
+	unsigned int step = userData & 0xff;
+
+	if (step == STEP_APPEND && result >= 0 && result != sizeof(messageRecord)) {
+		result = -EIO;
+	}
+
+	if (result >= 0) {
+		destination->doneSteps |= 1u << step;
+		if (step == STEP_OPEN_LOCK) {
+			destination->lockFD = result;
+		}
+		else if (step == STEP_OPEN_TMP) {
+			destination->tmpFD = result;
+		}
+		else if (step == STEP_OPEN_NEW) {
+			destination->newFD = result;
+		}
+	}
+	// Entries after a failed one in a chain are cancelled, and existing folders are fine.
+	// Closing comes after delivery, so it cannot fail one
+	else if (result != -ECANCELED && !((step == STEP_MKDIR_TMP || step == STEP_MKDIR_NEW) && result == -EEXIST)
+			&& step != STEP_CLOSE && destination->error == 0) {
+		destination->error = -result;
+	}
+}
+
+// Queues one entry for a destination. The ring always has room for a whole batch
+static struct io_uring_sqe* queueStep(uring* ring, uint8_t opcode, unsigned int destination, unsigned int step, uint8_t flags) {
+	struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->flags = flags;
+	sqe->fd = AT_FDCWD;
+	sqe->user_data = (uint64_t) destination << 8 | step;
+
+	return sqe;
+}
+
+static void queueOpen(uring* ring, int dirFD, const char* name, int openFlags, unsigned int destination, unsigned int step, uint8_t flags) {
+	struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_OPENAT, destination, step, flags);
+
+	sqe->fd = dirFD;
+	sqe->addr = (uintptr_t) name;
+	sqe->open_flags = openFlags;
+}
+
+static void queueLink(uring* ring, int oldDirFD, const char* oldName, int newDirFD, const char* newName,
+		unsigned int destination, unsigned int step, uint8_t flags) {
+	struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_LINKAT, destination, step, flags);
+
+	sqe->fd = oldDirFD;
+	sqe->addr = (uintptr_t) oldName;
+	sqe->len = newDirFD;
+	sqe->addr2 = (uintptr_t) newName;
+}
+
+static void queueRename(uring* ring, int oldDirFD, const char* oldName, int newDirFD, const char* newName,
+		unsigned int destination, unsigned int step, uint8_t flags) {
+	struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_RENAMEAT, destination, step, flags);
+
+	sqe->fd = oldDirFD;
+	sqe->addr = (uintptr_t) oldName;
+	sqe->len = newDirFD;
+	sqe->addr2 = (uintptr_t) newName;
+}
+
+static void queueMkdir(uring* ring, int dirFD, const char* name, unsigned int destination, unsigned int step) {
+	// Hard links keep the chain going when the folder already exists
+	struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_MKDIRAT, destination, step, IOSQE_IO_HARDLINK);
+
+	sqe->fd = dirFD;
+	sqe->addr = (uintptr_t) name;
+	sqe->len = 0600;
+}
+
+// Delivers one batch through the ring.
+// Each destination's mailbox is opened first, as synchronous delivery opens
+// it, so nothing in the ring walks a path from the root or follows a symlink.
+// Unread index delivery takes three round trips: the lock files are opened,
+// then each destination's index is opened, the links made, and the record
+// appended as one linked chain, then everything is closed. The shared locks
+// are taken in between, since io_uring has no flock. Maildir-style delivery
+// takes two: tmp and new are made and opened, then linked and renamed into.
+// Returns 0 if the batch went through the ring, -1 if the destinations it did
+// not finish must be delivered synchronously
+static int deliverBatch(uring* ring, const deliveryJob* job, batchDestination* batch, unsigned int count) {
+	bool attachment = job->attachmentName != NULL;
+	uint64_t start = metricsClock();
+
+	TRACE_BEGIN(TRACE_URING_BATCH);
+
+	// A missing mailbox fails here with ENOENT
+	for (unsigned int i = 0; i < count; i++) {
+		batchDestination* destination = &batch[i];
+
+		memset(destination, 0, sizeof(batchDestination));
+		destination->lockFD = destination->tmpFD = destination->newFD = -1;
+
+		if (openMailbox(&destination->mailbox, job->results[i].username, job->maildir ? MAILBOX_INBOX : MAILBOX_UNREAD) != 0) {
+			destination->error = errno;
+		}
+	}
+
+	int status = 0;
+
+	if (job->maildir) {
+		for (unsigned int i = 0; i < count; i++) {
+			batchDestination* destination = &batch[i];
+			int inboxFD = destination->mailbox.inboxFD;
+
+			if (destination->error != 0) {
+				continue;
+			}
+			queueMkdir(ring, inboxFD, tmpStr + 1, i, STEP_MKDIR_TMP);
+			queueMkdir(ring, inboxFD, newStr + 1, i, STEP_MKDIR_NEW);
+			queueOpen(ring, inboxFD, tmpStr + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, i, STEP_OPEN_TMP, IOSQE_IO_LINK);
+			queueOpen(ring, inboxFD, newStr + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, i, STEP_OPEN_NEW, 0);
+		}
+		status = uringSubmitAndWait(ring, recordBatchCompletion, batch);
+
+		unsigned int numQueued = 0;
+
+		for (unsigned int i = 0; i < count && status == 0; i++) {
+			batchDestination* destination = &batch[i];
+
+			if (destination->error != 0 || destination->tmpFD < 0 || destination->newFD < 0) {
+				continue;
+			}
+			queueLink(ring, job->draftDirFD, job->draftName, destination->tmpFD, job->messageName, i, STEP_LINK_MESSAGE, IOSQE_IO_LINK);
+			if (attachment) {
+				queueLink(ring, job->attachmentDirFD, job->draftAttachmentName, destination->tmpFD, job->attachmentName,
+					i, STEP_LINK_ATTACHMENT, IOSQE_IO_LINK);
+				queueRename(ring, destination->tmpFD, job->attachmentName, destination->newFD, job->attachmentName,
+					i, STEP_RENAME_ATTACHMENT, IOSQE_IO_LINK);
+			}
+			queueRename(ring, destination->tmpFD, job->messageName, destination->newFD, job->messageName, i, STEP_RENAME_MESSAGE, 0);
+			numQueued++;
+		}
+		if (numQueued > 0 && status == 0) {
+			status = uringSubmitAndWait(ring, recordBatchCompletion, batch);
+		}
+
+		// Anything left half done is undone so a retry starts clean, even when
+		// the ring failed and the synchronous path will deliver it again
+		for (unsigned int i = 0; i < count; i++) {
+			batchDestination* destination = &batch[i];
+
+			if (destination->doneSteps & 1u << STEP_RENAME_MESSAGE) {
+				continue;
+			}
+			if ((destination->doneSteps & 1u << STEP_LINK_MESSAGE) && !(destination->doneSteps & 1u << STEP_RENAME_MESSAGE)) {
+				unlinkat(destination->tmpFD, job->messageName, 0);
+			}
+			if ((destination->doneSteps & 1u << STEP_LINK_ATTACHMENT) && !(destination->doneSteps & 1u << STEP_RENAME_ATTACHMENT)) {
+				unlinkat(destination->tmpFD, job->attachmentName, 0);
+			}
+			if (destination->doneSteps & 1u << STEP_RENAME_ATTACHMENT) {
+				unlinkat(destination->newFD, job->attachmentName, 0);
+			}
+		}
+	}
+	else {
+		unsigned int numQueued = 0;
+
+		for (unsigned int i = 0; i < count; i++) {
+			if (batch[i].error == 0) {
+				queueOpen(ring, batch[i].mailbox.unreadFD, lockName + 1, O_RDONLY | O_CLOEXEC, i, STEP_OPEN_LOCK, 0);
+				numQueued++;
+			}
+		}
+		if (numQueued > 0) {
+			status = uringSubmitAndWait(ring, recordBatchCompletion, batch);
+		}
+
+		numQueued = 0;
+
+		for (unsigned int i = 0; i < count && status == 0; i++) {
+			batchDestination* destination = &batch[i];
+			int unreadFD = destination->mailbox.unreadFD;
+
+			if (destination->lockFD < 0) {
+				continue;
+			}
+
+			// Appends share the lock, only compaction of the unread index waits on it
+			destination->lockedAt = timedLock(destination->lockFD, LOCK_SH);
+
+			// The index is opened into fixed file slot i so the append can follow in the same chain
+			struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_OPENAT, i, STEP_OPEN_INDEX, IOSQE_IO_LINK);
+			sqe->fd = unreadFD;
+			sqe->addr = (uintptr_t) (indexName + 1);
+			sqe->open_flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+			sqe->len = 0644;
+			sqe->file_index = i + 1;
+
+			queueLink(ring, job->draftDirFD, job->draftName, unreadFD, job->messageName, i, STEP_LINK_MESSAGE, IOSQE_IO_LINK);
+			if (attachment) {
+				queueLink(ring, job->attachmentDirFD, job->draftAttachmentName, unreadFD, job->attachmentName,
+					i, STEP_LINK_ATTACHMENT, IOSQE_IO_LINK);
+			}
+
+			sqe = queueStep(ring, IORING_OP_WRITE, i, STEP_APPEND, IOSQE_FIXED_FILE);
+			sqe->fd = i;
+			sqe->addr = (uintptr_t) job->record;
+			sqe->len = sizeof(messageRecord);
+			sqe->off = (uint64_t) -1;
+			numQueued++;
+		}
+		if (numQueued > 0 && status == 0) {
+			status = uringSubmitAndWait(ring, recordBatchCompletion, batch);
+		}
+
+		numQueued = 0;
+
+		for (unsigned int i = 0; i < count; i++) {
+			batchDestination* destination = &batch[i];
+
+			// Links are undone while the lock is still held, even when the ring
+			// failed and the synchronous path will deliver the message again
+			if (!(destination->doneSteps & 1u << STEP_APPEND)) {
+				if (destination->doneSteps & 1u << STEP_LINK_MESSAGE) {
+					unlinkat(destination->mailbox.unreadFD, job->messageName, 0);
+				}
+				if (destination->doneSteps & 1u << STEP_LINK_ATTACHMENT) {
+					unlinkat(destination->mailbox.unreadFD, job->attachmentName, 0);
+				}
+			}
+
+			// Released here rather than by the ring's close, so the hold is recorded
+			if (destination->lockedAt != 0) {
+				timedUnlock(destination->lockFD, destination->lockedAt);
+			}
+
+			if (destination->doneSteps & 1u << STEP_OPEN_INDEX) {
+				struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_CLOSE, i, STEP_CLOSE, 0);
+				sqe->fd = 0;
+				sqe->file_index = i + 1;
+				numQueued++;
+			}
+			if (destination->lockFD >= 0) {
+				struct io_uring_sqe* sqe = queueStep(ring, IORING_OP_CLOSE, i, STEP_CLOSE, 0);
+				sqe->fd = destination->lockFD;
+				numQueued++;
+			}
+		}
+		if (numQueued > 0 && uringSubmitAndWait(ring, recordBatchCompletion, batch) != 0) {
+			for (unsigned int i = 0; i < count; i++) {
+				if (batch[i].lockFD >= 0) {
+					close(batch[i].lockFD);
+				}
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		batchDestination* destination = &batch[i];
+
+		if (destination->tmpFD >= 0) {
+			close(destination->tmpFD);
+		}
+		if (destination->newFD >= 0) {
+			close(destination->newFD);
+		}
+		closeMailbox(&destination->mailbox);
+
+		// A ring failure leaves every destination the ring did not finish to the
+		// synchronous path. Every destination in a batch waited on the whole batch
+		if (status == 0 || destination->doneSteps & 1u << (job->maildir ? STEP_RENAME_MESSAGE : STEP_APPEND)) {
+			job->results[i].attempts = 1;
+			job->results[i].error = destination->error;
+			job->results[i].delivered = destination->error == 0;
+			recordMetric(METRIC_DELIVERY, start, 0);
+		}
+	}
+
+	TRACE_END(TRACE_URING_BATCH);
+
+	return status;
+}
+
+// Delivers to every destination through io_uring, URING_BATCH_SIZE at a time.
+// Destinations it could not reach are left for the synchronous workers
+static void deliverWithUring(deliveryJob* job) {
+	uring ring;
+
+	if (uringInit(&ring, URING_BATCH_SIZE * URING_STEPS_PER_DESTINATION, URING_BATCH_SIZE) != 0) {
+		return;
+	}
+
+	batchDestination* batch = malloc(URING_BATCH_SIZE * sizeof(batchDestination));
+	deliveryResult* allResults = job->results;
+
+	for (unsigned int first = 0; first < job->numDestinations; first += URING_BATCH_SIZE) {
+		unsigned int count = job->numDestinations - first < URING_BATCH_SIZE ? job->numDestinations - first : URING_BATCH_SIZE;
+
+		job->results = allResults + first;
+		if (deliverBatch(&ring, job, batch, count) != 0) {
+			break;
+		}
+	}
+	job->results = allResults;
+
+	free(batch);
+	uringClose(&ring);
+}
+
+// Finds the name to pass with a directory descriptor for a file.
+// Returns dirFD with the file's name in it if the file is directly inside
+// dirPath, otherwise AT_FDCWD with the whole path
+static int nameInDirectory(int dirFD, const char* dirPath, const char* path, const char** name) {
+	size_t dirLength = strlen(dirPath);
+
+	if (dirFD >= 0 && !strncmp(path, dirPath, dirLength) && path[dirLength] == '/' && strchr(path + dirLength + 1, '/') == NULL) {
+		*name = path + dirLength + 1;
+		return dirFD;
+	}
+
+	*name = path;
+	return AT_FDCWD;
+}
+
+// True if a destination has not been delivered to and is still worth another attempt
+static bool needsDelivery(const deliveryResult* result) {
+	return !result->delivered && !isPermanentError(result->error) && result->attempts < MAX_DELIVERY_ATTEMPTS;
+}
+
+// True if a worker still has something to do for a destination
+static bool needsWorker(const deliveryJob* job, const deliveryResult* result) {
+	return needsDelivery(result) || (result->delivered && job->terms != NULL);
+}
+
+// Worker loop. Delivers to unclaimed destinations until none are left, and
+// logs each delivered message to its destination's search index
+static void* deliveryWorker(void* arg) {
+	deliveryJob* job = arg;
+	unsigned int i;
+
+	// Each destination's paths reuse the same arena space
+	arena pathMemory;
+	initArena(&pathMemory, ARENA_BLOCK_SIZE);
+	arenaMark destinationStart = markArena(&pathMemory);
+
+	while ((i = __atomic_fetch_add(&job->nextDestination, 1, __ATOMIC_RELAXED)) < job->numDestinations) {
+		deliveryResult* result = &job->results[i];
+
+		// Destinations settled by the io_uring backend are only logged
+		if (needsDelivery(result)) {
+			uint64_t start = metricsClock();
+			TRACE_BEGIN(TRACE_DELIVERY);
+
+			// Retries back off 10ms, then 20ms
+			do {
+				result->attempts++;
+				result->error = deliverToDestination(job, result->username);
+				result->delivered = result->error == 0;
+
+				if (needsDelivery(result)) {
+					usleep(10000 << (result->attempts - 1));
+				}
+			} while (needsDelivery(result));
+
+			TRACE_END(TRACE_DELIVERY);
+			recordMetric(METRIC_DELIVERY, start, 0);
+		}
+
+		// Logged here so a destination compacting its search log only holds up this worker
+		paths destPaths;
+
+		if (result->delivered && job->terms != NULL && generatePathsInArena(&destPaths, result->username, &pathMemory) == 0) {
+			addToSearchIndex(&destPaths, 'u', job->record, job->terms);
+			resetArena(&pathMemory, destinationStart);
+		}
+	}
+
+	freeArena(&pathMemory);
+
+	return NULL;
+}
+
+int deliverDraft(const char* username, paths* userPaths, const char* draftFilePath,
+		const char* draftAttachmentFilePath, const char* destinationsFilePath,
+		unsigned int numDestinations, deliveryResult* results) {
+	bool attachment = draftAttachmentFilePath != NULL;
+	int failures = 0;
+
+	TRACE_BEGIN(TRACE_SEND);
+
+	// Destinations are read up front so workers never share the file
+	FILE* destinationsFile = fopen(destinationsFilePath, "r");
+	unsigned int numRead = 0;
+
+	while (destinationsFile != NULL && numRead < numDestinations
+			&& fscanf(destinationsFile, "%32s", results[numRead].username) == 1) {
+		results[numRead].delivered = false;
+		results[numRead].attempts = 0;
+		results[numRead].error = 0;
+		numRead++;
+	}
+	if (destinationsFile != NULL) {
+		fclose(destinationsFile);
+	}
+
+	// Destinations missing from the file are reported as failed
+	for (unsigned int i = numRead; i < numDestinations; i++) {
+		strcpy(results[i].username, "?");
+		results[i].delivered = false;
+		results[i].attempts = 0;
+		results[i].error = ENOENT;
+	}
+
+	int64_t timestamp;
+	char* messageId = generateMessageId(&timestamp);
+
+	// Names for this send come from one arena, released together at the end
+	arena sendMemory;
+	initArena(&sendMemory, ARENA_BLOCK_SIZE);
+
+	// Filenames are generated for both the sender's sent folder and the unread folders of the destinations
+	char* sentName = arenaPrintf(&sendMemory, "%s/%s", userPaths->sentPath, messageId);
+	char* sentDestinations = arenaPrintf(&sendMemory, "%s/%s_destinations.txt", userPaths->sentPath, messageId);
+
+	// Body and attachment are swapped for shared blobs before any links are made,
+	// so every mailbox entry below points at the one stored copy.
+	// A file the store cannot take is still delivered as its own copy
+	ingestBlob(draftFilePath, numRead + 1);
+	if (attachment) {
+		ingestBlob(draftAttachmentFilePath, numRead + 1);
+	}
+
+	// moves draft from draft to sent folder
+	TRACE_BEGIN(TRACE_LINK);
+	if (link(draftFilePath, sentName) != 0 || link(destinationsFilePath, sentDestinations) != 0) {
+		perror("Error saving sent message");
+	}
+	TRACE_END(TRACE_LINK);
+
+	// Header is read once here and copied into every index record
+	messageRecord record;
+	buildMessageRecord(&record, draftFilePath, messageId, timestamp);
+	record.recipientCount = numRead;
+	if (numRead > 0) {
+		strcpy(record.firstRecipient, results[0].username);
+	}
+
+	// Logs sending
+	appendMessageRecord(userPaths->sentIndex, &record);
+
+	char* destFileMessageName = arenaPrintf(&sendMemory, "%s_%s", username, messageId);
+	char* attachmentName;
+
+	// attachment moved if necessary
+	if (attachment) {
+		attachmentName = arenaPrintf(&sendMemory, "%s_%s", destFileMessageName, "attachment");
+
+		link(draftAttachmentFilePath, arenaPrintf(&sendMemory, "%s_%s", sentName, "attachment"));
+	}
+	else {
+		attachmentName = NULL;
+	}
+
+	// Destinations index the message under <sender>_<time>
+	messageRecord sentRecord = record;
+	snprintf(record.name, sizeof(record.name), "%s", destFileMessageName);
+
+	// Terms are found once and logged to the sender's index here, and to every
+	// mailbox that gets the message by whichever worker delivered to it
+	searchTerms terms;
+	bool haveTerms = extractSearchTerms(draftFilePath, &sentRecord, &terms) == 0;
+
+	if (haveTerms) {
+		addToSearchIndex(userPaths, 's', &sentRecord, &terms);
+	}
+
+	struct stat flagStat;
+
+	// Drafts in the sender's draft folder are linked relative to it
+	int draftDirFD = open(userPaths->draftPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	deliveryJob job = {
+		.draftFilePath = draftFilePath,
+		.draftAttachmentFilePath = draftAttachmentFilePath,
+		.draftDirFD = nameInDirectory(draftDirFD, userPaths->draftPath, draftFilePath, &job.draftName),
+		.attachmentDirFD = attachment ? nameInDirectory(draftDirFD, userPaths->draftPath, draftAttachmentFilePath, &job.draftAttachmentName) : AT_FDCWD,
+		.messageName = destFileMessageName,
+		.attachmentName = attachmentName,
+		.record = &record,
+		.terms = haveTerms ? &terms : NULL,
+		.maildir = stat(maildirFlagFilename, &flagStat) == 0,
+		.results = results,
+		.numDestinations = numRead,
+		.nextDestination = 0
+	};
+
+	// Batched delivery goes first when enabled. Whatever it leaves is retried
+	// synchronously, and what it delivered is still logged by the workers
+	unsigned int numRemaining = numRead;
+
+	if (stat(uringFlagFilename, &flagStat) == 0) {
+		deliverWithUring(&job);
+
+		numRemaining = 0;
+		for (unsigned int i = 0; i < numRead; i++) {
+			if (needsWorker(&job, &results[i])) {
+				numRemaining++;
+			}
+		}
+	}
+
+	unsigned int numWorkers = numRemaining < MAX_DELIVERY_WORKERS ? numRemaining : MAX_DELIVERY_WORKERS;
+	pthread_t workers[MAX_DELIVERY_WORKERS];
+	unsigned int numStarted = 0;
+
+	// The calling thread is one of the workers, so a single destination spawns nothing
+	for (unsigned int i = 1; i < numWorkers; i++) {
+		if (pthread_create(&workers[numStarted], NULL, deliveryWorker, &job) == 0) {
+			numStarted++;
+		}
+	}
+
+	if (numRemaining > 0) {
+		deliveryWorker(&job);
+	}
+
+	for (unsigned int i = 0; i < numStarted; i++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	for (unsigned int i = 0; i < numDestinations; i++) {
+		if (!results[i].delivered) {
+			failures++;
+		}
+	}
+
+	if (haveTerms) {
+		freeSearchTerms(&terms);
+	}
+
+	if (draftDirFD >= 0) {
+		close(draftDirFD);
+	}
+
+	// Clears out user's draft folder
+	remove(draftFilePath);
+	remove(destinationsFilePath);
+	if (attachment) {
+		remove(draftAttachmentFilePath);
+	}
+
+	free(messageId);
+	freeArena(&sendMemory);
+
+	TRACE_END(TRACE_SEND);
+
+	return failures;
+}
+
+void removeStaleDeliveries(const char* tmpPath) {
+	DIR* tmpDir = opendir(tmpPath);
+	if (tmpDir == NULL) {
+		return;
+	}
+
+	time_t now = time(NULL);
+	struct dirent* entry;
+
+	while ((entry = readdir(tmpDir)) != NULL) {
+		struct stat entryStat;
+
+		// A sender still delivering renames its entries away within moments
+		if (entry->d_name[0] != '.' && fstatat(dirfd(tmpDir), entry->d_name, &entryStat, AT_SYMLINK_NOFOLLOW) == 0
+				&& now - entryStat.st_ctime > STALE_DELIVERY_SECONDS) {
+			unlinkat(dirfd(tmpDir), entry->d_name, 0);
+		}
+	}
+	closedir(tmpDir);
+}
@@ -0,0 +1,51 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include <stdbool.h>
+
+#include "mailbox.h"
+
+// Upper bound on worker threads used for one send
+#define MAX_DELIVERY_WORKERS 16
+
+// Attempts made for each destination before it is reported as failed
+#define MAX_DELIVERY_ATTEMPTS 3
+
+// Outcome of delivering a message to one destination
+typedef struct deliveryResult {
+	char username[33];
+	bool delivered;
+	int attempts;
+	int error;
+} deliveryResult;
+
+// Destinations handled per io_uring round trip, and the most ring entries one needs
+#define URING_BATCH_SIZE 64
+#define URING_STEPS_PER_DESTINATION 6
+
+// Seconds a maildir-style delivery may sit in tmp before it is treated as abandoned
+#define STALE_DELIVERY_SECONDS (36 * 60 * 60)
+
+// Delivers a finished draft to every user listed in the destinations file.
+// The draft, its destinations list, and its attachment (NULL if none) are linked
+// into the sender's sent folder and each destination's unread folder, then
+// removed from the drafts folder. If maildirFlagFilename exists, destinations
+// receive the message through inbox/tmp and inbox/new without taking any lock.
+// If uringFlagFilename exists, destinations are first delivered in batches
+// through io_uring, with anything that fails retried synchronously.
+// Destinations are spread over a bounded pool of worker threads and each one
+// is retried on transient errors.
+// results must hold numDestinations entries and receives one per destination.
+// Returns the number of destinations the message could not be delivered to
+int deliverDraft(const char* username, paths* userPaths, const char* draftFilePath,
+		const char* draftAttachmentFilePath, const char* destinationsFilePath,
+		unsigned int numDestinations, deliveryResult* results);
+
+// Removes deliveries a sender abandoned in a maildir-style tmp folder
+void removeStaleDeliveries(const char* tmpPath);
+
+#endif
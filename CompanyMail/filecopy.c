@@ -0,0 +1,217 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "filecopy.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Largest request handed to the kernel in one call
+#define KERNEL_COPY_CHUNK (1 << 30)
+
+// Errors meaning the kernel cannot do this kind of copy, rather than a failed copy
+static bool isUnsupportedCopy(int error) {
+	return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == EBADF;
+}
+
+// Writes all of a buffer, retrying on short writes
+static int writeAll(int destFD, const char* buffer, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(destFD, buffer, length);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buffer += written;
+		length -= written;
+	}
+
+	return 0;
+}
+
+int copyFileData(int srcFD, int destFD) {
+	ssize_t copied;
+
+	// Both offsets advance as the kernel copies, so any fallback below
+	// carries on from wherever the previous method stopped
+	while ((copied = copy_file_range(srcFD, NULL, destFD, NULL, KERNEL_COPY_CHUNK, 0)) != 0) {
+		if (copied < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (!isUnsupportedCopy(errno)) {
+				return -1;
+			}
+			break;
+		}
+	}
+	if (copied == 0) {
+		return 0;
+	}
+
+	// sendfile needs a source that can be mapped, so pipes fall through
+	while ((copied = sendfile(destFD, srcFD, NULL, KERNEL_COPY_CHUNK)) != 0) {
+		if (copied < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (!isUnsupportedCopy(errno)) {
+				return -1;
+			}
+			break;
+		}
+	}
+	if (copied == 0) {
+		return 0;
+	}
+
+	char* buffer;
+	if (posix_memalign((void**) &buffer, 4096, COPY_BUFFER_SIZE) != 0) {
+		return -1;
+	}
+
+	int status = 0;
+	ssize_t bytes_read;
+
+	while ((bytes_read = read(srcFD, buffer, COPY_BUFFER_SIZE)) != 0) {
+		if (bytes_read < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			status = -1;
+			break;
+		}
+		if (writeAll(destFD, buffer, bytes_read) != 0) {
+			status = -1;
+			break;
+		}
+	}
+
+	free(buffer);
+
+	return status;
+}
+
+int openAsRealUser(const char* path) {
+	unsigned int euid = geteuid();
+
+	// Only the effective UID changes so root can be restored afterwards
+	seteuid(getuid());
+	int fileFD = open(path, O_RDONLY | O_CLOEXEC);
+	int openError = errno;
+	seteuid(euid);
+
+	errno = openError;
+
+	return fileFD;
+}
+
+int copyFile(const char *src_filename, const char *dest_filename, bool dropPerms) {
+	// Opens source file with the program's permissions
+	int srcFD = open(src_filename, O_RDONLY);
+    if (srcFD < 0) {
+        perror("Error opening source file");
+        return -1;
+    }
+
+	int status = copyFileFrom(srcFD, dest_filename, dropPerms);
+	close(srcFD);
+
+	return status;
+}
+
+int copyFileFrom(int srcFD, const char *dest_filename, bool dropPerms) {
+	uint64_t start = metricsClock();
+
+	unsigned int euid = geteuid();
+	unsigned int ruid = getuid();
+
+	// drops root perms when creating the destination file.
+	// Only the effective UID changes so root can be restored afterwards
+	if (dropPerms) {
+		seteuid(ruid);
+	}
+
+	int destFD = open(dest_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if (dropPerms) {
+		seteuid(euid);
+	}
+
+    if (destFD < 0) {
+        perror("Error opening destination file");
+        return -1;
+    }
+
+	// A reflink shares the source's blocks and costs no data copy at all
+	int status = 0;
+	TRACE_BEGIN(TRACE_COPY);
+	if (ioctl(destFD, FICLONE, srcFD) != 0) {
+		status = copyFileData(srcFD, destFD);
+	}
+	TRACE_END(TRACE_COPY);
+
+	if (status != 0) {
+		perror("Error copying file");
+	}
+
+	struct stat destStat;
+	if (status == 0 && fstat(destFD, &destStat) == 0) {
+		recordMetric(METRIC_FILE_COPY, start, destStat.st_size);
+	}
+
+    if (close(destFD) != 0) {
+		status = -1;
+	}
+
+    return status;
+}
+
+int appendFile(const char *src_filename, const char *dest_filename) {
+    int srcFD = open(src_filename, O_RDONLY);
+    if (srcFD < 0) {
+        perror("Error opening source file");
+        return -1;
+    }
+
+    // copy_file_range refuses O_APPEND destinations, so the end is found by seeking
+    int destFD = open(dest_filename, O_WRONLY | O_CREAT, 0666);
+    if (destFD < 0 || lseek(destFD, 0, SEEK_END) < 0) {
+        perror("Error opening destination file");
+        close(srcFD);
+        if (destFD >= 0) {
+			close(destFD);
+		}
+        return -1;
+    }
+
+	TRACE_BEGIN(TRACE_COPY);
+	int status = copyFileData(srcFD, destFD);
+	TRACE_END(TRACE_COPY);
+
+	if (status != 0) {
+		perror("Error writing to destination file");
+	}
+
+    close(srcFD);
+    if (close(destFD) != 0) {
+		status = -1;
+	}
+
+    return status;
+}
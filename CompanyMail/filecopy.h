@@ -0,0 +1,38 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef FILECOPY_H
+#define FILECOPY_H
+
+#include <stdbool.h>
+
+// Size of the aligned buffer used when the kernel cannot copy for us
+#define COPY_BUFFER_SIZE (1 << 20)
+
+// Copies everything from the current offset of srcFD to the current offset
+// of destFD. Data stays in the kernel where possible (copy_file_range, then
+// sendfile) and falls back to an aligned buffer for pipes and terminals.
+// Binary safe. Returns 0 on success, -1 on failure
+int copyFileData(int srcFD, int destFD);
+
+// Opens a file for reading with the real user's permissions rather than the
+// program's, so a path the user names is checked and opened in one step.
+// Returns the descriptor, or -1 with errno set
+int openAsRealUser(const char* path);
+
+// Copies everything in an open source file to a destination, as copyFile() does.
+// srcFD is left open. Returns 0 on success, -1 on failure
+int copyFileFrom(int srcFD, const char *dest_filename, bool dropPerms);
+
+// Copies a file from a source to a destination
+// Root permissions will be dropped when creating the destination file if
+// dropPerms is true. Tries a reflink first on filesystems that support one.
+// Returns 0 on success, -1 on failure
+int copyFile(const char *src_filename, const char *dest_filename, bool dropPerms);
+
+// Appends the contents of a source file to a destination file
+// Returns 0 on success, -1 on failure
+int appendFile(const char *src_filename, const char *dest_filename);
+
+#endif
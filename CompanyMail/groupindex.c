@@ -0,0 +1,487 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "groupindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LENGTH 1024
+
+// Separators between the members of a group
+#define MEMBER_SEPARATORS ", \t"
+
+// A group's members while the index is built, as positions in the sorted users
+typedef struct expansion {
+	uint32_t* members;
+	uint32_t count;
+	uint32_t capacity;
+
+	// Depth first visit number, 0 until visited, and the lowest visit number
+	// reachable from the group through groups still being expanded
+	uint32_t order;
+	uint32_t lowLink;
+	bool onStack;
+} expansion;
+
+// Everything needed to flatten the groups
+typedef struct groupBuilder {
+	char (*users)[USERNAME_LENGTH];
+	size_t numUsers;
+	groupDefinition* groups;
+	size_t numGroups;
+	expansion* expansions;
+	FILE* report;
+
+	// Groups visited but not yet assigned their final members
+	uint32_t* stack;
+	size_t stackSize;
+	uint32_t nextOrder;
+} groupBuilder;
+
+// Records the mtime and size of a file, or zeros if it does not exist
+static void statSignature(const char* filename, int64_t* mtimeSec, int64_t* mtimeNsec, int64_t* size) {
+	struct stat fileStat;
+
+	if (stat(filename, &fileStat) != 0) {
+		*mtimeSec = 0;
+		*mtimeNsec = 0;
+		*size = -1;
+		return;
+	}
+
+	*mtimeSec = fileStat.st_mtim.tv_sec;
+	*mtimeNsec = fileStat.st_mtim.tv_nsec;
+	*size = fileStat.st_size;
+}
+
+// True if neither source file changed since the index was built
+static bool sourcesUnchanged(const groupIndexHeader* header, const char* groupsFilename, const char* usersFilename) {
+	int64_t mtimeSec, mtimeNsec, size;
+
+	statSignature(groupsFilename, &mtimeSec, &mtimeNsec, &size);
+	if (mtimeSec != header->groupsMtimeSec || mtimeNsec != header->groupsMtimeNsec || size != header->groupsSize) {
+		return false;
+	}
+
+	statSignature(usersFilename, &mtimeSec, &mtimeNsec, &size);
+	return mtimeSec == header->usersMtimeSec && mtimeNsec == header->usersMtimeNsec && size == header->usersSize;
+}
+
+static int compareNames(const void* a, const void* b) {
+	return strcmp((const char*) a, (const char*) b);
+}
+
+static int compareMembers(const void* a, const void* b) {
+	uint32_t first = *(const uint32_t*) a;
+	uint32_t second = *(const uint32_t*) b;
+
+	return first < second ? -1 : first > second;
+}
+
+bool validGroupName(const char* name) {
+	return name[0] != '\0' && name[0] != '.' && strlen(name) < USERNAME_LENGTH
+		&& strpbrk(name, "/:@, \t\n") == NULL;
+}
+
+int readGroupDefinitions(const char* groupsFilename, groupDefinition** groups, size_t* count) {
+	*groups = NULL;
+	*count = 0;
+
+	FILE* groupsFile = fopen(groupsFilename, "r");
+	if (groupsFile == NULL) {
+		return 0;
+	}
+
+	size_t capacity = 0;
+	char* line = NULL;
+	size_t lineCapacity = 0;
+
+	while (getline(&line, &lineCapacity, groupsFile) > 0) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		char* members = strchr(line, ':');
+		if (members == NULL) {
+			continue;
+		}
+		*members++ = '\0';
+
+		if (!validGroupName(line)) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 16;
+			*groups = realloc(*groups, capacity * sizeof(groupDefinition));
+		}
+
+		groupDefinition* group = &(*groups)[(*count)++];
+		strcpy(group->name, line);
+		group->members = strdup(members);
+	}
+	free(line);
+	fclose(groupsFile);
+
+	return 0;
+}
+
+int writeGroupDefinitions(const char* groupsFilename, const groupDefinition* groups, size_t count) {
+	char tempFilename[strlen(groupsFilename) + strlen(".tmp") + 1];
+	sprintf(tempFilename, "%s.tmp", groupsFilename);
+
+	FILE* groupsFile = fopen(tempFilename, "w");
+	if (groupsFile == NULL) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		fprintf(groupsFile, "%s:%s\n", groups[i].name, groups[i].members);
+	}
+
+	if (fclose(groupsFile) != 0 || rename(tempFilename, groupsFilename) != 0) {
+		remove(tempFilename);
+		return -1;
+	}
+
+	return 0;
+}
+
+void freeGroupDefinitions(groupDefinition* groups, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(groups[i].members);
+	}
+	free(groups);
+}
+
+// Reads the usernames of the users file, sorted and without repeats
+static char (*readUsernames(const char* usersFilename, size_t* count))[USERNAME_LENGTH] {
+	*count = 0;
+
+	FILE* users = fopen(usersFilename, "r");
+	if (users == NULL) {
+		return NULL;
+	}
+
+	size_t capacity = 256;
+	char (*names)[USERNAME_LENGTH] = malloc(capacity * USERNAME_LENGTH);
+	char line[MAX_LINE_LENGTH];
+
+	// Users file lines are username:uid
+	while (fgets(line, sizeof(line), users) != NULL) {
+		char* savePtr;
+		char* username = strtok_r(line, ":\n", &savePtr);
+
+		if (username == NULL || strlen(username) >= USERNAME_LENGTH) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity *= 2;
+			names = realloc(names, capacity * USERNAME_LENGTH);
+		}
+		strcpy(names[(*count)++], username);
+	}
+	fclose(users);
+
+	qsort(names, *count, USERNAME_LENGTH, compareNames);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < *count; i++) {
+		if (kept == 0 || strcmp(names[kept - 1], names[i]) != 0) {
+			memmove(names[kept++], names[i], USERNAME_LENGTH);
+		}
+	}
+	*count = kept;
+
+	return names;
+}
+
+static void addMember(expansion* group, uint32_t member) {
+	if (group->count == group->capacity) {
+		group->capacity = group->capacity > 0 ? group->capacity * 2 : 16;
+		group->members = realloc(group->members, group->capacity * sizeof(uint32_t));
+	}
+	group->members[group->count++] = member;
+}
+
+// Sorts a group's members by name and drops repeats
+static void sortMembers(expansion* group) {
+	qsort(group->members, group->count, sizeof(uint32_t), compareMembers);
+
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < group->count; i++) {
+		if (kept == 0 || group->members[kept - 1] != group->members[i]) {
+			group->members[kept++] = group->members[i];
+		}
+	}
+	group->count = kept;
+}
+
+// Flattens one group, expanding each nested group once. Groups that nest in
+// a loop are found as one strongly connected component (Tarjan) and all get
+// the union of their members, whatever order they are reached in
+static void expandGroup(groupBuilder* builder, size_t groupNumber) {
+	groupDefinition* definition = &builder->groups[groupNumber];
+	expansion* group = &builder->expansions[groupNumber];
+
+	group->order = group->lowLink = ++builder->nextOrder;
+	group->onStack = true;
+	builder->stack[builder->stackSize++] = groupNumber;
+
+	char* members = strdup(definition->members);
+	char* savePtr;
+
+	for (char* member = strtok_r(members, MEMBER_SEPARATORS, &savePtr); member != NULL;
+			member = strtok_r(NULL, MEMBER_SEPARATORS, &savePtr)) {
+		if (member[0] != GROUP_PREFIX) {
+			char (*user)[USERNAME_LENGTH] = strlen(member) < USERNAME_LENGTH
+				? bsearch(member, builder->users, builder->numUsers, USERNAME_LENGTH, compareNames) : NULL;
+
+			if (user != NULL) {
+				addMember(group, user - builder->users);
+			}
+			else if (builder->report != NULL) {
+				fprintf(builder->report, "Group %s: no account named %s\n", definition->name, member);
+			}
+			continue;
+		}
+
+		groupDefinition* nested = strlen(member + 1) < USERNAME_LENGTH
+			? bsearch(member + 1, builder->groups, builder->numGroups, sizeof(groupDefinition), compareNames) : NULL;
+
+		if (nested == NULL) {
+			if (builder->report != NULL) {
+				fprintf(builder->report, "Group %s: no group named %s\n", definition->name, member);
+			}
+			continue;
+		}
+
+		expansion* nestedGroup = &builder->expansions[nested - builder->groups];
+
+		if (nestedGroup->order == 0) {
+			expandGroup(builder, nested - builder->groups);
+
+			if (nestedGroup->lowLink < group->lowLink) {
+				group->lowLink = nestedGroup->lowLink;
+			}
+		}
+		else if (nestedGroup->onStack && nestedGroup->order < group->lowLink) {
+			group->lowLink = nestedGroup->order;
+		}
+
+		// A group in the same loop is merged below, once the loop is complete
+		if (!nestedGroup->onStack) {
+			for (uint32_t i = 0; i < nestedGroup->count; i++) {
+				addMember(group, nestedGroup->members[i]);
+			}
+		}
+	}
+	free(members);
+
+	if (group->lowLink != group->order) {
+		return;
+	}
+
+	// This group is the first reached of its loop, if it is in one. Every
+	// group above it on the stack is in the loop and gets the same members
+	size_t loopStart = builder->stackSize;
+	while (builder->stack[--loopStart] != groupNumber) {
+		expansion* looped = &builder->expansions[builder->stack[loopStart]];
+
+		for (uint32_t i = 0; i < looped->count; i++) {
+			addMember(group, looped->members[i]);
+		}
+	}
+	sortMembers(group);
+
+	for (size_t i = loopStart; i < builder->stackSize; i++) {
+		expansion* looped = &builder->expansions[builder->stack[i]];
+
+		if (looped != group) {
+			looped->members = realloc(looped->members, (group->count > 0 ? group->count : 1) * sizeof(uint32_t));
+			memcpy(looped->members, group->members, group->count * sizeof(uint32_t));
+			looped->count = looped->capacity = group->count;
+
+			if (builder->report != NULL) {
+				fprintf(builder->report, "Group %s: nests in a loop with %s and shares its members\n",
+					builder->groups[builder->stack[i]].name, definition->name);
+			}
+		}
+		looped->onStack = false;
+	}
+	builder->stackSize = loopStart;
+}
+
+int buildGroupIndex(const char* groupsFilename, const char* usersFilename, const char* indexFilename, FILE* report) {
+	groupIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = GROUP_INDEX_MAGIC;
+	header.version = GROUP_INDEX_VERSION;
+
+	// Signatures are taken before reading so a concurrent rewrite makes the index stale
+	statSignature(groupsFilename, &header.groupsMtimeSec, &header.groupsMtimeNsec, &header.groupsSize);
+	statSignature(usersFilename, &header.usersMtimeSec, &header.usersMtimeNsec, &header.usersSize);
+
+	groupBuilder builder;
+	builder.report = report;
+	builder.users = readUsernames(usersFilename, &builder.numUsers);
+
+	if (builder.users == NULL || readGroupDefinitions(groupsFilename, &builder.groups, &builder.numGroups) != 0) {
+		free(builder.users);
+		return -1;
+	}
+
+	// Sorted by name. A name defined more than once keeps one definition
+	qsort(builder.groups, builder.numGroups, sizeof(groupDefinition), compareNames);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < builder.numGroups; i++) {
+		if (kept > 0 && !strcmp(builder.groups[kept - 1].name, builder.groups[i].name)) {
+			if (report != NULL) {
+				fprintf(report, "Group %s is defined more than once\n", builder.groups[i].name);
+			}
+			free(builder.groups[i].members);
+			continue;
+		}
+		builder.groups[kept++] = builder.groups[i];
+	}
+	builder.numGroups = kept;
+
+	builder.expansions = calloc(builder.numGroups > 0 ? builder.numGroups : 1, sizeof(expansion));
+	builder.stack = malloc((builder.numGroups > 0 ? builder.numGroups : 1) * sizeof(uint32_t));
+	builder.stackSize = 0;
+	builder.nextOrder = 0;
+
+	groupRecord* records = calloc(builder.numGroups > 0 ? builder.numGroups : 1, sizeof(groupRecord));
+
+	for (size_t i = 0; i < builder.numGroups; i++) {
+		if (builder.expansions[i].order == 0) {
+			expandGroup(&builder, i);
+		}
+
+		strcpy(records[i].name, builder.groups[i].name);
+		records[i].firstMember = header.numMembers;
+		records[i].numMembers = builder.expansions[i].count;
+		header.numMembers += builder.expansions[i].count;
+	}
+	header.numGroups = builder.numGroups;
+
+	// Written to a temporary file and renamed so readers never see a partial index
+	char tempFilename[strlen(indexFilename) + strlen(".tmp.") + 11 + 1];
+	sprintf(tempFilename, "%s.tmp.%d", indexFilename, getpid());
+
+	int status = -1;
+	FILE* indexFile = fopen(tempFilename, "wb");
+
+	if (indexFile != NULL) {
+		bool written = fwrite(&header, sizeof(header), 1, indexFile) == 1
+			&& fwrite(records, sizeof(groupRecord), header.numGroups, indexFile) == header.numGroups;
+
+		for (size_t i = 0; written && i < builder.numGroups; i++) {
+			for (uint32_t j = 0; written && j < builder.expansions[i].count; j++) {
+				written = fwrite(builder.users[builder.expansions[i].members[j]], USERNAME_LENGTH, 1, indexFile) == 1;
+			}
+		}
+
+		if (fclose(indexFile) == 0 && written && rename(tempFilename, indexFilename) == 0) {
+			status = 0;
+		}
+		else {
+			remove(tempFilename);
+		}
+	}
+
+	for (size_t i = 0; i < builder.numGroups; i++) {
+		free(builder.expansions[i].members);
+	}
+	free(builder.expansions);
+	free(builder.stack);
+	free(records);
+	freeGroupDefinitions(builder.groups, builder.numGroups);
+	free(builder.users);
+
+	return status;
+}
+
+int openGroupIndex(groupIndex* index, const char* groupsFilename, const char* usersFilename, const char* indexFilename) {
+	memset(index, 0, sizeof(groupIndex));
+
+	int indexFD = open(indexFilename, O_RDONLY | O_CLOEXEC);
+	if (indexFD < 0) {
+		return -1;
+	}
+
+	struct stat indexStat;
+	if (fstat(indexFD, &indexStat) != 0 || indexStat.st_size < sizeof(groupIndexHeader)) {
+		close(indexFD);
+		return -1;
+	}
+
+	void* map = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, indexFD, 0);
+	close(indexFD);
+
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	const groupIndexHeader* header = map;
+	size_t expectedSize = sizeof(groupIndexHeader) + (size_t) header->numGroups * sizeof(groupRecord)
+		+ (size_t) header->numMembers * USERNAME_LENGTH;
+
+	bool valid = header->magic == GROUP_INDEX_MAGIC && header->version == GROUP_INDEX_VERSION
+		&& expectedSize == indexStat.st_size && sourcesUnchanged(header, groupsFilename, usersFilename);
+
+	const groupRecord* groups = (const groupRecord*) (header + 1);
+
+	// Every group's members must lie inside the file
+	for (uint32_t i = 0; valid && i < header->numGroups; i++) {
+		valid = groups[i].firstMember <= header->numMembers
+			&& groups[i].numMembers <= header->numMembers - groups[i].firstMember;
+	}
+
+	if (!valid) {
+		munmap(map, indexStat.st_size);
+		return -1;
+	}
+
+	index->map = map;
+	index->mapSize = indexStat.st_size;
+	index->header = header;
+	index->groups = groups;
+	index->members = (const char (*)[USERNAME_LENGTH]) (groups + header->numGroups);
+
+	return 0;
+}
+
+int loadGroupIndex(groupIndex* index, const char* groupsFilename, const char* usersFilename, const char* indexFilename) {
+	if (openGroupIndex(index, groupsFilename, usersFilename, indexFilename) == 0) {
+		return 0;
+	}
+
+	if (buildGroupIndex(groupsFilename, usersFilename, indexFilename, NULL) != 0) {
+		return -1;
+	}
+
+	return openGroupIndex(index, groupsFilename, usersFilename, indexFilename);
+}
+
+void closeGroupIndex(groupIndex* index) {
+	if (index->map != NULL) {
+		munmap(index->map, index->mapSize);
+	}
+	memset(index, 0, sizeof(groupIndex));
+}
+
+const groupRecord* findGroup(const groupIndex* index, const char* name) {
+	if (index->map == NULL || strlen(name) >= USERNAME_LENGTH) {
+		return NULL;
+	}
+
+	return bsearch(name, index->groups, index->header->numGroups, sizeof(groupRecord), compareNames);
+}
@@ -0,0 +1,98 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef GROUPINDEX_H
+#define GROUPINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "userindex.h"
+
+#define GROUP_INDEX_MAGIC 0x58444947
+#define GROUP_INDEX_VERSION 1
+
+// Groups are addressed as @name wherever a username is accepted
+#define GROUP_PREFIX '@'
+
+// The groups file has one group per line: name:member,member,...
+// A member is a username or @group, so groups can nest.
+
+// One group as written in the groups file. members is the comma separated list
+typedef struct groupDefinition {
+	char name[USERNAME_LENGTH];
+	char* members;
+} groupDefinition;
+
+// One group in the index. Its members are numMembers names starting at firstMember
+typedef struct groupRecord {
+	char name[USERNAME_LENGTH];
+	uint8_t reserved[3];
+	uint32_t firstMember;
+	uint32_t numMembers;
+} groupRecord;
+
+// The index file is this header, then numGroups records sorted by name, then
+// numMembers usernames. Each group's members are fully expanded, sorted and
+// without repeats, and only name existing accounts, so a send never resolves
+// a nested group. The mtimes and sizes of the groups and users files the
+// index was built from are kept so a stale index can be detected.
+typedef struct groupIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numGroups;
+	uint32_t numMembers;
+	int64_t groupsMtimeSec;
+	int64_t groupsMtimeNsec;
+	int64_t groupsSize;
+	int64_t usersMtimeSec;
+	int64_t usersMtimeNsec;
+	int64_t usersSize;
+} groupIndexHeader;
+
+// A read only mapping of an index file
+typedef struct groupIndex {
+	void* map;
+	size_t mapSize;
+	const groupIndexHeader* header;
+	const groupRecord* groups;
+	const char (*members)[USERNAME_LENGTH];
+} groupIndex;
+
+// Reads every group from the groups file. A missing file has no groups.
+// groups must be freed with freeGroupDefinitions().
+// Returns 0 on success, -1 on failure
+int readGroupDefinitions(const char* groupsFilename, groupDefinition** groups, size_t* count);
+
+// Atomically replaces the groups file. Returns 0 on success, -1 on failure
+int writeGroupDefinitions(const char* groupsFilename, const groupDefinition* groups, size_t count);
+
+void freeGroupDefinitions(groupDefinition* groups, size_t count);
+
+// True if name can be used as a group name
+bool validGroupName(const char* name);
+
+// Flattens the groups file into the index. Groups that nest in a loop all get
+// every member of the loop. Unknown accounts and groups, and loops, are
+// reported to report if not NULL.
+// The new index atomically replaces any existing one.
+// Returns 0 on success, -1 on failure
+int buildGroupIndex(const char* groupsFilename, const char* usersFilename, const char* indexFilename, FILE* report);
+
+// Maps an existing index if it is valid and both source files are unchanged.
+// Returns 0 on success, -1 if the index is missing, corrupt or stale
+int openGroupIndex(groupIndex* index, const char* groupsFilename, const char* usersFilename, const char* indexFilename);
+
+// Opens the index, rebuilding it first if needed.
+// Returns 0 on success, -1 on failure
+int loadGroupIndex(groupIndex* index, const char* groupsFilename, const char* usersFilename, const char* indexFilename);
+
+void closeGroupIndex(groupIndex* index);
+
+// Returns the group named name, without its prefix, or NULL if there is none
+const groupRecord* findGroup(const groupIndex* index, const char* name);
+
+#endif
@@ -0,0 +1,430 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "listing.h"
+#include "arena.h"
+#include "metrics.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maps a whole index. Compaction replaces an index by rename, so the mapping
+// keeps seeing the version it was opened on
+static int mapIndex(const char* indexPath, mailListing* listing) {
+	int indexFD = open(indexPath, O_RDONLY | O_CLOEXEC);
+	if (indexFD < 0) {
+		return 0;
+	}
+
+	struct stat indexStat;
+	if (fstat(indexFD, &indexStat) != 0) {
+		close(indexFD);
+		return -1;
+	}
+
+	// A torn record at the end of the file is ignored
+	listing->numMapped = indexStat.st_size / sizeof(messageRecord);
+	listing->mapSize = listing->numMapped * sizeof(messageRecord);
+
+	if (listing->mapSize > 0) {
+		void* map = mmap(NULL, listing->mapSize, PROT_READ, MAP_SHARED, indexFD, 0);
+
+		if (map == MAP_FAILED) {
+			listing->numMapped = 0;
+			listing->mapSize = 0;
+			close(indexFD);
+			return -1;
+		}
+		listing->mapped = map;
+	}
+	close(indexFD);
+
+	return 0;
+}
+
+// Newest last, by the time in the name, so deliveries list in the order they arrived
+static int compareDelivered(const void* a, const void* b) {
+	const deliveredName* first = a;
+	const deliveredName* second = b;
+
+	if (first->timestamp != second->timestamp) {
+		return (first->timestamp > second->timestamp) - (first->timestamp < second->timestamp);
+	}
+	return strcmp(first->name, second->name);
+}
+
+// Lists the messages delivered into new by name alone. No message is opened
+static deliveredName* readDeliveredNames(const char* newPath, size_t* count) {
+	*count = 0;
+
+	DIR* folder = opendir(newPath);
+	if (folder == NULL) {
+		return NULL;
+	}
+
+	size_t capacity = 16;
+	deliveredName* names = malloc(capacity * sizeof(deliveredName));
+	struct dirent* entry;
+
+	while ((entry = readdir(folder)) != NULL) {
+		size_t nameLength = strlen(entry->d_name);
+
+		// Attachments are picked up with their message
+		if (entry->d_name[0] == '.' || nameLength >= MESSAGE_NAME_LENGTH
+				|| (nameLength > strlen("_attachment") && !strcmp(entry->d_name + nameLength - strlen("_attachment"), "_attachment"))) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity *= 2;
+			names = realloc(names, capacity * sizeof(deliveredName));
+		}
+
+		const char* timeStr = strchr(entry->d_name, '_') != NULL ? strchr(entry->d_name, '_') + 1 : entry->d_name;
+
+		names[*count].timestamp = parseMessageTime(timeStr);
+		strcpy(names[*count].name, entry->d_name);
+		(*count)++;
+	}
+	closedir(folder);
+
+	if (*count == 0) {
+		free(names);
+		return NULL;
+	}
+
+	qsort(names, *count, sizeof(deliveredName), compareDelivered);
+
+	return names;
+}
+
+// Reads the header of a delivered message. One another session has already
+// taken is still listed, by name and time alone
+static void readDeliveredRecord(const mailListing* listing, size_t position, messageRecord* record) {
+	const deliveredName* delivered = &listing->delivered[position];
+	pathBuilder messagePath;
+	const char* path = NULL;
+
+	if (setPathFolder(&messagePath, listing->deliveredPath) == 0) {
+		path = buildPath(&messagePath, delivered->name, NULL);
+	}
+
+	if (path == NULL || buildMessageRecord(record, path, delivered->name, delivered->timestamp) != 0) {
+		memset(record, 0, sizeof(messageRecord));
+		snprintf(record->name, sizeof(record->name), "%s", delivered->name);
+		record->timestamp = delivered->timestamp;
+	}
+}
+
+static bool isRemoved(const mailListing* listing, size_t source) {
+	return listing->removed != NULL && listing->removed[source / 8] & 1 << source % 8;
+}
+
+// True if a source is still in the folder. Unread entries flagged as consumed,
+// even by this session, are seen through the shared mapping
+static bool isShown(const mailListing* listing, size_t source) {
+	if (source < listing->start || isRemoved(listing, source)) {
+		return false;
+	}
+	if (source >= listing->numMapped) {
+		return true;
+	}
+
+	const messageRecord* record = &listing->mapped[source];
+
+	return listing->folder == 'u' ? !(record->flags & MESSAGE_FLAG_CONSUMED)
+		: !isTombstoned(listing->tombstones, listing->numTombstones, record->name);
+}
+
+// Collects up to a page of shown sources from source from onwards into
+// sources, which may be NULL. Returns the source after the last one looked at
+static size_t scanPage(const mailListing* listing, size_t from, size_t* sources, size_t* rows) {
+	size_t numSources = listing->numMapped + listing->numDelivered;
+	size_t source = from;
+
+	*rows = 0;
+	for (; source < numSources && *rows < LISTING_PAGE_SIZE; source++) {
+		if (isShown(listing, source)) {
+			if (sources != NULL) {
+				sources[*rows] = source;
+			}
+			(*rows)++;
+		}
+	}
+
+	return source;
+}
+
+// Records that a scan of page ran off the end of the folder with rows on it
+static void setLastPage(mailListing* listing, size_t page, size_t rows) {
+	listing->complete = true;
+	listing->count = page * LISTING_PAGE_SIZE + rows;
+}
+
+// Reads a page in date order into pageSources, and the headers of the
+// deliveries on it into pageRecords. Pages before it are scanned first if
+// they have not been shown yet
+static void loadPage(mailListing* listing, size_t page) {
+	if (listing->loadedPage == page) {
+		return;
+	}
+	listing->loadedPage = page;
+	listing->pageRows = 0;
+
+	while (listing->numPageStarts <= page) {
+		size_t last = listing->numPageStarts - 1;
+		size_t rows;
+		size_t next = scanPage(listing, listing->pageStarts[last], NULL, &rows);
+
+		if (rows < LISTING_PAGE_SIZE) {
+			setLastPage(listing, last, rows);
+			return;
+		}
+
+		listing->pageStarts = realloc(listing->pageStarts, (listing->numPageStarts + 1) * sizeof(size_t));
+		listing->pageStarts[listing->numPageStarts++] = next;
+	}
+
+	scanPage(listing, listing->pageStarts[page], listing->pageSources, &listing->pageRows);
+
+	if (listing->pageRows < LISTING_PAGE_SIZE) {
+		setLastPage(listing, page, listing->pageRows);
+	}
+	// A full page keeps the next one reachable even if the count was worked out too low
+	else if (!listing->complete && listing->count <= (page + 1) * LISTING_PAGE_SIZE) {
+		listing->count = (page + 1) * LISTING_PAGE_SIZE + 1;
+	}
+
+	for (size_t i = 0; i < listing->pageRows; i++) {
+		if (listing->pageSources[i] >= listing->numMapped) {
+			readDeliveredRecord(listing, listing->pageSources[i] - listing->numMapped, &listing->pageRecords[i]);
+		}
+	}
+}
+
+// Sets up date order paging from start, with count guessed until the last page is found
+static void startPaging(mailListing* listing, size_t start, size_t count) {
+	listing->start = start;
+	listing->count = count;
+	listing->pageStarts = malloc(sizeof(size_t));
+	listing->pageStarts[0] = start;
+	listing->numPageStarts = 1;
+	listing->loadedPage = SIZE_MAX;
+
+	loadPage(listing, 0);
+}
+
+int openListing(const paths* userPaths, char folder, mailListing* listing) {
+	memset(listing, 0, sizeof(mailListing));
+	listing->folder = folder;
+	listing->sort = SORT_BY_DATE;
+
+	const char* indexPath = folder == 'u' ? userPaths->unreadIndex : folder == 'r' ? userPaths->readIndex : userPaths->sentIndex;
+	int status;
+
+	if (folder == 'u') {
+		// The shared lock keeps the unread index from being compacted under the cursor
+		FILE* unreadLockFile = fopen(userPaths->unreadLock, "r");
+		uint64_t lockedAt = 0;
+
+		if (unreadLockFile != NULL) {
+			lockedAt = timedLock(fileno(unreadLockFile), LOCK_SH);
+		}
+
+		readIndexCursor(userPaths->unreadCursor, indexPath, &listing->cursor);
+		status = mapIndex(indexPath, listing);
+
+		if (unreadLockFile != NULL) {
+			timedUnlock(fileno(unreadLockFile), lockedAt);
+			fclose(unreadLockFile);
+		}
+
+		listing->deliveredPath = userPaths->newPath;
+		listing->delivered = readDeliveredNames(userPaths->newPath, &listing->numDelivered);
+	}
+	else {
+		status = mapIndex(indexPath, listing);
+
+		// Deleted entries wait in the read and sent indexes until compaction
+		listing->tombstones = readTombstones(folder == 'r' ? userPaths->readTombstones : userPaths->sentTombstones, &listing->numTombstones);
+	}
+
+	if (status != 0) {
+		return -1;
+	}
+
+	// Entries before the cursor have all been read already. Unread mail
+	// delivered maildir-style follows the indexed entries
+	if (folder == 'u') {
+		size_t start = listing->cursor.position < listing->numMapped ? listing->cursor.position : listing->numMapped;
+
+		startPaging(listing, start, listing->numMapped - start + listing->numDelivered);
+	}
+	else {
+		startPaging(listing, 0, listing->numMapped > listing->numTombstones ? listing->numMapped - listing->numTombstones : 0);
+	}
+
+	return 0;
+}
+
+void openListingOf(char folder, messageRecord* records, size_t count, mailListing* listing) {
+	memset(listing, 0, sizeof(mailListing));
+	listing->folder = folder;
+	listing->sort = SORT_BY_DATE;
+	listing->fetched = records;
+	listing->mapped = records;
+	listing->numMapped = count;
+
+	startPaging(listing, 0, count);
+}
+
+// Finds the source shown at position i
+static bool listingSource(mailListing* listing, size_t i, size_t* source) {
+	if (listing->entries != NULL) {
+		if (i >= listing->count) {
+			return false;
+		}
+		*source = listing->entries[i];
+		return true;
+	}
+
+	loadPage(listing, i / LISTING_PAGE_SIZE);
+	*source = listing->pageSources[i % LISTING_PAGE_SIZE];
+
+	return i % LISTING_PAGE_SIZE < listing->pageRows;
+}
+
+// Record of a source once the listing is sorted
+static const messageRecord* sortedRecord(const mailListing* listing, size_t source) {
+	return source < listing->numMapped ? &listing->mapped[source] : &listing->deliveredRecords[source - listing->numMapped];
+}
+
+const messageRecord* listingRecord(mailListing* listing, size_t i) {
+	size_t source;
+
+	if (!listingSource(listing, i, &source)) {
+		return NULL;
+	}
+	if (listing->entries != NULL || source < listing->numMapped) {
+		return sortedRecord(listing, source);
+	}
+
+	return &listing->pageRecords[i % LISTING_PAGE_SIZE];
+}
+
+bool listingIndexPosition(mailListing* listing, size_t i, size_t* indexPosition) {
+	return listingSource(listing, i, indexPosition) && *indexPosition < listing->numMapped;
+}
+
+static int compareEntries(const void* a, const void* b, void* context) {
+	const mailListing* listing = context;
+	uint32_t first = *(const uint32_t*) a;
+	uint32_t second = *(const uint32_t*) b;
+	const messageRecord* firstRecord = sortedRecord(listing, first);
+	const messageRecord* secondRecord = sortedRecord(listing, second);
+	int order = 0;
+	// Sent mail shows, and so sorts by, who it went to
+	if (listing->sort == SORT_BY_SENDER && listing->folder == 's') {
+		order = strcmp(firstRecord->firstRecipient, secondRecord->firstRecipient);
+	}
+	else if (listing->sort == SORT_BY_SENDER) {
+		order = strcmp(firstRecord->sender, secondRecord->sender);
+	}
+	else if (listing->sort == SORT_BY_SIZE) {
+		order = (firstRecord->size < secondRecord->size) - (firstRecord->size > secondRecord->size);
+	}
+
+	if (order == 0) {
+		order = (firstRecord->timestamp > secondRecord->timestamp) - (firstRecord->timestamp < secondRecord->timestamp);
+	}
+
+	// Ties keep folder order
+	return order != 0 ? order : (first > second) - (first < second);
+}
+
+void sortListing(mailListing* listing, listingSort sort) {
+	listing->sort = sort;
+
+	// Folder order needs nothing kept
+	if (sort == SORT_BY_DATE) {
+		free(listing->entries);
+		listing->entries = NULL;
+		listing->loadedPage = SIZE_MAX;
+		return;
+	}
+
+	// The first sort visits every message and reads every delivered header
+	if (listing->entries == NULL) {
+		size_t numSources = listing->numMapped + listing->numDelivered;
+
+		if (listing->deliveredRecords == NULL && listing->numDelivered > 0) {
+			listing->deliveredRecords = malloc(listing->numDelivered * sizeof(messageRecord));
+			for (size_t i = 0; i < listing->numDelivered; i++) {
+				readDeliveredRecord(listing, i, &listing->deliveredRecords[i]);
+			}
+		}
+
+		listing->entries = malloc((numSources + 1) * sizeof(uint32_t));
+		listing->count = 0;
+
+		for (size_t source = listing->start; source < numSources; source++) {
+			if (isShown(listing, source)) {
+				listing->entries[listing->count++] = source;
+			}
+		}
+		listing->complete = true;
+	}
+
+	qsort_r(listing->entries, listing->count, sizeof(uint32_t), compareEntries, listing);
+}
+
+void removeFromListing(mailListing* listing, size_t i) {
+	size_t source;
+
+	if (!listingSource(listing, i, &source)) {
+		return;
+	}
+
+	if (listing->removed == NULL) {
+		listing->removed = calloc((listing->numMapped + listing->numDelivered) / 8 + 1, 1);
+	}
+	listing->removed[source / 8] |= 1 << source % 8;
+
+	if (listing->entries != NULL) {
+		memmove(&listing->entries[i], &listing->entries[i + 1], (listing->count - i - 1) * sizeof(uint32_t));
+	}
+	listing->count--;
+
+	// Pages after the one it was on now start one message later
+	size_t page = listing->entries != NULL ? 0 : i / LISTING_PAGE_SIZE;
+	if (listing->numPageStarts > page + 1) {
+		listing->numPageStarts = page + 1;
+	}
+	listing->loadedPage = SIZE_MAX;
+}
+
+void closeListing(mailListing* listing) {
+	if (listing->fetched != NULL) {
+		free(listing->fetched);
+	}
+	else if (listing->mapped != NULL) {
+		munmap((void*) listing->mapped, listing->mapSize);
+	}
+	free(listing->delivered);
+	free(listing->deliveredRecords);
+	free(listing->tombstones);
+	free(listing->removed);
+	free(listing->pageStarts);
+	free(listing->entries);
+	memset(listing, 0, sizeof(mailListing));
+}
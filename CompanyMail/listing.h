@@ -0,0 +1,99 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mailbox.h"
+#include "mailindex.h"
+
+// Messages shown on one page of a listing screen
+#define LISTING_PAGE_SIZE 20
+
+// Orders a listing can be shown in. Dates and senders ascend, sizes descend.
+// Sent mail is sorted by its first recipient rather than its sender
+typedef enum listingSort {
+	SORT_BY_DATE,
+	SORT_BY_SENDER,
+	SORT_BY_SIZE
+} listingSort;
+
+// A message delivered maildir-style, known only by its name until its page is shown
+typedef struct deliveredName {
+	int64_t timestamp;
+	char name[MESSAGE_NAME_LENGTH];
+} deliveredName;
+
+// One folder's messages in the order a listing screen shows them.
+// Messages are numbered by source: an index position below numMapped, or
+// numMapped plus a position in delivered. In date order a listing holds no
+// per-message state. Pages are read straight from the memory mapped index
+// and from the names in new, and a delivered message's header is only read
+// for the page showing it. Page starts are remembered as pages are shown, so
+// reaching page p costs p pages of records. Until the last page has been
+// found, count is worked out from the size of the index and may be high.
+// Sorting by sender or size visits every message once and keeps the order in
+// entries, with every delivered header read into deliveredRecords.
+// cursor is where the unread index's reader had got to when it was opened
+typedef struct mailListing {
+	char folder;
+	const messageRecord* mapped;
+	size_t numMapped;
+	size_t mapSize;
+	messageRecord* fetched;
+	const char* deliveredPath;
+	deliveredName* delivered;
+	size_t numDelivered;
+	messageRecord* deliveredRecords;
+	char* tombstones;
+	size_t numTombstones;
+	uint8_t* removed;
+	size_t start;
+	size_t* pageStarts;
+	size_t numPageStarts;
+	size_t loadedPage;
+	size_t pageSources[LISTING_PAGE_SIZE];
+	messageRecord pageRecords[LISTING_PAGE_SIZE];
+	size_t pageRows;
+	bool complete;
+	uint32_t* entries;
+	size_t count;
+	listingSort sort;
+	indexCursor cursor;
+} mailListing;
+
+// Opens a listing of a folder, 'u' for unread, 'r' for read, or 's' for sent,
+// in date order. Unread and sent mail are in the order it arrived and read
+// mail in the order it was read. Read unread mail and deleted read or sent
+// mail are left out. Only the first page is read, so count is 0 only if the
+// folder is empty. Must be closed with closeListing(), even on failure.
+// Returns 0 on success, -1 on failure
+int openListing(const paths* userPaths, char folder, mailListing* listing);
+
+// Opens a listing of a read ('r') or sent ('s') folder already read into
+// records, such as one from the mail server, in the order given. The listing
+// takes records over, so it must have come from malloc and is freed by closeListing()
+void openListingOf(char folder, messageRecord* records, size_t count, mailListing* listing);
+
+// Returns the record shown at position i of the listing, or NULL if there is none.
+// The record may be overwritten by the next call for another page
+const messageRecord* listingRecord(mailListing* listing, size_t i);
+
+// True if position i of the listing comes from the index, with its record's
+// position in the index stored in indexPosition
+bool listingIndexPosition(mailListing* listing, size_t i, size_t* indexPosition);
+
+// Reorders the listing. Date order drops any sort and goes back to folder order
+void sortListing(mailListing* listing, listingSort sort);
+
+// Drops position i from the listing once its message has left the folder
+void removeFromListing(mailListing* listing, size_t i);
+
+void closeListing(mailListing* listing);
+
+#endif
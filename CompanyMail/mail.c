@@ -7,201 +7,47 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <time.h>
-
-#define MAX_LINE_LENGTH 1024
-
-const char* mailDir = "/CompanyMail/mailboxes/";
-
-const char* outbox = "/outbox";
-const char* sent = "/sent";
-const char* logName = "/log.txt";
-const char* drafts = "/drafts";
-
-const char* inbox = "/inbox";
-const char* unread = "/unread";
-const char* readStr = "/read";
-
-const char* draftFilename = "/draft.txt";
-const char* draftAttachmentFilename = "/draft.attach";
-const char* draftHeadername = "/draft_hdr.txt";
-const char* destinationsFilename = "/destinations.txt";
-const char* lockName = "/lock.lck";
-
-// Structs for file names/paths needed for each user
-typedef struct customPaths {
-	char* userPath;
-
-    char* outboxPath;
-
-    char* sentPath;
-
-	char* sentLog;
-
-    char* draftPath;
-    
-    char* inboxPath;
-
-	char* unreadLog;
-
-    char* unreadPath;
-
-    char* readLog;
-
-	char* readPath;
-
-	char* unreadLock;
-} paths;
-
-// Generates all necessary paths to populate a paths struct.
-// Paths are customized based on username
-void generatePaths (paths* currPaths, char* username) {
-	currPaths->userPath = malloc(strlen(mailDir) + strlen(username) + 1);
-    sprintf(currPaths->userPath, "%s%s", mailDir, username);
-
-    currPaths->outboxPath = malloc(strlen(currPaths->userPath) + strlen(outbox) + 1);
-    sprintf(currPaths->outboxPath, "%s%s", currPaths->userPath, outbox);
-
-    currPaths->sentPath = malloc(strlen(currPaths->outboxPath) + strlen(sent) + 1);
-    sprintf(currPaths->sentPath, "%s%s", currPaths->outboxPath, sent);
-
-	currPaths->sentLog = malloc(strlen(currPaths->sentPath) + strlen(logName) + 1);
-    sprintf(currPaths->sentLog, "%s%s", currPaths->sentPath, logName);
-
-    currPaths->draftPath = malloc(strlen(currPaths->outboxPath) + strlen(drafts) + 1);
-    sprintf(currPaths->draftPath, "%s%s", currPaths->outboxPath, drafts);
-	
-    currPaths->inboxPath = malloc(strlen(currPaths->userPath) + strlen(inbox) + 1);
-    sprintf(currPaths->inboxPath, "%s%s", currPaths->userPath, inbox);
-
-    currPaths->unreadPath = malloc(strlen(currPaths->inboxPath) + strlen(unread) + 1);
-    sprintf(currPaths->unreadPath, "%s%s", currPaths->inboxPath, unread);
-
-	currPaths->unreadLog = malloc(strlen(currPaths->unreadPath) + strlen(logName) + 1);
-    sprintf(currPaths->unreadLog, "%s%s", currPaths->unreadPath, logName);
-
-    currPaths->readPath = malloc(strlen(currPaths->inboxPath) + strlen(readStr) + 1);
-    sprintf(currPaths->readPath, "%s%s", currPaths->inboxPath, readStr);
-
-	currPaths->readLog = malloc(strlen(currPaths->readPath) + strlen(logName) + 1);
-    sprintf(currPaths->readLog, "%s%s", currPaths->readPath, logName);
-
-	currPaths->unreadLock = malloc(strlen(currPaths->unreadPath) + strlen(lockName) + 1);
-    sprintf(currPaths->unreadLock, "%s%s", currPaths->unreadPath, lockName);
-}
-
-// Frees all the memory of a paths struct
-void freePaths(paths* currPaths) {
-	free(currPaths->userPath);
-	free(currPaths->outboxPath);
-	free(currPaths->sentPath);
-	free(currPaths->sentLog);
-	free(currPaths->draftPath);
-	free(currPaths->inboxPath);
-	free(currPaths->unreadLog);
-	free(currPaths->unreadPath);
-	free(currPaths->readPath);
-	free(currPaths->readLog);
-	free(currPaths->unreadLock);
-
-	currPaths->userPath = NULL;
-	currPaths->outboxPath = NULL;
-	currPaths->sentPath = NULL;
-	currPaths->sentLog = NULL;
-	currPaths->draftPath = NULL;
-	currPaths->inboxPath = NULL;
-	currPaths->unreadLog = NULL;
-	currPaths->unreadPath = NULL;
-	currPaths->readPath = NULL;
-	currPaths->readLog = NULL;
-	currPaths->unreadLock = NULL;
-
-}
-
-// Copies a file from a source to a destination
-// Root permissions will be dropped when creating the destination file if
-// dropPerms is true
-int copyFile(const char *src_filename, const char *dest_filename, bool dropPerms) {
-	// Opens source file in binary read mode
-    FILE *src_file = fopen(src_filename, "rb");
-    if (src_file == NULL) {
-        perror("Error opening source file");
-        return -1;
-    }
-
-	unsigned int euid = geteuid();
-	unsigned int ruid = getuid();
-
-	// drops root perms when writing file
-	if (dropPerms) {
-		setuid(ruid);
-	}
-
-    // Opens destination file in binary write mode
-	FILE *dest_file = fopen(dest_filename, "wb");
-    if (dest_file == NULL) {
-        perror("Error opening destination file");
-        fclose(src_file);
-        return -1;
-    }
-
-    char buffer[1024];
-    size_t bytes_read;
-
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
-        fwrite(buffer, 1, bytes_read, dest_file);
-    }
-
-
-    fclose(src_file);
-    fclose(dest_file);
-
-	setuid(euid);
-
-    return 0;  // Success
-}
-
-
-// Appends the contents of a source file to a destination file
-int appendFile(const char *src_filename, const char *dest_filename) {
-    // Open the source file in binary read mode
-    FILE *src_file = fopen(src_filename, "rb");
-    if (src_file == NULL) {
-        perror("Error opening source file");
-        return -1;
-    }
-
-    // Open the destination file in binary append mode ("ab")
-    FILE *dest_file = fopen(dest_filename, "ab");
-    if (dest_file == NULL) {
-        perror("Error opening destination file");
-        fclose(src_file);
-        return -1;
-    }
-
-    char buffer[1024];
-    size_t bytes_read;
-
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, dest_file) != bytes_read) {
-            perror("Error writing to destination file");
-            fclose(src_file);
-            fclose(dest_file);
-            return -1;
-        }
-    }
-
-    fclose(src_file);
-    fclose(dest_file);
-
-    return 0;  // Success
-}
-
+#include <getopt.h>
+
+#include "mailbox.h"
+#include "archive.h"
+#include "arena.h"
+#include "blobstore.h"
+#include "delivery.h"
+#include "filecopy.h"
+#include "groupindex.h"
+#include "listing.h"
+#include "mailindex.h"
+#include "mailclient.h"
+#include "mailgrep.h"
+#include "recipients.h"
+#include "metrics.h"
+#include "searchindex.h"
+#include "terminal.h"
+#include "trace.h"
+#include "userindex.h"
+
+const char* usersFilename = MAIL_ROOT "/Config/users";
+const char* adminFilename = MAIL_ROOT "/Config/admins";
+const char* userIndexFilename = MAIL_ROOT "/Config/users.idx";
+const char* groupsFilename = MAIL_ROOT "/Config/groups";
+const char* groupIndexFilename = MAIL_ROOT "/Config/groups.idx";
+
+// Memory mapped user directory. Unmapped if no usable index exists
+userIndex userDirectory;
+
+// Memory mapped distribution groups, mapped the first time a group is addressed
+groupIndex groupDirectory;
+
+// Messages are shown in vim instead of the built-in pager, set by mail --vim
+bool viewWithVim = false;
 
 // Prompts user with provided prompt. Asks for 'y' or 'n'
 // Returns true if 'y' else if 'n' false
@@ -224,508 +70,497 @@ bool yesNoPromptFunc(char* prompt) {
 	return inputChar == 'y';
 }
 
-// Returns a string representing the time that can be used as a valid file name
-char* getTimeString() {
-	time_t raw_time;
-    struct tm *time_info;
-    char buffer[80];
-
-    // Get the current time
-    time(&raw_time);
-
-    // Convert the time to local time
-    time_info = localtime(&raw_time);
+// Shows a message in the built-in pager, or read only in vim if the user asked
+// for it, then lets the user download its attachment to their home directory.
+// attachPath is NULL if the message has no attachment
+void showMessage(char* username, const char* messagePath, const char* attachPath, const char* attachName) {
+	if (viewWithVim) {
+		TRACE_BEGIN(TRACE_EDITOR);
+		pid_t childID = fork();
 
-    // Format the time with underscores instead of spaces
-    strftime(buffer, sizeof(buffer), "%Y_%m_%d_%H_%M_%S", time_info);
+		char* vimArgs[] = {"vim", "-M", (char*) messagePath, NULL};
 
-	char* timeStr = malloc(sizeof(buffer));
+		// Child opens message
+		if (!childID) {
+			execvp("vim", vimArgs);
+			_exit(1);
+		}
+		wait(NULL);
+		TRACE_END(TRACE_EDITOR);
+	}
+	else {
+		pageFile(messagePath);
+	}
 
-	strcpy(timeStr, buffer);
+	// User can download an attachment to their home directory
+	if (attachPath != NULL) {
+		if (yesNoPromptFunc("Would you like to download the file attached to this message")) {
+			char* attachmentFilePath = malloc(strlen("/home/") + strlen(username) + strlen("/") + strlen(attachName) + 1);
+			sprintf(attachmentFilePath, "/home/%s/%s", username, attachName);
 
-    return timeStr;
-}
+			printf("The file will be downloaded to: %s\n", attachmentFilePath);
 
-// Function to view all unread mail
-void viewMail(char* username, paths* userPaths) {
+			if (yesNoPromptFunc("Download the file")) {
+				copyFile(attachPath, attachmentFilePath, true);
+			}
+			free(attachmentFilePath);
+		}
 
-	system("clear");
-	
-	char buffer[MAX_LINE_LENGTH];
-	char tokenBuffer[MAX_LINE_LENGTH];
-	bool unreadMail = false;
-
-	// Check if unread log exists
-	struct stat bufferStat;
-	if (stat(userPaths->unreadLog, &bufferStat) != 0) {
-   		printf("No Unread Mail!\n");
-		return;
 	}
+}
 
-	char* unreadLogCopy = malloc(strlen(userPaths->unreadLog) + strlen("_copy") + 1);
-	sprintf(unreadLogCopy, "%s%s", userPaths->unreadLog, "_copy");
-
-	char* stillUnread = malloc(strlen(userPaths->unreadLog) + strlen("_stillUnread") + 1);
-	sprintf(stillUnread, "%s%s", userPaths->unreadLog, "_stillUnread"); 
-
-	// Acquire Lock
-	FILE* unreadLockFile = fopen(userPaths->unreadLock, "r");
-	int lockFD = fileno(unreadLockFile);
-	flock(lockFD, LOCK_EX);
-
-	// Copy the log
-	copyFile(userPaths->unreadLog, unreadLogCopy, false);
-	FILE* unreadLogFile = fopen(userPaths->unreadLog, "w");
-	fclose(unreadLogFile);
+// Shows a read or sent message. An archived message is unpacked from its
+// segment into anonymous files, which the pager, vim and the download open
+// through /proc, so nothing is extracted to disk
+void showStoredMessage(char* username, const char* folderPath, const messageRecord* record) {
+	bool attachment = recordHasAttachment(record);
 
-	// Release Lock
-	flock(lockFD, LOCK_UN);
+	if (record->flags & MESSAGE_FLAG_ARCHIVED) {
+		int messageFD = openArchivedPart(folderPath, record, ARCHIVE_PART_MESSAGE);
+		int attachmentFD = attachment ? openArchivedPart(folderPath, record, ARCHIVE_PART_ATTACHMENT) : -1;
 
-	FILE* unreadLogCopyFile = fopen(unreadLogCopy, "r");
-	FILE* stillUnreadFile = fopen(stillUnread, "a");
-	
-	// Each part of log copy
-	while (fscanf(unreadLogCopyFile, "%s", buffer) != EOF) {
-		unreadMail = true;
-		strcpy(tokenBuffer, buffer);
-		char* usernameReceive = strtok(tokenBuffer, "_");
-		char* dateTime = strtok(NULL, "\n");
-
-		unsigned int count = 0;
-
-		// Format the date of the message
-		for (int i = 0; i < strlen(dateTime); i++) {
-			if (dateTime[i] == '_') {
-				if (count < 2) {
-					dateTime[i] = '/';
-				}
-				else if (count == 2) {
-					dateTime[i] = ' ';
-				}
-				else {
-					dateTime[i] = ':';
-				}
-				count++;
-			}
+		if (messageFD < 0) {
+			printf("The message could not be read from its archive\n");
 		}
+		else {
+			char messagePath[32], attachmentPath[32];
+			sprintf(messagePath, "/proc/self/fd/%d", messageFD);
+			sprintf(attachmentPath, "/proc/self/fd/%d", attachmentFD);
 
-		printf("Message received from %s at %s\n", usernameReceive, dateTime);
+			showMessage(username, messagePath, attachmentFD >= 0 ? attachmentPath : NULL, record->attachment);
+			close(messageFD);
+		}
 
-		// Does user want to read the message
-		if(yesNoPromptFunc("Would you like to read this message")) {
-			bool attachment;
+		if (attachmentFD >= 0) {
+			close(attachmentFD);
+		}
+		return;
+	}
 
-			// Prepare to move to read folder
-			char* currentMessageLocation = malloc(strlen(userPaths->unreadPath) + strlen("/") + strlen(buffer) + 1);
-			sprintf(currentMessageLocation, "%s/%s", userPaths->unreadPath, buffer);
+	pathBuilder messagePath, attachmentPath;
+	setPathFolder(&messagePath, folderPath);
+	setPathFolder(&attachmentPath, folderPath);
 
-			char* futureMessageLocation = malloc(strlen(userPaths->readPath) + strlen("/") + strlen(buffer) + 1);
-			sprintf(futureMessageLocation, "%s/%s", userPaths->readPath, buffer);
+	showMessage(username, buildPath(&messagePath, record->name, NULL),
+		attachment ? buildPath(&attachmentPath, record->name, "_attachment") : NULL, record->attachment);
+}
 
-			// Add to the read log
-			FILE* readLogFile = fopen(userPaths->readLog, "a");
+// Reads a folder listing from the mail server if one is running, otherwise from disk.
+// folder is 'u' for unread, 'r' for read, or 's' for sent. The array must be freed
+messageRecord* readFolderRecords(const char* username, paths* userPaths, char folder, size_t* count) {
+	messageRecord* records;
 
-			fprintf(readLogFile, "%s\n", buffer);
+	if (requestFolder(username, folder, &records, count) == 0) {
+		return records;
+	}
 
-			fclose(readLogFile);
+	return readFolder(userPaths, folder, count);
+}
 
-			char* currentAttachName = malloc(strlen(currentMessageLocation) + strlen("_attachment") + 1);
-			sprintf(currentAttachName, "%s%s", currentMessageLocation, "_attachment");
+// Opens a listing of a folder from the mail server if one is running, otherwise from disk.
+// Unread mail is always listed from disk, since reading it marks its index entry.
+// Must be closed with closeListing(), even on failure.
+// Returns 0 on success, -1 on failure
+int openFolderListing(const char* username, const paths* userPaths, char folder, mailListing* listing) {
+	messageRecord* records;
+	size_t count;
 
-			char* futureAttachName = malloc(strlen(futureMessageLocation) + strlen("_attachment") + 1);
-			sprintf(futureAttachName, "%s%s", futureMessageLocation, "_attachment");
+	if (folder != 'u' && requestFolder(username, folder, &records, &count) == 0) {
+		openListingOf(folder, records, count, listing);
+		return 0;
+	}
 
+	return openListing(userPaths, folder, listing);
+}
 
-			FILE* readMessage = fopen(currentMessageLocation, "r");
-			char attachBuffer[101];
+// Shows a listing a page at a time until the user picks a message or quits.
+// page is kept across calls so the user returns to where they were.
+// Returns the listing position picked, or -1 once the user quits
+ssize_t browseListing(mailListing* listing, const char* title, size_t* page) {
+	const char* sortNames[] = {listing->folder == 'r' ? "date read" : "date", listing->folder == 's' ? "recipient" : "sender", "size"};
+	char input[32];
+
+	while (true) {
+		// Reading the page can find the folder ends sooner than its count said
+		size_t first = *page * LISTING_PAGE_SIZE;
+		if (listingRecord(listing, first) == NULL && *page > 0) {
+			(*page)--;
+			continue;
+		}
 
-			// Check for attachment, storing name in attach buffer or "NONE"
-			do {
-				fscanf(readMessage, "%s", attachBuffer);
-			} while(strcmp(attachBuffer, "Attachment:") != 0);
-			fscanf(readMessage, "%s", attachBuffer);
+		size_t numPages = (listing->count + LISTING_PAGE_SIZE - 1) / LISTING_PAGE_SIZE;
 
-			attachment = strcmp(attachBuffer, "NONE") != 0;
+		if (numPages == 0) {
+			numPages = 1;
+		}
+		if (*page >= numPages) {
+			*page = numPages - 1;
+		}
 
-			fclose(readMessage);
+		clearScreen();
 
-			// Move file link to read folder
-			link(currentMessageLocation, futureMessageLocation);
-			remove(currentMessageLocation);
+		printf("%s: %zu message%s, page %zu of %zu, by %s\n\n", title, listing->count, listing->count == 1 ? "" : "s",
+			*page + 1, numPages, sortNames[listing->sort]);
+		printf("%6s  %-19s  %-20s  %10s  A  %s\n", "#", "Date", listing->folder == 's' ? "To" : "From", "Size", "Subject");
 
-			// Move attachment link if necessary
-			if (attachment) {
-				link(currentAttachName, futureAttachName);
-				remove(currentAttachName);
-			}
+		// Only the records on this page are read
+		first = *page * LISTING_PAGE_SIZE;
 
-			pid_t childID = fork();
+		const messageRecord* record;
+		for (size_t i = first; i < first + LISTING_PAGE_SIZE && (record = listingRecord(listing, i)) != NULL; i++) {
 
-			char* vimArgs[] = {"vim", "-M", futureMessageLocation, NULL};
+			char dateTime[32];
+			formatTimestamp(record->timestamp, dateTime, sizeof(dateTime));
 
-			// Child opens message
-			if (!childID) {
-				execvp("vim", vimArgs);
+			char who[48];
+			if (listing->folder == 's' && record->recipientCount > 1) {
+				snprintf(who, sizeof(who), "%s (+%u)", record->firstRecipient, record->recipientCount - 1);
 			}
 			else {
-				wait(NULL);
+				snprintf(who, sizeof(who), "%s", listing->folder == 's' ? record->firstRecipient : record->sender);
+			}
 
-				// User can download an attachment to their home directory
-				if (attachment) {
-					if (yesNoPromptFunc("Would you like to download the file attached to this message")) {
-						char* attachmentFilePath = malloc(strlen("/home/") + strlen(username) + strlen("/") + sizeof(attachBuffer));
-						sprintf(attachmentFilePath, "/home/%s/%s", username, attachBuffer);
+			printf("%6zu  %-19s  %-20s  %10llu  %c  %s\n", i + 1, dateTime, who, (unsigned long long) record->size,
+				recordHasAttachment(record) ? '*' : ' ', record->subject);
+		}
 
-						printf("The file will be downloaded to: %s\n", attachmentFilePath);
+		if (listing->count == 0) {
+			printf("\nNo Messages\n");
+		}
 
-						if (yesNoPromptFunc("Download the file")) {
-							copyFile(futureAttachName, attachmentFilePath, true);
-						}
-						free(attachmentFilePath);
-					}
+		printf("\nOpen a Message: its #\n");
+		printf("Next Page: N  Previous Page: P  Sort by Date: D  Sort by %s: F  Sort by Size: Z  Back: Q\n",
+			listing->folder == 's' ? "Recipient" : "Sender");
+		printf("Your Selection: ");
 
-				}
-				
-			}
-			free(currentMessageLocation);
-			free(futureMessageLocation);
-			free(currentAttachName);
-			free(futureAttachName);
+		if (fgets(input, sizeof(input), stdin) == NULL) {
+			return -1;
 		}
-		else {
-			fprintf(stillUnreadFile, "%s\n", buffer);
+
+		// Rest of an overlong line is thrown away
+		if (strchr(input, '\n') == NULL) {
+			int discard;
+			while ((discard = getchar()) != '\n' && discard != EOF);
 		}
-	}
-	fclose(unreadLogCopyFile);
-	remove(unreadLogCopy);
 
-	fclose(stillUnreadFile);
+		char* end;
+		unsigned long long selected = strtoull(input, &end, 10);
 
-	// Acquire the lock again
-	flock(lockFD, LOCK_EX);
+		if (end != input && (*end == '\n' || *end == '\0')) {
+			if (selected >= 1 && listingRecord(listing, selected - 1) != NULL) {
+				*page = (selected - 1) / LISTING_PAGE_SIZE;
+				return selected - 1;
+			}
+			continue;
+		}
 
-	// Add any new arrivals to the still unread file
-	appendFile(userPaths->unreadLog, stillUnread);
-	// Copy the still unread file to the log
-	copyFile(stillUnread, userPaths->unreadLog, false);
+		switch (tolower(input[0])) {
+			case 'n':
+				if (*page + 1 < numPages) {
+					(*page)++;
+				}
+				break;
+			case 'p':
+				if (*page > 0) {
+					(*page)--;
+				}
+				break;
+			case 'd':
+				sortListing(listing, SORT_BY_DATE);
+				*page = 0;
+				break;
+			case 'f':
+				sortListing(listing, SORT_BY_SENDER);
+				*page = 0;
+				break;
+			case 'z':
+				sortListing(listing, SORT_BY_SIZE);
+				*page = 0;
+				break;
+			case 'q':
+				return -1;
+		}
+	}
+}
 
-	// Remove still unread
-	remove(stillUnread);
+// Function to view all unread mail
+void viewMail(char* username, paths* userPaths, const mailboxHandle* mailbox) {
 
-	// Release the lock
-	flock(lockFD, LOCK_UN);
-	
-	fclose(unreadLockFile);
+	clearScreen();
 
-	system("clear");
+	// Mail delivered maildir-style is found from the new folder without any lock
+	removeStaleDeliveries(userPaths->tmpPath);
 
-	if (!unreadMail) {
+	mailListing listing;
+	if (openListing(userPaths, 'u', &listing) != 0 || listing.count == 0) {
+		closeListing(&listing);
 		printf("No Unread Mail!\n");
+		return;
 	}
 
-	free(unreadLogCopy);
-	free(stillUnread);
-
-}
-
-// Function to view all read mail
-void viewOldMail(char* username, paths* userPaths) {
-
-	system("clear");
-	
+	// Senders only ever append to the unread index, so they share the lock with
+	// readers. Only compaction takes it exclusively
+	int lockFD = openat(mailbox->unreadFD, lockName + 1, O_RDONLY | O_CLOEXEC);
+	uint64_t lockedAt;
+
+	// Maildir deliveries are renamed out of new
+	int newFD = openat(mailbox->inboxFD, newStr + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	// Paths of opened messages are rebuilt in place, so reading allocates nothing
+	pathBuilder messagePath, attachmentPath;
+	setPathFolder(&messagePath, userPaths->readPath);
+	setPathFolder(&attachmentPath, userPaths->readPath);
+
+	size_t page = 0;
+	ssize_t selected;
+
+	// Reading a message moves it to the read folder and off this listing
+	while ((selected = browseListing(&listing, "Unread Mail", &page)) >= 0) {
+		messageRecord record = *listingRecord(&listing, selected);
+		size_t indexPosition;
+		bool indexed = listingIndexPosition(&listing, selected, &indexPosition);
+		int status = markMessageRead(mailbox, userPaths, lockFD, newFD, &record, indexed, indexPosition);
+
+		// A message another session has read is dropped. One that could not be
+		// moved stays unread, so it is neither logged nor passed by the cursor
+		if (status != 0) {
+			if (status > 0) {
+				removeFromListing(&listing, selected);
+			}
+			else {
+				perror("Error reading message");
+			}
+			continue;
+		}
 
-	char buffer[MAX_LINE_LENGTH];
-	char tokenBuffer[MAX_LINE_LENGTH];
-	bool readMail = false;
+		moveInSearchIndex(userPaths, record.name, 'r');
+		removeFromListing(&listing, selected);
 
-	// Check if read log exists
-	struct stat bufferStat;
-	if (stat(userPaths->readLog, &bufferStat) != 0) {
-   		printf("No Read Mail!\n");
-		return;
+		showMessage(username, buildPath(&messagePath, record.name, NULL),
+			recordHasAttachment(&record) ? buildPath(&attachmentPath, record.name, "_attachment") : NULL, record.attachment);
 	}
 
-	char* readLogCopy = malloc(strlen(userPaths->readLog) + strlen("_copy") + 1);
-	sprintf(readLogCopy, "%s%s", userPaths->readLog, "_copy");
+	// The mapped index sees the entries flagged above. Every entry before
+	// the cursor was already consumed
+	size_t numRecords = listing.numMapped;
+	size_t numConsumed = listing.cursor.position;
+	size_t advance = 0;
+	bool leadingRun = true;
 
+	for (size_t i = listing.cursor.position; i < listing.numMapped; i++) {
+		bool consumed = listing.mapped[i].flags & MESSAGE_FLAG_CONSUMED;
 
-	copyFile(userPaths->readLog, readLogCopy, false);
-	FILE* readLogFile = fopen(userPaths->readLog, "w");
-
+		if (consumed) {
+			numConsumed++;
+		}
 
-	FILE* readLogCopyFile = fopen(readLogCopy, "r");
-	
-	// Read each entry in log copy
-	while (fscanf(readLogCopyFile, "%s", buffer) != EOF) {
-		readMail = true;
-		strcpy(tokenBuffer, buffer);
-		char* usernameReceive = strtok(tokenBuffer, "_");
-		char* dateTime = strtok(NULL, "\n");
-
-		unsigned int count = 0;
-
-		// Format date of message
-		for (int i = 0; i < strlen(dateTime); i++) {
-			if (dateTime[i] == '_') {
-				if (count < 2) {
-					dateTime[i] = '/';
-				}
-				else if (count == 2) {
-					dateTime[i] = ' ';
-				}
-				else {
-					dateTime[i] = ':';
-				}
-				count++;
-			}
+		// Cursor moves past the leading run of read entries
+		leadingRun = leadingRun && consumed;
+		if (leadingRun) {
+			advance++;
 		}
+	}
 
-		bool attachment;
+	indexCursor cursor = listing.cursor;
+	closeListing(&listing);
 
-		char* currentMessageLocation = malloc(strlen(userPaths->readPath) + strlen("/") + strlen(buffer) + 1);
-		sprintf(currentMessageLocation, "%s/%s", userPaths->readPath, buffer);
+	if (advance > 0) {
+		cursor.position += advance;
 
+		lockedAt = timedLock(lockFD, LOCK_SH);
+		writeIndexCursor(userPaths->unreadCursor, userPaths->unreadIndex, &cursor);
+		timedUnlock(lockFD, lockedAt);
+	}
 
-		char* currentAttachName = malloc(strlen(currentMessageLocation) + strlen("_attachment") + 1);
-		sprintf(currentAttachName, "%s%s", currentMessageLocation, "_attachment");
+	// Read entries are only dropped once they make up most of the index
+	if (numConsumed >= INDEX_COMPACT_THRESHOLD && numConsumed * 2 >= numRecords) {
+		lockedAt = timedLock(lockFD, LOCK_EX);
+		compactMessageIndex(userPaths->unreadIndex, userPaths->unreadCursor);
+		timedUnlock(lockFD, lockedAt);
+	}
+	
+	if (newFD >= 0) {
+		close(newFD);
+	}
+	close(lockFD);
 
+	clearScreen();
 
-		FILE* readMessage = fopen(currentMessageLocation, "r");
-		char attachBuffer[101];
+}
 
-		// Check for attachment
-		do {
-			fscanf(readMessage, "%s", attachBuffer);
-		} while(strcmp(attachBuffer, "Attachment:") != 0);
-		fscanf(readMessage, "%s", attachBuffer);
+// Function to view all read mail
+void viewOldMail(char* username, paths* userPaths, const mailboxHandle* mailbox) {
 
-		attachment = strcmp(attachBuffer, "NONE") != 0;
+	clearScreen();
 
-		fclose(readMessage);
+	mailListing listing;
+	if (openFolderListing(username, userPaths, 'r', &listing) != 0 || listing.count == 0) {
+		closeListing(&listing);
+   		printf("No Read Mail!\n");
+		return;
+	}
 
-		printf("Message received from %s at %s\n", usernameReceive, dateTime);
+	size_t page = 0;
+	ssize_t selected;
 
-		// Does user want to read the message
-		if(yesNoPromptFunc("Would you like to read this message")) {
-			
-			pid_t childID = fork();
+	while ((selected = browseListing(&listing, "Read Mail", &page)) >= 0) {
+		messageRecord record = *listingRecord(&listing, selected);
+		bool attachment = recordHasAttachment(&record);
 
-			char* vimArgs[] = {"vim", "-M", currentMessageLocation, NULL};
+		char attachmentName[sizeof(record.name) + strlen("_attachment")];
+		sprintf(attachmentName, "%s_attachment", record.name);
 
+		showStoredMessage(username, userPaths->readPath, &record);
 
-			if (!childID) {
-				execvp("vim", vimArgs);
-			}
-			else {
-				wait(NULL);
-				// User can download the attachment if desired
+		// Message and attachment can be deleted.
+		// The index entry is tombstoned rather than rewriting the index.
+		// An archived message stays in its segment until the whole segment is unused
+		if(yesNoPromptFunc("Would you like to delete the message")) {
+			if (!(record.flags & MESSAGE_FLAG_ARCHIVED)) {
 				if (attachment) {
-					if (yesNoPromptFunc("Would you like to download the file attached to this message")) {
-						char* attachmentFilePath = malloc(strlen("/home/") + strlen(username) + strlen("/") + sizeof(attachBuffer));
-						sprintf(attachmentFilePath, "/home/%s/%s", username, attachBuffer);
-
-						printf("The file will be downloaded to: %s\n", attachmentFilePath);
-
-						if (yesNoPromptFunc("Download the file")) {
-							copyFile(currentAttachName, attachmentFilePath, true);
-						}
-						free(attachmentFilePath);
-					}
-
+					unlinkat(mailbox->readFD, attachmentName, 0);
 				}
-				
-			}
-		}
-		// Message and attachment can be deleted
-		if(yesNoPromptFunc("Would you like to delete the message")) {
-			if (attachment) {
-				remove(currentAttachName);
+				unlinkat(mailbox->readFD, record.name, 0);
 			}
-			remove(currentMessageLocation);
-
-		}
-		// Add log entry back to log if not deleted
-		else {
-			fprintf(readLogFile, "%s\n", buffer);
+			appendTombstone(userPaths->readIndex, userPaths->readTombstones, record.name);
+			removeFromSearchIndex(userPaths, record.name);
+			removeFromListing(&listing, selected);
 		}
-		free(currentAttachName);
-		free(currentMessageLocation);
 	}
-	fclose(readLogCopyFile);
-	remove(readLogCopy);
-	fclose(readLogFile);
+	closeListing(&listing);
 
-	free(readLogCopy);
+	// The index is only rewritten once enough of it has been deleted
+	compactTombstones(userPaths->readIndex, userPaths->readTombstones);
 
 
-	system("clear");
-
-
-	if (!readMail) {
-		printf("No Read Mail!\n");
-	}
+	clearScreen();
 
 }
 
 // Function to view all sent mail
-void viewSentMail(char* username, paths* userPaths) {
-
-	system("clear");
-	
+void viewSentMail(char* username, paths* userPaths, const mailboxHandle* mailbox) {
 
-	char buffer[MAX_LINE_LENGTH];
-	bool sentMail = false;
+	clearScreen();
 
-	// Check if sent log exists
-	struct stat bufferStat;
-	if (stat(userPaths->sentLog, &bufferStat) != 0) {
+	mailListing listing;
+	if (openFolderListing(username, userPaths, 's', &listing) != 0 || listing.count == 0) {
+		closeListing(&listing);
    		printf("No Sent Mail!\n");
 		return;
 	}
 
-	char* sentLogCopy = malloc(strlen(userPaths->sentLog) + strlen("_copy") + 1);
-	sprintf(sentLogCopy, "%s%s", userPaths->sentLog, "_copy");
+	size_t page = 0;
+	ssize_t selected;
 
+	while ((selected = browseListing(&listing, "Sent Mail", &page)) >= 0) {
+		messageRecord record = *listingRecord(&listing, selected);
+		bool attachment = recordHasAttachment(&record);
 
-	copyFile(userPaths->sentLog, sentLogCopy, false);
-	FILE* sentLogFile = fopen(userPaths->sentLog, "w");
+		char attachmentName[sizeof(record.name) + strlen("_attachment")];
+		sprintf(attachmentName, "%s_attachment", record.name);
 
+		char destinationsName[sizeof(record.name) + strlen("_destinations.txt")];
+		sprintf(destinationsName, "%s_destinations.txt", record.name);
 
-	FILE* sentLogCopyFile = fopen(sentLogCopy, "r");
-	
-	// Read each entry of sent log copy
-	while (fscanf(sentLogCopyFile, "%s", buffer) != EOF) {
-		sentMail = true;
-		char dateTime[MAX_LINE_LENGTH];
-		strcpy(dateTime, buffer);
+		showStoredMessage(username, userPaths->sentPath, &record);
 
-		unsigned int count = 0;
-		
-		// Extract date in proper format
-		for (int i = 0; i < strlen(dateTime); i++) {
-			if (dateTime[i] == '_') {
-				if (count < 2) {
-					dateTime[i] = '/';
-				}
-				else if (count == 2) {
-					dateTime[i] = ' ';
-				}
-				else {
-					dateTime[i] = ':';
+		// Deletes message, destinations list, and attachment.
+		// An archived message stays in its segment until the whole segment is unused
+		if(yesNoPromptFunc("Would you like to delete the message")) {
+			if (!(record.flags & MESSAGE_FLAG_ARCHIVED)) {
+				if (attachment) {
+					unlinkat(mailbox->sentFD, attachmentName, 0);
 				}
-				count++;
+				unlinkat(mailbox->sentFD, record.name, 0);
+				unlinkat(mailbox->sentFD, destinationsName, 0);
 			}
+			appendTombstone(userPaths->sentIndex, userPaths->sentTombstones, record.name);
+			removeFromSearchIndex(userPaths, record.name);
+			removeFromListing(&listing, selected);
 		}
+	}
+	closeListing(&listing);
 
-		bool attachment;
-
-		char* currentMessageLocation = malloc(strlen(userPaths->sentPath) + strlen("/") + strlen(buffer) + 1);
-		sprintf(currentMessageLocation, "%s/%s", userPaths->sentPath, buffer);
-
-
-		char* currentAttachName = malloc(strlen(currentMessageLocation) + strlen("_attachment") + 1);
-		sprintf(currentAttachName, "%s%s", currentMessageLocation, "_attachment");
-
-		char* currentDestinations = malloc(strlen(currentMessageLocation) + strlen("_destinations.txt") + 1);
-		sprintf(currentDestinations, "%s%s", currentMessageLocation, "_destinations.txt");
-
-
-		FILE* sentMessage = fopen(currentMessageLocation, "r");
-		char attachBuffer[101];
-
-		// Check for attachment
-		do {
-			fscanf(sentMessage, "%s", attachBuffer);
-		} while(strcmp(attachBuffer, "Attachment:") != 0);
-		fscanf(sentMessage, "%s", attachBuffer);
-
-		attachment = strcmp(attachBuffer, "NONE") != 0;
-
-		fclose(sentMessage);
-
-		unsigned int destCount = 0;
-
-		FILE* desinationFile = fopen(currentDestinations, "r");
+	// The index is only rewritten once enough of it has been deleted
+	compactTombstones(userPaths->sentIndex, userPaths->sentTombstones);
 
-		char destinationsBuffer[MAX_LINE_LENGTH];
+	clearScreen();
 
-		printf("Message sent at %s to ", dateTime);
+}
 
-		// Print who the message was sent to
-		while (fscanf(desinationFile, "%s", destinationsBuffer) != EOF) {
-			if (destCount == 0) {
-				printf("%s", destinationsBuffer);
-			}
-			else {
-				printf(", %s", destinationsBuffer);
+// Prints the outcome of a send for each destination.
+// Successful deliveries are only listed if verbose is true
+void printDeliveryReport(const deliveryResult* results, unsigned int numDestinations, bool verbose) {
+	for (unsigned int i = 0; i < numDestinations; i++) {
+		if (results[i].delivered) {
+			if (verbose) {
+				printf("Delivered to %s\n", results[i].username);
 			}
-			destCount++;
 		}
-		printf("\n");
-
-		fclose(desinationFile);
-
-		// User can read the message
-		if(yesNoPromptFunc("Would you like to read this message")) {
-			
-			pid_t childID = fork();
+		else {
+			printf("Could not deliver to %s after %d attempt(s): %s\n", results[i].username,
+				results[i].attempts, strerror(results[i].error));
+		}
+	}
+}
 
-			char* vimArgs[] = {"vim", "-M", currentMessageLocation, NULL};
+// Validates the destinations added since the last check. A group costs one
+// lookup in the cached group index plus adding its members.
+// Returns the number of invalid destinations found
+size_t checkRecipients(recipientList* recipients) {
+	if (recipients->numGroupNames > 0 && groupDirectory.map == NULL) {
+		loadGroupIndex(&groupDirectory, groupsFilename, usersFilename, groupIndexFilename);
+	}
 
+	return validateRecipients(recipients, &userDirectory, &groupDirectory, usersFilename);
+}
 
-			if (!childID) {
-				execvp("vim", vimArgs);
-			}
-			else {
-				wait(NULL);
-				// User can download an attachment
-				if (attachment) {
-					if (yesNoPromptFunc("Would you like to download the file attached to this message")) {
-						char* attachmentFilePath = malloc(strlen("/home/") + strlen(username) + strlen("/") + sizeof(attachBuffer));
-						sprintf(attachmentFilePath, "/home/%s/%s", username, attachBuffer);
+// Reads destinations typed or pasted at the prompt until a blank line. Names
+// are separated by commas or whitespace, @name is a distribution group, and a
+// line starting with < names a file in the user's home directory to read them from
+void promptRecipients(char* username, recipientList* recipients) {
+	char* line = NULL;
+	size_t lineCapacity = 0;
+	ssize_t lineLength;
 
-						printf("The file will be downloaded to: %s\n", attachmentFilePath);
+	printf("Enter the destinations, separated by spaces or commas. @name sends to a group.\n");
+	printf("<file reads them from a file in /home/%s. Finish with an empty line:\n", username);
 
-						if (yesNoPromptFunc("Download the file")) {
-							copyFile(currentAttachName, attachmentFilePath, true);
-						}
-						free(attachmentFilePath);
-					}
+	while ((lineLength = getline(&line, &lineCapacity, stdin)) > 0) {
+		char* start = line + strspn(line, RECIPIENT_SEPARATORS);
 
-				}
-				
-			}
+		if (*start == '\0') {
+			break;
 		}
-		// Deletes message, destinations list, and attachment
-		if(yesNoPromptFunc("Would you like to delete the message")) {
-			if (attachment) {
-				remove(currentAttachName);
-			}
-			remove(currentMessageLocation);
-			remove(currentDestinations);
 
+		if (*start != '<') {
+			addRecipientsFromText(recipients, start);
+			continue;
 		}
-		// Adds entry back to sent log if not deleted
-		else {
-			fprintf(sentLogFile, "%s\n", buffer);
-		}
-		free(currentAttachName);
-		free(currentMessageLocation);
-		free(currentDestinations);
-	}
-	fclose(sentLogCopyFile);
-	remove(sentLogCopy);
-	fclose(sentLogFile);
 
-	free(sentLogCopy);
+		start[strcspn(start, "\r\n")] = '\0';
+
+		char listFilePath[PATH_MAX];
+		snprintf(listFilePath, sizeof(listFilePath), "/home/%s/%s", username, start + 1 + strspn(start + 1, " \t"));
 
-	system("clear");
+		// Opened with the real user's permissions, so no root-only file can be read
+		int listFD = openAsRealUser(listFilePath);
 
+		if (listFD < 0) {
+			printf("Cannot read %s\n", listFilePath);
+			continue;
+		}
+
+		long numAdded = readRecipients(recipients, listFD, false);
+		close(listFD);
 
-	if (!sentMail) {
-		printf("No Sent Mail!\n");
+		printf("Read %ld destination(s) from %s\n", numAdded < 0 ? 0 : numAdded, listFilePath);
 	}
+	free(line);
 
+	if (recipients->numDuplicates > 0) {
+		printf("%zu repeated destination(s) ignored\n", recipients->numDuplicates);
+	}
 }
 
 // Function to send a message
@@ -746,6 +581,7 @@ void composeMail(char* username, paths* userPaths) {
 	FILE* clearDestinations = fopen(userDestinations, "w");
 	fclose(clearDestinations);
 
+	TRACE_BEGIN(TRACE_EDITOR);
 	pid_t childID = fork();
 
 	char* vimArgs[] = {"vim", userPersonalDraftFilePath, NULL};
@@ -762,6 +598,7 @@ void composeMail(char* username, paths* userPaths) {
 	}
 	else {
 		wait(NULL);
+		TRACE_END(TRACE_EDITOR);
 
 		char subject[100];
 		
@@ -770,7 +607,7 @@ void composeMail(char* username, paths* userPaths) {
 		char yesNo;
 		char discard;
 
-		system("clear");
+		clearScreen();
 		// User enters a subject line
 		do {
 			printf("Please enter a subject line for your message (100 chars max):\n\n");
@@ -795,11 +632,8 @@ void composeMail(char* username, paths* userPaths) {
 
 
 
-		FILE* personalDraft = fopen(userPersonalDraftFilePath, "r");
 		FILE* actualDraft = fopen(userDraftFilePath, "w");
 
-		char buffer[MAX_LINE_LENGTH];
-
 		fprintf(actualDraft, "From: %s\n", username);
 		fprintf(actualDraft, "Subject: %s", subject);
 
@@ -816,19 +650,18 @@ void composeMail(char* username, paths* userPaths) {
 				char* attachmentFilePath = malloc(strlen("/home/") + strlen(username) + strlen("/") + sizeof(attachBuffer));
 				sprintf(attachmentFilePath, "/home/%s/%s", username, attachBuffer);
 
-				if (access(attachmentFilePath, F_OK) == 0) {
+				// Opened with the real user's permissions since the copy runs as root
+				int attachmentFD = openAsRealUser(attachmentFilePath);
+
+				if (attachmentFD >= 0) {
         			printf("File '%s' exists.\n", attachmentFilePath);
 					invalidPath = false;
 
-					FILE* personalAttachment = fopen(attachmentFilePath, "r");
-					FILE* draftFolderAttach = fopen(userDraftAttachmentFilePath, "w");
-
-					while (fgets(buffer, sizeof(buffer), personalAttachment) != NULL) {
-						fputs(buffer, draftFolderAttach);
+					// Binary safe copy into the drafts folder
+					if (copyFileFrom(attachmentFD, userDraftAttachmentFilePath, false) != 0) {
+						attachment = false;
 					}
-
-					fclose(personalAttachment);
-					fclose(draftFolderAttach);
+					close(attachmentFD);
     			} 
 				else {
         			printf("File does not exist\n");
@@ -862,12 +695,9 @@ void composeMail(char* username, paths* userPaths) {
 			fprintf(actualDraft, "Attachment: NONE\n\n");
 		}
 
-		while (fgets(buffer, sizeof(buffer), personalDraft) != NULL) {
-			fputs(buffer, actualDraft);
-		}
-
-		fclose(personalDraft);
+		// Message body follows the header
 		fclose(actualDraft);
+		appendFile(userPersonalDraftFilePath, userDraftFilePath);
 		remove(userPersonalDraftFilePath);
 
 		promptAgainYesNo = true;
@@ -907,202 +737,689 @@ void composeMail(char* username, paths* userPaths) {
 		}
 		// Send the message
 		else {
-			char destination[33];
-			char line[MAX_LINE_LENGTH];
-			bool matchFound = false;
-			unsigned int numDestinations = 0;
+			recipientList recipients;
+			initRecipientList(&recipients);
 
-			const char* usrsFilePath = "/CompanyMail/Config/users";
+			clearScreen();
 
-			system("clear");
-
-			FILE* usrFile;
+			// Destinations are entered in bulk and checked against the user table together
+			do {
+				promptRecipients(username, &recipients);
 
+				checkRecipients(&recipients);
+				printInvalidRecipients(&recipients, stdout);
 
-			usrFile = fopen(usrsFilePath, "r");
+				printf("The message is addressed to %zu destination(s)\n\n", recipients.numValid);
 
-			// must specify a valid account to send the message to
-			do {
-				matchFound = false;
-				fseek(usrFile, 0, SEEK_SET);
-				printf("Which user would you like to send the message to?: ");
+				// User may add more destinations.
+			} while (yesNoPromptFunc("Would you like to add more destinations"));
 
-				scanf("%32s", destination);
+			unsigned int numDestinations = recipients.numValid;
 
-				// Performs destination username validation
-				while(fgets(line, sizeof(line), usrFile) != NULL && !matchFound) {
-					char *compareUsername = strtok(line, ":");
+			// The destinations file is written once with every valid destination
+			if (numDestinations > 0 && writeRecipients(&recipients, userDestinations) != 0) {
+				perror("Error saving destinations");
+				numDestinations = 0;
+			}
+			freeRecipientList(&recipients);
 
-					if (!strcmp(destination, compareUsername)) {
-						matchFound = true;
-					}
-						
-				}
-				// Checks if user already addressed message to specified valid account
-				if (matchFound && numDestinations > 0) {
-					char compareDest[33];
-					bool alreadyAdded = false;
-					
-					FILE* destinationsFile;
-
-					destinationsFile = fopen(userDestinations, "r");
-
-					while (fscanf(destinationsFile, "%s", compareDest) != EOF && !alreadyAdded) {
-    					if (!strcmp(destination, compareDest)) {
-        					alreadyAdded = true;
-							matchFound = false;
-        					printf("Message already addressed to %s.\n", destination);
-    					}
-					}
+			// Sends message if user specified at least one valid destination
+			if (numDestinations > 0) {
+				deliveryResult* results = malloc(numDestinations * sizeof(deliveryResult));
 
+				int failures = deliverDraft(username, userPaths, userDraftFilePath,
+					attachment ? userDraftAttachmentFilePath : NULL,
+					userDestinations, numDestinations, results);
 
+				clearScreen();
+				printf("Mesage Sent\n");
 
-					fprintf(destinationsFile, "%s\n", destination);
-					fclose(destinationsFile);
+				// Only destinations that could not be reached are reported
+				if (failures > 0) {
+					printDeliveryReport(results, numDestinations, false);
+					sleep(2);
 				}
+				sleep(1);
 
-				if (!matchFound) {
-					printf("Invalid Destination\n");
-				}
-				// Destination is valid, so destination username adds to destination list
-				else {
-					numDestinations++;
-					FILE* destinationsFile;
-					destinationsFile = fopen(userDestinations, "a");
-					printf("The destination: %s\n\n", destination);
-					fprintf(destinationsFile, "%s\n", destination);
-					fclose(destinationsFile);
+				free(results);
+			}
+		}
+	}
+	clearScreen();
 
-				}
-				// User may add another destination.
-			} while (yesNoPromptFunc("Would you like to add another destination"));
+	free(userDraftFilePath);
+	free(userPersonalDraftFilePath);
+	free(userDraftAttachmentFilePath);
+	free(userDestinations);
 
-			// Sends message if user specified at least one valid destination
-			if (numDestinations > 0) {
-				char* timeStr = getTimeString();
+	userDraftFilePath = NULL;
+	userPersonalDraftFilePath = NULL;
+	userDraftAttachmentFilePath = NULL;
+	userDestinations = NULL;
+}
 
-				FILE* sentLog = fopen(userPaths->sentLog, "a");
+// Prints the usage of the non-interactive batch mode
+void printBatchUsage(void) {
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "  mail send --to user|@group[,...] --subject text [--attach path [--attach-name name]] < body\n");
+	fprintf(stderr, "  mail send --to-file file --subject text ... < body   (--to-file - reads destinations\n");
+	fprintf(stderr, "      from stdin up to the first empty line, followed by the body)\n");
+	fprintf(stderr, "  mail list [--unread | --read | --sent] [--format=text | --format=tsv]\n");
+	fprintf(stderr, "  mail count\n");
+	fprintf(stderr, "  mail groups\n");
+	fprintf(stderr, "  mail show id\n");
+	fprintf(stderr, "  mail search [--format=text | --format=tsv] word...\n");
+	fprintf(stderr, "  mail grep [--format=text | --format=tsv] pattern\n");
+	fprintf(stderr, "  mail archive [--days n] [--compress]   (packs read and sent mail older than n days,\n");
+	fprintf(stderr, "      %d by default, into archive segments)\n", ARCHIVE_DEFAULT_DAYS);
+	fprintf(stderr, "  mail --stats\n");
+	fprintf(stderr, "  mail --vim   (interactive, messages open in vim)\n");
+}
 
-				// Logs sending
-				fprintf(sentLog, "%s\n", timeStr);
-				fclose(sentLog);
+// Sends a message without any prompts. The body is streamed from stdin.
+// Returns 0 if every destination received the message
+int batchSend(char* username, paths* userPaths, int argc, char* argv[]) {
+	static struct option sendOptions[] = {
+		{"to", required_argument, NULL, 't'},
+		{"to-file", required_argument, NULL, 'f'},
+		{"subject", required_argument, NULL, 's'},
+		{"attach", required_argument, NULL, 'a'},
+		{"attach-name", required_argument, NULL, 'n'},
+		{NULL, 0, NULL, 0}
+	};
+
+	char* destinationList[argc];
+	unsigned int numLists = 0;
+	char* destinationFiles[argc];
+	unsigned int numFiles = 0;
+	char* subject = NULL;
+	char* attachPath = NULL;
+	char* attachName = NULL;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "t:f:s:a:n:", sendOptions, NULL)) != -1) {
+		switch (option) {
+			case 't':
+				destinationList[numLists++] = optarg;
+				break;
+			case 'f':
+				destinationFiles[numFiles++] = optarg;
+				break;
+			case 's':
+				subject = optarg;
+				break;
+			case 'a':
+				attachPath = optarg;
+				break;
+			case 'n':
+				attachName = optarg;
+				break;
+			default:
+				printBatchUsage();
+				return 1;
+		}
+	}
 
+	if ((numLists == 0 && numFiles == 0) || subject == NULL) {
+		printBatchUsage();
+		return 1;
+	}
 
-				// Filenames are generated for both the sender's sent folder and the unread folders of the destinations
-				char* sentName = malloc(strlen(userPaths->sentPath) + strlen("/") + strlen(timeStr) + 1);
-				sprintf(sentName, "%s/%s", userPaths->sentPath, timeStr);
+	if (strlen(subject) > 100 || strchr(subject, '\n') != NULL) {
+		fprintf(stderr, "Subject must be a single line of at most 100 chars\n");
+		return 1;
+	}
 
-				char* sentDestinations = malloc(strlen(userPaths->sentPath) + strlen("/") + strlen(timeStr) + strlen("_destinations.txt") + 1);
-				sprintf(sentDestinations, "%s/%s_destinations.txt", userPaths->sentPath, timeStr);
+	// Attachment name defaults to the name of the attached file
+	if (attachPath != NULL && attachName == NULL) {
+		attachName = strrchr(attachPath, '/') != NULL ? strrchr(attachPath, '/') + 1 : attachPath;
+	}
 
-				// moves draft from draft to sent folder
-				link(userDraftFilePath, sentName);
-				link(userDestinations, sentDestinations);
+	if (attachName != NULL && (strlen(attachName) == 0 || strlen(attachName) > 100 || strpbrk(attachName, " \t\n/") != NULL)) {
+		fprintf(stderr, "Invalid attachment name\n");
+		return 1;
+	}
 
-				char* destLogMessageName = malloc(strlen(username) + strlen("_") + strlen(timeStr) + 1);
-				sprintf(destLogMessageName, "%s_%s", username, timeStr);
+	// Drafts are named by PID so concurrent batch sends from one user do not collide
+	char* draftFilePath = malloc(strlen(userPaths->draftPath) + strlen("/draft_.txt") + 11 + 1);
+	sprintf(draftFilePath, "%s/draft_%d.txt", userPaths->draftPath, getpid());
 
-				char* destFileMessageName = malloc(strlen(username) + strlen("_") + strlen(timeStr) + 1);
-				sprintf(destFileMessageName, "%s_%s", username, timeStr);
+	char* draftAttachmentFilePath = malloc(strlen(userPaths->draftPath) + strlen("/draft_.attach") + 11 + 1);
+	sprintf(draftAttachmentFilePath, "%s/draft_%d.attach", userPaths->draftPath, getpid());
 
-				char* attachmentName;
+	char* destinationsFilePath = malloc(strlen(userPaths->draftPath) + strlen("/destinations_.txt") + 11 + 1);
+	sprintf(destinationsFilePath, "%s/destinations_%d.txt", userPaths->draftPath, getpid());
 
-				// attachment moved if necessary
-				if (attachment) {
-					attachmentName = malloc(strlen(destFileMessageName) + strlen("_") + strlen("attachment") + 1);
-					sprintf(attachmentName, "%s_%s", destFileMessageName, "attachment");
+	// Destinations from every source are merged without repeats, then
+	// validated together before anything is written
+	recipientList recipients;
+	initRecipientList(&recipients);
 
-					char* senderAttachmentPath = malloc(strlen(sentName) + strlen("_") + strlen("attachment") + 1);
-					sprintf(senderAttachmentPath, "%s_%s", sentName, "attachment");
+	int status = 1;
+	bool unreadableList = false;
 
-					link(userDraftAttachmentFilePath, senderAttachmentPath);
-					
-					free(senderAttachmentPath);
-					senderAttachmentPath = NULL;
-				}
-				else {
-					attachmentName = NULL;
-				}
+	for (unsigned int i = 0; i < numLists; i++) {
+		addRecipientsFromText(&recipients, destinationList[i]);
+	}
+
+	for (unsigned int i = 0; i < numFiles; i++) {
+		bool fromStdin = !strcmp(destinationFiles[i], "-");
+
+		// Opened with the real user's permissions, so no root-only file can be read
+		int listFD = fromStdin ? STDIN_FILENO : openAsRealUser(destinationFiles[i]);
+
+		if (listFD < 0 || readRecipients(&recipients, listFD, fromStdin) < 0) {
+			fprintf(stderr, "Cannot read destinations from %s\n", destinationFiles[i]);
+			unreadableList = true;
+		}
+		if (listFD >= 0 && !fromStdin) {
+			close(listFD);
+		}
+	}
 
-				FILE* destinationsFile = fopen(userDestinations, "r");
+	checkRecipients(&recipients);
+	printInvalidRecipients(&recipients, stderr);
 
-				// Sends to each user specified in destinations file
-				for (int i = 0; i < numDestinations; i++) {
-					char destUsername[33];
+	unsigned int numDestinations = recipients.numValid;
 
-					fscanf(destinationsFile, "%s", destUsername);
-					paths curDestPaths;
-					generatePaths(&curDestPaths, destUsername);
+	if (unreadableList || recipients.numInvalid > 0 || numDestinations == 0) {
+		freeRecipientList(&recipients);
+		goto cleanup;
+	}
 
-					
+	// The destinations file is written once
+	if (writeRecipients(&recipients, destinationsFilePath) != 0) {
+		perror("Error saving destinations");
+		freeRecipientList(&recipients);
+		remove(destinationsFilePath);
+		goto cleanup;
+	}
+	freeRecipientList(&recipients);
 
-					char* destFilePath = malloc(strlen(curDestPaths.unreadPath) + strlen("/") + strlen(destFileMessageName));
-					sprintf(destFilePath, "%s/%s", curDestPaths.unreadPath, destFileMessageName);
+	// The attachment is opened with the real user's permissions, once, so the
+	// path cannot be swapped for one only root can read
+	if (attachPath != NULL) {
+		int attachmentFD = openAsRealUser(attachPath);
 
-					FILE* curDestLock = fopen(curDestPaths.unreadLock, "r");
+		if (attachmentFD < 0) {
+			fprintf(stderr, "Cannot read attachment %s\n", attachPath);
+			remove(destinationsFilePath);
+			goto cleanup;
+		}
 
-					int lockFD = fileno(curDestLock);
+		int copied = copyFileFrom(attachmentFD, draftAttachmentFilePath, false);
+		close(attachmentFD);
 
-					// Lock aquired so entry in destination's unread log can be safely added
-					flock(lockFD, LOCK_EX);
+		if (copied != 0) {
+			remove(draftAttachmentFilePath);
+			remove(destinationsFilePath);
+			goto cleanup;
+		}
+	}
 
-					FILE* curDestLog = fopen(curDestPaths.unreadLog, "a");
+	FILE* draft = fopen(draftFilePath, "w");
 
-					// Entry added
-					fprintf(curDestLog, "%s\n", destLogMessageName);
+	if (draft == NULL) {
+		perror("Error creating draft");
+		if (attachPath != NULL) {
+			remove(draftAttachmentFilePath);
+		}
+		remove(destinationsFilePath);
+		goto cleanup;
+	}
 
-					fclose(curDestLog);
+	fprintf(draft, "From: %s\n", username);
+	fprintf(draft, "Subject: %s\n", subject);
+	fprintf(draft, "Attachment: %s\n\n", attachPath != NULL ? attachName : "NONE");
 
-					// Link created in destination unread directory
-					link(userDraftFilePath, destFilePath);
+	// Body is streamed from stdin, in the kernel when stdin is a file.
+	// A body that could not be read in full is never delivered
+	bool bodyWritten = fflush(draft) == 0 && copyFileData(STDIN_FILENO, fileno(draft)) == 0;
 
-					// Attachment link created if necessary
-					if (attachment) {
-						char * destAttachName = malloc(strlen(curDestPaths.unreadPath) + strlen("/") + strlen(attachmentName) + 1);
-						sprintf(destAttachName, "%s/%s", curDestPaths.unreadPath, attachmentName);
-						link(userDraftAttachmentFilePath, destAttachName);
-						free(destAttachName);
-					}
+	if (fclose(draft) != 0) {
+		bodyWritten = false;
+	}
+
+	if (!bodyWritten) {
+		perror("Error reading message body");
+		remove(draftFilePath);
+		if (attachPath != NULL) {
+			remove(draftAttachmentFilePath);
+		}
+		remove(destinationsFilePath);
+		goto cleanup;
+	}
+
+	deliveryResult* results = malloc(numDestinations * sizeof(deliveryResult));
+
+	int failures = deliverDraft(username, userPaths, draftFilePath,
+		attachPath != NULL ? draftAttachmentFilePath : NULL,
+		destinationsFilePath, numDestinations, results);
+
+	// Scripts get one line per destination
+	printDeliveryReport(results, numDestinations, true);
+	printf("Message sent to %u of %u destinations\n", numDestinations - failures, numDestinations);
+
+	free(results);
+
+	status = failures == 0 ? 0 : 2;
+
+cleanup:
+	free(draftFilePath);
+	free(draftAttachmentFilePath);
+	free(destinationsFilePath);
+
+	return status;
+}
+
+// Prints one message of a listing.
+// folder is 'u' for unread, 'r' for read, or 's' for sent
+void batchPrintRecord(char* username, const messageRecord* record, char folder, bool tsv) {
+	const char* folderName = folder == 'u' ? "unread" : folder == 'r' ? "read" : "sent";
+
+	char dateTime[32];
+	formatTimestamp(record->timestamp, dateTime, sizeof(dateTime));
+
+	// Inbox messages were sent to this user, sent messages list their first destination
+	const char* destination = folder == 's' ? record->firstRecipient : username;
+
+	if (tsv) {
+		printf("%s\t%s\t%s\t%s\t%u\t%s\t%llu\t%s\t%s\n", folderName, record->name, record->sender, destination,
+			record->recipientCount, dateTime, (unsigned long long) record->size, record->attachment, record->subject);
+	}
+	else {
+		printf("[%s] %s  From: %s  To: %s", folderName, dateTime, record->sender, destination);
+		if (record->recipientCount > 1) {
+			printf(" (+%u)", record->recipientCount - 1);
+		}
+		printf("  Subject: %s  Attachment: %s\n", record->subject, record->attachment);
+	}
+}
 
-					// Lock released
-					flock(lockFD, LOCK_UN);
+// Lists one mailbox without prompts or modifying it
+void batchListFolder(char* username, paths* userPaths, char folder, bool tsv) {
+	size_t numRecords;
+	messageRecord* records = readFolderRecords(username, userPaths, folder, &numRecords);
 
-					fclose(curDestLock);
-					
-					free(destFilePath);
-					destFilePath = NULL;
-					freePaths(&curDestPaths);
+	for (size_t i = 0; i < numRecords; i++) {
+		batchPrintRecord(username, &records[i], folder, tsv);
+	}
 
+	free(records);
+}
+
+// Lists mailboxes without prompts. Defaults to every folder in text format
+int batchList(char* username, paths* userPaths, int argc, char* argv[]) {
+	static struct option listOptions[] = {
+		{"unread", no_argument, NULL, 'u'},
+		{"read", no_argument, NULL, 'r'},
+		{"sent", no_argument, NULL, 's'},
+		{"format", required_argument, NULL, 'f'},
+		{NULL, 0, NULL, 0}
+	};
+
+	bool listUnread = false, listRead = false, listSent = false;
+	bool tsv = false;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "urs", listOptions, NULL)) != -1) {
+		switch (option) {
+			case 'u':
+				listUnread = true;
+				break;
+			case 'r':
+				listRead = true;
+				break;
+			case 's':
+				listSent = true;
+				break;
+			case 'f':
+				if (!strcmp(optarg, "tsv")) {
+					tsv = true;
 				}
-				// Clears out user's draft folder
-				remove(userDraftFilePath);
-				remove(userDestinations);
-				if (attachment) {
-					remove(userDraftAttachmentFilePath);
-					free(attachmentName);
+				else if (strcmp(optarg, "text") != 0) {
+					printBatchUsage();
+					return 1;
 				}
-				system("clear");
-				printf("Mesage Sent\n");
-				sleep(1);
+				break;
+			default:
+				printBatchUsage();
+				return 1;
+		}
+	}
+
+	if (!listUnread && !listRead && !listSent) {
+		listUnread = listRead = listSent = true;
+	}
+
+	if (tsv) {
+		printf("folder\tid\tfrom\tto\trecipients\tdate\tsize\tattachment\tsubject\n");
+	}
+	if (listUnread) {
+		batchListFolder(username, userPaths, 'u', tsv);
+	}
+	if (listRead) {
+		batchListFolder(username, userPaths, 'r', tsv);
+	}
+	if (listSent) {
+		batchListFolder(username, userPaths, 's', tsv);
+	}
+
+	return 0;
+}
+
+// Lists the messages holding every given word, oldest first.
+// Answered from the search index without opening any message
+int batchSearch(char* username, paths* userPaths, int argc, char* argv[]) {
+	static struct option searchOptions[] = {
+		{"format", required_argument, NULL, 'f'},
+		{NULL, 0, NULL, 0}
+	};
+
+	bool tsv = false;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", searchOptions, NULL)) != -1) {
+		if (option == 'f' && !strcmp(optarg, "tsv")) {
+			tsv = true;
+		}
+		else if (option != 'f' || strcmp(optarg, "text") != 0) {
+			printBatchUsage();
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		printBatchUsage();
+		return 1;
+	}
 
-				free(sentName);
-				free(sentDestinations);
-				free(destLogMessageName);
-				free(destFileMessageName);
+	// Every remaining argument is part of the query
+	size_t queryLength = 1;
+	for (int i = optind; i < argc; i++) {
+		queryLength += strlen(argv[i]) + 1;
+	}
+
+	char* query = malloc(queryLength);
+	query[0] = '\0';
+	for (int i = optind; i < argc; i++) {
+		strcat(query, argv[i]);
+		strcat(query, " ");
+	}
+
+	size_t numMatches;
+	searchDoc* matches = searchMailbox(userPaths, query, &numMatches);
+
+	if (tsv) {
+		printf("folder\tid\tfrom\tto\trecipients\tdate\tsize\tattachment\tsubject\n");
+	}
+	for (size_t i = 0; i < numMatches; i++) {
+		batchPrintRecord(username, &matches[i].record, matches[i].folder, tsv);
+	}
+
+	free(matches);
+	free(query);
+
+	return numMatches > 0 ? 0 : 2;
+}
+
+// Prints every line of the user's messages containing the pattern.
+// Reads the messages themselves, so it works without a search index
+int batchGrep(char* username, paths* userPaths, int argc, char* argv[]) {
+	static struct option grepOptions[] = {
+		{"format", required_argument, NULL, 'f'},
+		{NULL, 0, NULL, 0}
+	};
+
+	bool tsv = false;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "", grepOptions, NULL)) != -1) {
+		if (option == 'f' && !strcmp(optarg, "tsv")) {
+			tsv = true;
+		}
+		else if (option != 'f' || strcmp(optarg, "text") != 0) {
+			printBatchUsage();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || argv[optind][0] == '\0') {
+		printBatchUsage();
+		return 1;
+	}
+
+	if (tsv) {
+		printf("folder\tid\tfrom\tdate\tline\n");
+	}
+	fflush(stdout);
+
+	return grepMailbox(userPaths, argv[optind], tsv, stdout) > 0 ? 0 : 2;
+}
+
+// Prints the number of messages in each folder
+int batchCount(char* username, paths* userPaths) {
+	const char folders[] = {'u', 'r', 's'};
+	const char* folderNames[] = {"unread", "read", "sent"};
+
+	for (int i = 0; i < 3; i++) {
+		size_t count;
+
+		if (requestCount(username, folders[i], &count) != 0) {
+			free(readFolder(userPaths, folders[i], &count));
+		}
+		printf("%s\t%zu\n", folderNames[i], count);
+	}
+
+	return 0;
+}
+
+// Prints every distribution group and its number of members
+int batchGroups(void) {
+	if (loadGroupIndex(&groupDirectory, groupsFilename, usersFilename, groupIndexFilename) != 0) {
+		fprintf(stderr, "No distribution groups have been set up\n");
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < groupDirectory.header->numGroups; i++) {
+		printf("%c%s\t%u\n", GROUP_PREFIX, groupDirectory.groups[i].name, groupDirectory.groups[i].numMembers);
+	}
+
+	return 0;
+}
+
+// Prints one message, found by its id in any of the user's folders
+int batchShow(char* username, paths* userPaths, int argc, char* argv[]) {
+	if (argc != 2 || argv[1][0] == '\0' || argv[1][0] == '.' || strchr(argv[1], '/') != NULL) {
+		printBatchUsage();
+		return 1;
+	}
+
+	const char folders[] = {'u', 'r', 's'};
+
+	fflush(stdout);
+	for (int i = 0; i < 3; i++) {
+		if (requestMessage(username, folders[i], argv[1], STDOUT_FILENO) == 0) {
+			return 0;
+		}
+	}
+
+	// Without a server the folders are searched directly
+	const char* folderPaths[] = {userPaths->unreadPath, userPaths->newPath, userPaths->readPath, userPaths->sentPath};
+
+	for (int i = 0; i < 4; i++) {
+		char* messagePath = malloc(strlen(folderPaths[i]) + strlen("/") + strlen(argv[1]) + 1);
+		sprintf(messagePath, "%s/%s", folderPaths[i], argv[1]);
+
+		int messageFD = open(messagePath, O_RDONLY);
+		free(messagePath);
+
+		if (messageFD >= 0) {
+			int status = copyFileData(messageFD, STDOUT_FILENO);
+			close(messageFD);
+			return status == 0 ? 0 : 1;
+		}
+	}
+
+	// Archived read and sent mail is found through its folder's index
+	const char archivedFolders[] = {'r', 's'};
+
+	for (int i = 0; i < 2; i++) {
+		size_t count;
+		messageRecord* records = readFolder(userPaths, archivedFolders[i], &count);
+		int messageFD = -1;
+
+		for (size_t j = 0; messageFD < 0 && j < count; j++) {
+			if (!strcmp(records[j].name, argv[1])) {
+				messageFD = openArchivedPart(archivedFolders[i] == 'r' ? userPaths->readPath : userPaths->sentPath,
+					&records[j], ARCHIVE_PART_MESSAGE);
 			}
 		}
+		free(records);
+
+		if (messageFD >= 0) {
+			int status = copyFileData(messageFD, STDOUT_FILENO);
+			close(messageFD);
+			return status == 0 ? 0 : 1;
+		}
 	}
-	system("clear");
 
-	free(userDraftFilePath);
-	free(userPersonalDraftFilePath);
-	free(userDraftAttachmentFilePath);
-	free(userDestinations);
+	fprintf(stderr, "No message with id %s\n", argv[1]);
+	return 1;
+}
 
-	userDraftFilePath = NULL;
-	userPersonalDraftFilePath = NULL;
-	userDraftAttachmentFilePath = NULL;
-	userDestinations = NULL;
+// Packs a user's read and sent mail from before cutoff into archive segments,
+// reporting what was packed to report. Returns 0 on success, -1 on failure
+int archiveMailbox(const char* username, const paths* userPaths, int64_t cutoff, bool compress, FILE* report) {
+	const char folders[] = {'r', 's'};
+	const char* folderNames[] = {"read", "sent"};
+	int status = 0;
+
+	for (int i = 0; i < 2; i++) {
+		archiveResult result;
+
+		if (archiveFolder(userPaths, folders[i], cutoff, compress, &result) != 0) {
+			fprintf(report, "%s %s: could not be archived\n", username, folderNames[i]);
+			status = -1;
+			continue;
+		}
+
+		fprintf(report, "%s %s: archived %zu message(s) from %zu file(s), %llu bytes into %llu bytes",
+			username, folderNames[i], result.numMessages, result.numFiles,
+			(unsigned long long) result.bytesIn, (unsigned long long) result.bytesOut);
+
+		if (result.numSegmentsRemoved > 0) {
+			fprintf(report, ", removed %zu unused segment(s)", result.numSegmentsRemoved);
+		}
+		fprintf(report, "\n");
+	}
+
+	return status;
+}
+
+// Converts an age in days into a cutoff in nanoseconds since the epoch
+int64_t archiveCutoff(long days) {
+	return ((int64_t) time(NULL) - (int64_t) days * 24 * 60 * 60) * 1000000000LL;
+}
+
+// Packs the user's read and sent mail older than --days into archive segments
+int batchArchive(char* username, paths* userPaths, int argc, char* argv[]) {
+	static struct option archiveOptions[] = {
+		{"days", required_argument, NULL, 'd'},
+		{"compress", no_argument, NULL, 'z'},
+		{NULL, 0, NULL, 0}
+	};
+
+	long days = ARCHIVE_DEFAULT_DAYS;
+	bool compress = false;
+	int option;
+
+	while ((option = getopt_long(argc, argv, "d:z", archiveOptions, NULL)) != -1) {
+		char* end;
+
+		switch (option) {
+			case 'd':
+				days = strtol(optarg, &end, 10);
+				if (*optarg == '\0' || *end != '\0' || days < 0) {
+					printBatchUsage();
+					return 1;
+				}
+				break;
+			case 'z':
+				compress = true;
+				break;
+			default:
+				printBatchUsage();
+				return 1;
+		}
+	}
+
+	if (optind != argc) {
+		printBatchUsage();
+		return 1;
+	}
+
+	return archiveMailbox(username, userPaths, archiveCutoff(days), compress, stdout) == 0 ? 0 : 1;
+}
+
+// Runs a single non-interactive command given on the command line.
+// Never clears the screen or starts an editor
+int runBatchMode(char* username, paths* userPaths, int argc, char* argv[]) {
+	// Options are parsed after the command word
+	optind = 1;
+
+	if (!strcmp(argv[0], "send")) {
+		return batchSend(username, userPaths, argc, argv);
+	}
+	else if (!strcmp(argv[0], "list")) {
+		return batchList(username, userPaths, argc, argv);
+	}
+	else if (!strcmp(argv[0], "count")) {
+		return batchCount(username, userPaths);
+	}
+	else if (!strcmp(argv[0], "groups")) {
+		return batchGroups();
+	}
+	else if (!strcmp(argv[0], "show")) {
+		return batchShow(username, userPaths, argc, argv);
+	}
+	else if (!strcmp(argv[0], "search")) {
+		return batchSearch(username, userPaths, argc, argv);
+	}
+	else if (!strcmp(argv[0], "grep")) {
+		return batchGrep(username, userPaths, argc, argv);
+	}
+	else if (!strcmp(argv[0], "archive")) {
+		return batchArchive(username, userPaths, argc, argv);
+	}
+
+	printBatchUsage();
+	return 1;
+}
+
+// Converts any folder still using a text log.txt to a binary index
+void migrateMailbox(paths* userPaths) {
+	migrateLogToIndex(userPaths->readLog, userPaths->readPath, userPaths->readIndex, true);
+	migrateLogToIndex(userPaths->sentLog, userPaths->sentPath, userPaths->sentIndex, false);
+
+	// Senders may be delivering, so the unread folder is migrated under its lock
+	struct stat unreadLogStat;
+	if (stat(userPaths->unreadLog, &unreadLogStat) == 0) {
+		FILE* unreadLockFile = fopen(userPaths->unreadLock, "r");
+
+		if (unreadLockFile != NULL) {
+			uint64_t lockedAt = timedLock(fileno(unreadLockFile), LOCK_EX);
+			migrateLogToIndex(userPaths->unreadLog, userPaths->unreadPath, userPaths->unreadIndex, true);
+			timedUnlock(fileno(unreadLockFile), lockedAt);
+			fclose(unreadLockFile);
+		}
+	}
+
+	// A long search log is merged here rather than slowing down the next search
+	struct stat searchLogStat;
+	if (stat(userPaths->searchLog, &searchLogStat) == 0 && searchLogStat.st_size >= SEARCH_COMPACT_BYTES) {
+		compactSearchIndex(userPaths);
+	}
 }
 
 // Displays menu of choices for regular users
@@ -1131,7 +1448,7 @@ char displayMenu() {
 			needSelection = false;
 		}
 		else {
-			system("clear");
+			clearScreen();
 			printf("Invalid Input\n\n");
 		}
 
@@ -1140,6 +1457,176 @@ char displayMenu() {
 	return selection;
 }
 
+// Reads one line from the admin at a prompt, without its newline.
+// Returns the line, which must be freed, or NULL on end of input
+char* promptLine(const char* prompt) {
+	char* line = NULL;
+	size_t lineCapacity = 0;
+
+	printf("%s", prompt);
+	if (getline(&line, &lineCapacity, stdin) < 0) {
+		free(line);
+		return NULL;
+	}
+	line[strcspn(line, "\r\n")] = '\0';
+
+	return line;
+}
+
+// Rewrites the groups file and rebuilds the cached expansions, reporting any
+// member that does not resolve
+void saveGroups(const groupDefinition* groups, size_t count) {
+	if (writeGroupDefinitions(groupsFilename, groups, count) != 0) {
+		perror("Error saving groups");
+		return;
+	}
+
+	if (buildGroupIndex(groupsFilename, usersFilename, groupIndexFilename, stdout) != 0) {
+		printf("Error building group index\n");
+	}
+}
+
+// Lists, creates, replaces and deletes distribution groups.
+// Members are usernames or @group for a nested group
+void runGroupMenu(void) {
+	char* selection;
+
+	while ((selection = promptLine("Distribution Groups\n\nList Groups: L\nCreate or Replace a Group: C\n"
+			"Delete a Group: X\nBack: Q\nYour Selection: ")) != NULL) {
+		char choice = tolower(selection[0]);
+		free(selection);
+
+		clearScreen();
+
+		if (choice == 'q') {
+			break;
+		}
+
+		groupDefinition* groups;
+		size_t numGroups;
+		readGroupDefinitions(groupsFilename, &groups, &numGroups);
+
+		if (choice == 'l') {
+			loadGroupIndex(&groupDirectory, groupsFilename, usersFilename, groupIndexFilename);
+
+			for (size_t i = 0; i < numGroups; i++) {
+				const groupRecord* group = findGroup(&groupDirectory, groups[i].name);
+
+				printf("%c%s (%u members): %s\n", GROUP_PREFIX, groups[i].name, group != NULL ? group->numMembers : 0, groups[i].members);
+			}
+			printf("%zu group(s)\n\n", numGroups);
+
+			closeGroupIndex(&groupDirectory);
+		}
+		else if (choice == 'c' || choice == 'x') {
+			char* name = promptLine("Group name: ");
+			size_t found = numGroups;
+
+			for (size_t i = 0; name != NULL && i < numGroups; i++) {
+				if (!strcmp(groups[i].name, name)) {
+					found = i;
+				}
+			}
+
+			if (name == NULL || !validGroupName(name)) {
+				printf("Invalid group name\n\n");
+			}
+			else if (choice == 'x') {
+				if (found == numGroups) {
+					printf("No group named %s\n\n", name);
+				}
+				else {
+					free(groups[found].members);
+					groups[found] = groups[--numGroups];
+					saveGroups(groups, numGroups);
+					printf("Deleted %c%s\n\n", GROUP_PREFIX, name);
+				}
+			}
+			else {
+				// Members may span several lines, which are joined with commas
+				char* members = strdup("");
+				char* line;
+
+				printf("Enter the members: usernames or @group, separated by spaces or commas.\n");
+				while ((line = promptLine("")) != NULL && line[strspn(line, RECIPIENT_SEPARATORS)] != '\0') {
+					char* joined = malloc(strlen(members) + strlen(",") + strlen(line) + 1);
+					sprintf(joined, "%s%s%s", members, members[0] != '\0' ? "," : "", line);
+					free(members);
+					free(line);
+					members = joined;
+				}
+				free(line);
+
+				if (found == numGroups) {
+					groups = realloc(groups, (numGroups + 1) * sizeof(groupDefinition));
+					strcpy(groups[numGroups++].name, name);
+				}
+				else {
+					free(groups[found].members);
+				}
+				groups[found].members = members;
+
+				saveGroups(groups, numGroups);
+				printf("Saved %c%s\n\n", GROUP_PREFIX, name);
+			}
+			free(name);
+		}
+		else {
+			printf("Invalid Input\n\n");
+		}
+
+		freeGroupDefinitions(groups, numGroups);
+	}
+}
+
+// Archives every user's read and sent mail older than a number of days
+void runArchiveMenu(void) {
+	char* line = promptLine("Archive read and sent mail older than how many days? ");
+	char* end;
+	long days = line != NULL ? strtol(line, &end, 10) : -1;
+
+	if (line == NULL || *line == '\0' || *end != '\0' || days < 0) {
+		free(line);
+		printf("Invalid number of days\n\n");
+		return;
+	}
+	free(line);
+
+	bool compress = yesNoPromptFunc("Compress the archived messages");
+	int64_t cutoff = archiveCutoff(days);
+
+	// Users file lines are username:uid
+	FILE* users = fopen(usersFilename, "r");
+	if (users == NULL) {
+		perror("Error opening users file");
+		return;
+	}
+
+	char userLine[MAX_LINE_LENGTH];
+
+	while (fgets(userLine, sizeof(userLine), users) != NULL) {
+		char* savePtr;
+		char* username = strtok_r(userLine, ":\n", &savePtr);
+		struct stat userStat;
+		paths userPaths;
+
+		if (username == NULL) {
+			continue;
+		}
+
+		generatePaths(&userPaths, username);
+
+		// Accounts without a mailbox yet have nothing to archive
+		if (stat(userPaths.userPath, &userStat) == 0) {
+			archiveMailbox(username, &userPaths, cutoff, compress, stdout);
+		}
+		freePaths(&userPaths);
+	}
+	fclose(users);
+
+	printf("\n");
+}
+
 // Displays menu of choices for users running program with sudo
 // Returns a char representing a valid selection
 char displayAdminMenu(void) {
@@ -1152,6 +1639,10 @@ char displayAdminMenu(void) {
 		printf("Company Mail Admin Menu\n\n");
 		printf("Update Users In Company Mail System: U\n");
 		printf("Run Setup Utility: S\n");
+		printf("Collect Unreferenced Blobs: G\n");
+		printf("Manage Distribution Groups: D\n");
+		printf("Archive Old Mail: A\n");
+		printf("View Mail Statistics: M\n");
 		printf("Quit: Q\n");
 		printf("Your Selection: ");
 		scanf(" %c", &selection);
@@ -1160,17 +1651,17 @@ char displayAdminMenu(void) {
 		selection = tolower(selection);
 
 
-		if(selection == 'u' || selection == 's' || selection == 'q') {
+		if(selection == 'u' || selection == 's' || selection == 'g' || selection == 'd' || selection == 'a' || selection == 'm' || selection == 'q') {
 			needSelection = false;
 		}
 		else {
-			system("clear");
+			clearScreen();
 			printf("Invalid Input\n\n");
 		}
 
 	} while (needSelection);
 
-	system("clear");
+	clearScreen();
 
 	return selection;
 
@@ -1180,7 +1671,7 @@ char displayAdminMenu(void) {
 // Admin menu is displayed. Setup or update_user utilities may be executed.
 // Otherwise, user can quit
 void runAdminMenu(void) {
-	system("clear");
+	clearScreen();
 	char selection;
 
 	do {
@@ -1188,10 +1679,30 @@ void runAdminMenu(void) {
 		
 		switch (selection) {
 			case 'u':
-				execl("/CompanyMail/Setup/update_users", "/CompanyMail/Setup/update_users", NULL);
+				execl(MAIL_ROOT "/Setup/update_users", MAIL_ROOT "/Setup/update_users", NULL);
 				break;
 			case 's':
-				execl("/CompanyMail/Setup/setup", "/CompanyMail/Setup/setup", NULL);
+				execl(MAIL_ROOT "/Setup/setup", MAIL_ROOT "/Setup/setup", NULL);
+				break;
+			case 'g': {
+				unsigned long long bytesFreed = 0;
+				unsigned long removed = collectBlobs(&bytesFreed);
+
+				printf("Removed %lu unreferenced blob(s), freeing %llu bytes\n\n", removed, bytesFreed);
+				break;
+			}
+			case 'd':
+				runGroupMenu();
+				clearScreen();
+				break;
+			case 'a':
+				runArchiveMenu();
+				break;
+			case 'm':
+				if (printMetrics(stdout) != 0) {
+					printf("No mail statistics have been recorded\n");
+				}
+				printf("\n");
 				break;
 		}
 
@@ -1199,73 +1710,125 @@ void runAdminMenu(void) {
 }
 
 
-int main(void) {
-	system("clear");
+int main(int argc, char* argv[]) {
+	// Any arguments other than --vim select the non-interactive batch mode
+	viewWithVim = argc == 2 && !strcmp(argv[1], "--vim");
+	bool batchMode = argc > 1 && !viewWithVim;
+	bool showStats = argc == 2 && !strcmp(argv[1], "--stats");
 
-	FILE* users;
-	FILE* admins;
+	// Every mail process adds to the shared statistics
+	openMetrics();
 
-	const char* usersFilename = "/CompanyMail/Config/users";
-	const char* adminFilename = "/CompanyMail/Config/admins";
+	char traceLabel[TRACE_LABEL_LENGTH];
+	snprintf(traceLabel, sizeof(traceLabel), "mail (uid %d)", getuid());
+	openTrace(traceLabel);
+
+	if (!batchMode) {
+		clearScreen();
+	}
 
 	char ruidStr[11];
 
 	sprintf(ruidStr, "%d", getuid());
 
+	// Statistics are shown to root and to admins
+	if (getuid() == 0 && showStats) {
+		if (printMetrics(stdout) != 0) {
+			fprintf(stderr, "No mail statistics have been recorded\n");
+			return 1;
+		}
+		return 0;
+	}
+
 	// Checks if RUID is root and runs admin menu if so
-	if (getuid() == 0) {
+	if (getuid() == 0 && !batchMode) {
 		runAdminMenu();
 		return 0;
 	}
 
+	bool accountExists = false;
+	bool isAdmin = false;
 
-	char line[MAX_LINE_LENGTH];
+	char savedUsername[33];
 
-	users = fopen(usersFilename, "r");
+	// The indexed directory answers both checks with one lookup.
+	// The users and admins files are scanned if no index can be used.
+	uint64_t lookupStart = metricsClock();
 
-	bool accountExists = false;
+	if (loadUserIndex(&userDirectory, usersFilename, adminFilename, userIndexFilename) == 0) {
+		const userRecord* account = findUserByUid(&userDirectory, getuid());
+		recordMetric(METRIC_LOGIN_LOOKUP, lookupStart, 0);
 
-	char savedUsername[33];
+		if (account != NULL) {
+			accountExists = true;
+			isAdmin = account->isAdmin;
+			strcpy(savedUsername, account->username);
+		}
+	}
+	else {
+		FILE* users;
+		FILE* admins;
 
-	// Checks if user that is running program is in the Company Mail System.
-	while (fgets(line, sizeof(line), users) != NULL && !accountExists) {
+		char line[MAX_LINE_LENGTH];
 
-        char *username = strtok(line, ":");
+		users = fopen(usersFilename, "r");
 
-        char *uid_str = strtok(NULL, "\n");
+		// Checks if user that is running program is in the Company Mail System.
+		while (users != NULL && fgets(line, sizeof(line), users) != NULL && !accountExists) {
 
-        if(!strcmp(ruidStr,uid_str)) {
-            accountExists = true;
-			strcpy(savedUsername, username);
-			printf("Welcome %s.\n\n", username);
-        }
-    }
-	fclose(users);
+			char *username = strtok(line, ":");
+
+			char *uid_str = strtok(NULL, "\n");
+
+			if(uid_str != NULL && !strcmp(ruidStr,uid_str)) {
+				accountExists = true;
+				strcpy(savedUsername, username);
+			}
+		}
+		if (users != NULL) {
+			fclose(users);
+		}
+
+		admins = fopen(adminFilename, "r");
+
+		char compareUsername[33];
+
+		// Checks if the user who executed the program is the admin.
+		while (accountExists && admins != NULL && !isAdmin && fscanf(admins, "%32s", compareUsername) != EOF) {
+			if (!strcmp(savedUsername, compareUsername)) {
+				isAdmin = true;
+			}
+		}
+		if (admins != NULL) {
+			fclose(admins);
+		}
+	}
 
 	// Program exits if user has not be added to Company Mail System.
 	if(!accountExists) {
-		puts("You do not have a Company Mail account.\nAsk an admin to add you to the system.\n");
+		fputs("You do not have a Company Mail account.\nAsk an admin to add you to the system.\n", batchMode ? stderr : stdout);
 		exit(1);
 	}
 
+	if (showStats) {
+		if (!isAdmin) {
+			fprintf(stderr, "Only admins can view mail statistics\n");
+			return 1;
+		}
+		if (printMetrics(stdout) != 0) {
+			fprintf(stderr, "No mail statistics have been recorded\n");
+			return 1;
+		}
+		return 0;
+	}
 
+	if (!batchMode) {
+		printf("Welcome %s.\n\n", savedUsername);
 
-	bool isAdmin = false;
-	admins = fopen(adminFilename, "r");
-
-	char compareUsername[33];
-	int successfulIO;
-
-	// Checks if the user who executed the program is the admin.
-	do {
-		successfulIO = fscanf(admins, "%s", compareUsername);
-		if (!strcmp(savedUsername, compareUsername)) {
-			isAdmin = true;
+		if (isAdmin) {
 			printf("You are an admin\n");
 		}
-	} while (successfulIO != EOF && !isAdmin);
-
-	fclose(admins);
+	}
 
 	char selection;
 
@@ -1274,6 +1837,29 @@ int main(void) {
 
 	// Generates all custom paths for the user who executed the program
 	generatePaths(&currentUserPaths, savedUsername);
+
+	// Mailboxes from before the binary index are converted on first login
+	migrateMailbox(&currentUserPaths);
+
+	// Folders are opened once and worked on relative to their descriptors
+	mailboxHandle currentMailbox;
+	if (!batchMode && openMailbox(&currentMailbox, savedUsername, MAILBOX_ALL) != 0) {
+		perror("Error opening mailbox");
+		closeMailbox(&currentMailbox);
+		freePaths(&currentUserPaths);
+		closeUserIndex(&userDirectory);
+		closeGroupIndex(&groupDirectory);
+		exit(-1);
+	}
+
+	// Batch commands run once and exit
+	if (batchMode) {
+		int status = runBatchMode(savedUsername, &currentUserPaths, argc - 1, argv + 1);
+		freePaths(&currentUserPaths);
+		closeUserIndex(&userDirectory);
+		closeGroupIndex(&groupDirectory);
+		return status;
+	}
 	
 	// Loop provides user with a menu of choices.
 	// Loop iterates until user quits the program.
@@ -1285,13 +1871,13 @@ int main(void) {
 				composeMail(savedUsername, &currentUserPaths);
 				break;
 			case 'v':
-				viewMail(savedUsername, &currentUserPaths);
+				viewMail(savedUsername, &currentUserPaths, &currentMailbox);
 				break;
 			case 'r':
-				viewOldMail(savedUsername, &currentUserPaths);
+				viewOldMail(savedUsername, &currentUserPaths, &currentMailbox);
 				break;
 			case 's':
-				viewSentMail(savedUsername, &currentUserPaths);
+				viewSentMail(savedUsername, &currentUserPaths, &currentMailbox);
 				break;
 		}
 
@@ -1299,7 +1885,10 @@ int main(void) {
 
 	} while (selection != 'q');
 
+	closeMailbox(&currentMailbox);
 	freePaths(&currentUserPaths);
-	system("clear");
+	closeUserIndex(&userDirectory);
+	closeGroupIndex(&groupDirectory);
+	clearScreen();
 
 }
@@ -0,0 +1,333 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "mailbox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+const char* mailDir = MAIL_ROOT "/mailboxes/";
+const char* blobDir = MAIL_ROOT "/blobs/";
+
+const char* outbox = "/outbox";
+const char* sent = "/sent";
+const char* logName = "/log.txt";
+const char* drafts = "/drafts";
+
+const char* inbox = "/inbox";
+const char* unread = "/unread";
+const char* readStr = "/read";
+const char* tmpStr = "/tmp";
+const char* newStr = "/new";
+
+// Present when new mail is delivered maildir-style through inbox/tmp and inbox/new
+const char* maildirFlagFilename = MAIL_ROOT "/Config/maildir";
+
+// Present when deliveries are batched through io_uring
+const char* uringFlagFilename = MAIL_ROOT "/Config/iouring";
+
+const char* draftFilename = "/draft.txt";
+const char* draftAttachmentFilename = "/draft.attach";
+const char* draftHeadername = "/draft_hdr.txt";
+const char* destinationsFilename = "/destinations.txt";
+const char* lockName = "/lock.lck";
+const char* indexName = "/index.dat";
+const char* cursorName = "/cursor.dat";
+const char* tombstoneName = "/tombstones.dat";
+const char* searchLogName = "/search.log";
+const char* searchIndexName = "/search.idx";
+
+// Space the paths of a user take together
+static size_t pathsLength(const char* username) {
+	size_t userLength = strlen(mailDir) + strlen(username);
+	size_t outboxLength = userLength + strlen(outbox);
+	size_t sentLength = outboxLength + strlen(sent);
+	size_t inboxLength = userLength + strlen(inbox);
+	size_t unreadLength = inboxLength + strlen(unread);
+	size_t readLength = inboxLength + strlen(readStr);
+
+	return userLength + outboxLength + sentLength + inboxLength + unreadLength + readLength
+		+ sentLength + strlen(logName)
+		+ outboxLength + strlen(drafts)
+		+ unreadLength + strlen(logName)
+		+ readLength + strlen(logName)
+		+ inboxLength + strlen(tmpStr)
+		+ inboxLength + strlen(newStr)
+		+ unreadLength + strlen(lockName)
+		+ sentLength + strlen(indexName)
+		+ sentLength + strlen(tombstoneName)
+		+ unreadLength + strlen(indexName)
+		+ unreadLength + strlen(cursorName)
+		+ readLength + strlen(indexName)
+		+ readLength + strlen(tombstoneName)
+		+ userLength + strlen(searchLogName)
+		+ userLength + strlen(searchIndexName)
+		+ NUM_USER_PATHS;
+}
+
+// Writes each path into buffer one after another, userPath first
+static char* joinPath(char** buffer, const char* parent, const char* child) {
+	char* path = *buffer;
+
+	*buffer += sprintf(path, "%s%s", parent, child) + 1;
+
+	return path;
+}
+
+static void fillPaths(paths* currPaths, const char* username, char* buffer) {
+	currPaths->userPath = joinPath(&buffer, mailDir, username);
+	currPaths->outboxPath = joinPath(&buffer, currPaths->userPath, outbox);
+	currPaths->sentPath = joinPath(&buffer, currPaths->outboxPath, sent);
+	currPaths->sentLog = joinPath(&buffer, currPaths->sentPath, logName);
+	currPaths->draftPath = joinPath(&buffer, currPaths->outboxPath, drafts);
+	currPaths->inboxPath = joinPath(&buffer, currPaths->userPath, inbox);
+	currPaths->unreadPath = joinPath(&buffer, currPaths->inboxPath, unread);
+	currPaths->unreadLog = joinPath(&buffer, currPaths->unreadPath, logName);
+	currPaths->readPath = joinPath(&buffer, currPaths->inboxPath, readStr);
+	currPaths->readLog = joinPath(&buffer, currPaths->readPath, logName);
+	currPaths->tmpPath = joinPath(&buffer, currPaths->inboxPath, tmpStr);
+	currPaths->newPath = joinPath(&buffer, currPaths->inboxPath, newStr);
+	currPaths->unreadLock = joinPath(&buffer, currPaths->unreadPath, lockName);
+	currPaths->sentIndex = joinPath(&buffer, currPaths->sentPath, indexName);
+	currPaths->sentTombstones = joinPath(&buffer, currPaths->sentPath, tombstoneName);
+	currPaths->unreadIndex = joinPath(&buffer, currPaths->unreadPath, indexName);
+	currPaths->unreadCursor = joinPath(&buffer, currPaths->unreadPath, cursorName);
+	currPaths->readIndex = joinPath(&buffer, currPaths->readPath, indexName);
+	currPaths->readTombstones = joinPath(&buffer, currPaths->readPath, tombstoneName);
+	currPaths->searchLog = joinPath(&buffer, currPaths->userPath, searchLogName);
+	currPaths->searchIndex = joinPath(&buffer, currPaths->userPath, searchIndexName);
+}
+
+// Generates all necessary paths to populate a paths struct.
+// Paths are customized based on username
+void generatePaths (paths* currPaths, const char* username) {
+	fillPaths(currPaths, username, malloc(pathsLength(username)));
+}
+
+int generatePathsInArena(paths* currPaths, const char* username, arena* memory) {
+	char* buffer = arenaAlloc(memory, pathsLength(username));
+
+	if (buffer == NULL) {
+		return -1;
+	}
+	fillPaths(currPaths, username, buffer);
+
+	return 0;
+}
+
+// Frees all the memory of a paths struct
+void freePaths(paths* currPaths) {
+	// Every path lives in the one block starting at userPath
+	free(currPaths->userPath);
+
+	currPaths->userPath = NULL;
+	currPaths->outboxPath = NULL;
+	currPaths->sentPath = NULL;
+	currPaths->sentLog = NULL;
+	currPaths->draftPath = NULL;
+	currPaths->inboxPath = NULL;
+	currPaths->unreadLog = NULL;
+	currPaths->unreadPath = NULL;
+	currPaths->readPath = NULL;
+	currPaths->readLog = NULL;
+	currPaths->tmpPath = NULL;
+	currPaths->newPath = NULL;
+	currPaths->unreadLock = NULL;
+	currPaths->sentIndex = NULL;
+	currPaths->unreadIndex = NULL;
+	currPaths->unreadCursor = NULL;
+	currPaths->readIndex = NULL;
+	currPaths->sentTombstones = NULL;
+	currPaths->readTombstones = NULL;
+	currPaths->searchLog = NULL;
+	currPaths->searchIndex = NULL;
+
+}
+
+// Mailboxes directory, opened on first use and shared by every handle
+static int mailboxesFD = -1;
+
+// Opens one directory below another without following a symlink
+static int openDirectoryAt(int dirFD, const char* name) {
+	return openat(dirFD, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+int openMailbox(mailboxHandle* mailbox, const char* username, int folders) {
+	mailbox->userFD = mailbox->inboxFD = mailbox->unreadFD = -1;
+	mailbox->readFD = mailbox->sentFD = mailbox->draftFD = -1;
+
+	// A username is always a single path component
+	if (username[0] == '\0' || username[0] == '.' || strchr(username, '/') != NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	int rootFD = __atomic_load_n(&mailboxesFD, __ATOMIC_ACQUIRE);
+	if (rootFD < 0) {
+		rootFD = open(mailDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (rootFD < 0) {
+			return -1;
+		}
+
+		// Threads opening handles at once keep whichever descriptor was stored first
+		int expected = -1;
+		if (!__atomic_compare_exchange_n(&mailboxesFD, &expected, rootFD, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			close(rootFD);
+			rootFD = expected;
+		}
+	}
+
+	mailbox->userFD = openDirectoryAt(rootFD, username);
+	if (mailbox->userFD < 0) {
+		return -1;
+	}
+
+	// Each level is opened on its own so no part of the path can be a symlink
+	if (folders & (MAILBOX_INBOX | MAILBOX_UNREAD | MAILBOX_READ)) {
+		if ((mailbox->inboxFD = openDirectoryAt(mailbox->userFD, inbox + 1)) < 0
+				|| ((folders & MAILBOX_UNREAD) && (mailbox->unreadFD = openDirectoryAt(mailbox->inboxFD, unread + 1)) < 0)
+				|| ((folders & MAILBOX_READ) && (mailbox->readFD = openDirectoryAt(mailbox->inboxFD, readStr + 1)) < 0)) {
+			return -1;
+		}
+	}
+
+	if (folders & (MAILBOX_SENT | MAILBOX_DRAFTS)) {
+		int outboxFD = openDirectoryAt(mailbox->userFD, outbox + 1);
+		if (outboxFD < 0) {
+			return -1;
+		}
+
+		if (((folders & MAILBOX_SENT) && (mailbox->sentFD = openDirectoryAt(outboxFD, sent + 1)) < 0)
+				|| ((folders & MAILBOX_DRAFTS) && (mailbox->draftFD = openDirectoryAt(outboxFD, drafts + 1)) < 0)) {
+			int error = errno;
+			close(outboxFD);
+			errno = error;
+			return -1;
+		}
+		close(outboxFD);
+	}
+
+	// The inbox was only needed on the way to its folders
+	if (!(folders & MAILBOX_INBOX) && mailbox->inboxFD >= 0) {
+		close(mailbox->inboxFD);
+		mailbox->inboxFD = -1;
+	}
+
+	return 0;
+}
+
+void closeMailbox(mailboxHandle* mailbox) {
+	int* fds[] = {&mailbox->userFD, &mailbox->inboxFD, &mailbox->unreadFD, &mailbox->readFD, &mailbox->sentFD, &mailbox->draftFD};
+
+	for (int i = 0; i < 6; i++) {
+		if (*fds[i] >= 0) {
+			close(*fds[i]);
+		}
+		*fds[i] = -1;
+	}
+}
+
+// Newest timestamp handed out by this process, in nanoseconds since the epoch
+static int64_t lastMessageTimestamp = 0;
+
+// Number of message ids handed out by this process
+static uint32_t messageSequence = 0;
+
+char* generateMessageId(int64_t* timestamp) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	int64_t nowNanos = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	int64_t last = __atomic_load_n(&lastMessageTimestamp, __ATOMIC_RELAXED);
+	int64_t next;
+
+	// Timestamps only move forward within a process, even if the clock steps back
+	do {
+		next = nowNanos > last ? nowNanos : last + 1;
+	} while (!__atomic_compare_exchange_n(&lastMessageTimestamp, &last, next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	uint32_t sequence = __atomic_fetch_add(&messageSequence, 1, __ATOMIC_RELAXED);
+
+	time_t raw_time = next / 1000000000;
+    struct tm time_info;
+    char buffer[80];
+
+    // Convert the time to local time
+    localtime_r(&raw_time, &time_info);
+
+    // Format the time with underscores instead of spaces
+    strftime(buffer, sizeof(buffer), "%Y_%m_%d_%H_%M_%S", &time_info);
+
+	// Fixed width fields keep ids sorting chronologically as plain strings
+	char* messageId = malloc(strlen(buffer) + MESSAGE_ID_SUFFIX_LENGTH + 1);
+	sprintf(messageId, "%s_%09ld_%07d_%06u", buffer, (long) (next % 1000000000), (int) getpid(), sequence % 1000000);
+
+	if (timestamp != NULL) {
+		*timestamp = next;
+	}
+
+    return messageId;
+}
+
+void formatMessageDate(char* dateTime) {
+	unsigned int count = 0;
+
+	for (int i = 0; i < strlen(dateTime); i++) {
+		if (dateTime[i] == '_') {
+			// Sub-second, PID, and sequence fields of a message id are dropped
+			if (count == 5) {
+				dateTime[i] = '\0';
+				break;
+			}
+			if (count < 2) {
+				dateTime[i] = '/';
+			}
+			else if (count == 2) {
+				dateTime[i] = ' ';
+			}
+			else {
+				dateTime[i] = ':';
+			}
+			count++;
+		}
+	}
+}
+
+// Reads the From/Subject/Attachment header of a message file.
+// sender must hold at least 33 chars, subject and attachName at least 101 chars.
+// Returns 0 on success, -1 if the message could not be read
+int readMessageHeader(const char* messagePath, char* sender, char* subject, char* attachName) {
+	FILE* message = fopen(messagePath, "r");
+	if (message == NULL) {
+		return -1;
+	}
+
+	char line[MAX_LINE_LENGTH];
+	sender[0] = '\0';
+	subject[0] = '\0';
+	strcpy(attachName, "NONE");
+
+	for (int i = 0; i < 3 && fgets(line, sizeof(line), message) != NULL; i++) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "From: ", strlen("From: "))) {
+			snprintf(sender, 33, "%s", line + strlen("From: "));
+		}
+		else if (!strncmp(line, "Subject: ", strlen("Subject: "))) {
+			snprintf(subject, 101, "%s", line + strlen("Subject: "));
+		}
+		else if (!strncmp(line, "Attachment: ", strlen("Attachment: "))) {
+			snprintf(attachName, 101, "%s", line + strlen("Attachment: "));
+		}
+	}
+
+	fclose(message);
+
+	return 0;
+}
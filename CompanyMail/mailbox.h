@@ -0,0 +1,152 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "mailroot.h"
+
+#define MAX_LINE_LENGTH 1024
+
+extern const char* mailDir;
+extern const char* blobDir;
+
+extern const char* outbox;
+extern const char* sent;
+extern const char* logName;
+extern const char* drafts;
+
+extern const char* inbox;
+extern const char* unread;
+extern const char* readStr;
+extern const char* tmpStr;
+extern const char* newStr;
+
+extern const char* maildirFlagFilename;
+extern const char* uringFlagFilename;
+
+extern const char* draftFilename;
+extern const char* draftAttachmentFilename;
+extern const char* draftHeadername;
+extern const char* destinationsFilename;
+extern const char* lockName;
+extern const char* indexName;
+extern const char* cursorName;
+extern const char* tombstoneName;
+extern const char* searchLogName;
+extern const char* searchIndexName;
+
+// Structs for file names/paths needed for each user
+typedef struct customPaths {
+	char* userPath;
+
+    char* outboxPath;
+
+    char* sentPath;
+
+	char* sentLog;
+
+    char* draftPath;
+    
+    char* inboxPath;
+
+	char* unreadLog;
+
+    char* unreadPath;
+
+    char* readLog;
+
+	char* readPath;
+
+	char* tmpPath;
+
+	char* newPath;
+
+	char* unreadLock;
+
+	char* sentIndex;
+
+	char* unreadIndex;
+
+	char* unreadCursor;
+
+	char* readIndex;
+
+	char* sentTombstones;
+
+	char* readTombstones;
+
+	char* searchLog;
+
+	char* searchIndex;
+} paths;
+
+// Number of paths in a paths struct
+#define NUM_USER_PATHS 21
+
+// Generates all necessary paths to populate a paths struct.
+// Paths are customized based on username, and share a single allocation
+void generatePaths(paths* currPaths, const char* username);
+
+// Generates a paths struct in an arena instead. It is released with the
+// arena and must not be passed to freePaths().
+// Returns 0 on success, -1 if the arena is out of memory
+int generatePathsInArena(paths* currPaths, const char* username, arena* memory);
+
+// Frees all the memory of a paths struct
+void freePaths(paths* currPaths);
+
+// Folders a mailbox handle can open
+#define MAILBOX_INBOX 0x01
+#define MAILBOX_UNREAD 0x02
+#define MAILBOX_READ 0x04
+#define MAILBOX_SENT 0x08
+#define MAILBOX_DRAFTS 0x10
+#define MAILBOX_ALL 0x1f
+
+// A user's mailbox directories, opened once so later operations work with
+// openat/linkat/renameat/unlinkat relative to them instead of walking absolute
+// paths from the root. No directory is reached through a symlink, and none can
+// be swapped out between a check and its use. Folders not opened are -1.
+// The file names above start with '/' for building paths, which the *at calls skip
+typedef struct mailboxHandle {
+	int userFD;
+	int inboxFD;
+	int unreadFD;
+	int readFD;
+	int sentFD;
+	int draftFD;
+} mailboxHandle;
+
+// Opens a user's mailbox directory and the folders asked for with MAILBOX_* flags.
+// Must be closed with closeMailbox(), even on failure.
+// Returns 0 on success, -1 with errno set if any of them cannot be opened
+int openMailbox(mailboxHandle* mailbox, const char* username, int folders);
+
+// Closes every directory of a handle
+void closeMailbox(mailboxHandle* mailbox);
+
+// Length of the _<nanoseconds>_<pid>_<sequence> part of a message id
+#define MESSAGE_ID_SUFFIX_LENGTH 25
+
+// Returns a unique message id that can be used as a valid file name.
+// Ids are YYYY_MM_DD_HH_MM_SS_<nanoseconds>_<pid>_<sequence> in local time,
+// sort chronologically as strings, and never repeat within or across processes.
+// The id's time in nanoseconds since the epoch is stored in timestamp if not NULL
+char* generateMessageId(int64_t* timestamp);
+
+// Converts the YYYY_MM_DD_HH_MM_SS time at the start of a message id into
+// YYYY/MM/DD HH:MM:SS in place
+void formatMessageDate(char* dateTime);
+
+// Reads the From/Subject/Attachment header of a message file.
+// sender must hold at least 33 chars, subject and attachName at least 101 chars.
+// Returns 0 on success, -1 if the message could not be read
+int readMessageHeader(const char* messagePath, char* sender, char* subject, char* attachName);
+
+#endif
@@ -0,0 +1,153 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "mailclient.h"
+#include "mailserver.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Connects to the server and sends a request.
+// Returns the connected socket, or -1 if no server is running
+static int sendRequest(uint32_t type, const char* username, char folder, const char* name) {
+	int serverFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (serverFD < 0) {
+		return -1;
+	}
+
+	// A stuck server must not hang the front end
+	struct timeval timeout = {MAIL_SERVER_TIMEOUT, 0};
+	setsockopt(serverFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(serverFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", MAIL_SERVER_SOCKET);
+
+	mailRequest request;
+	memset(&request, 0, sizeof(request));
+	request.type = type;
+	request.folder = folder;
+	snprintf(request.username, sizeof(request.username), "%s", username);
+	if (name != NULL) {
+		snprintf(request.name, sizeof(request.name), "%s", name);
+	}
+
+	if (connect(serverFD, (struct sockaddr*) &address, sizeof(address)) != 0
+			|| send(serverFD, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) {
+		close(serverFD);
+		return -1;
+	}
+
+	return serverFD;
+}
+
+// Reads exactly length bytes. Returns 0 on success, -1 on failure
+static int receiveAll(int serverFD, void* buffer, size_t length) {
+	char* position = buffer;
+
+	while (length > 0) {
+		ssize_t received = recv(serverFD, position, length, 0);
+
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			return -1;
+		}
+		position += received;
+		length -= received;
+	}
+
+	return 0;
+}
+
+// Sends a request and reads the response header.
+// Returns the connected socket if the server accepted the request, otherwise -1
+static int startRequest(uint32_t type, const char* username, char folder, const char* name, mailResponse* response) {
+	int serverFD = sendRequest(type, username, folder, name);
+	if (serverFD < 0) {
+		return -1;
+	}
+
+	if (receiveAll(serverFD, response, sizeof(mailResponse)) != 0 || response->status != 0) {
+		close(serverFD);
+		return -1;
+	}
+
+	return serverFD;
+}
+
+int requestFolder(const char* username, char folder, messageRecord** records, size_t* count) {
+	mailResponse response;
+	int serverFD = startRequest(REQUEST_LIST, username, folder, NULL, &response);
+	if (serverFD < 0) {
+		return -1;
+	}
+
+	*records = NULL;
+	*count = 0;
+
+	int status = 0;
+
+	if (response.length > 0) {
+		*records = malloc(response.length * sizeof(messageRecord));
+
+		if (receiveAll(serverFD, *records, response.length * sizeof(messageRecord)) == 0) {
+			*count = response.length;
+		}
+		else {
+			free(*records);
+			*records = NULL;
+			status = -1;
+		}
+	}
+	close(serverFD);
+
+	return status;
+}
+
+int requestCount(const char* username, char folder, size_t* count) {
+	mailResponse response;
+	int serverFD = startRequest(REQUEST_COUNT, username, folder, NULL, &response);
+	if (serverFD < 0) {
+		return -1;
+	}
+	close(serverFD);
+
+	*count = response.length;
+
+	return 0;
+}
+
+int requestMessage(const char* username, char folder, const char* name, int destFD) {
+	mailResponse response;
+	int serverFD = startRequest(REQUEST_FETCH, username, folder, name, &response);
+	if (serverFD < 0) {
+		return -1;
+	}
+
+	char buffer[8192];
+	uint64_t remaining = response.length;
+	int status = 0;
+
+	while (remaining > 0 && status == 0) {
+		size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+
+		if (receiveAll(serverFD, buffer, chunk) != 0 || write(destFD, buffer, chunk) != chunk) {
+			status = -1;
+		}
+		remaining -= chunk;
+	}
+	close(serverFD);
+
+	return status;
+}
@@ -0,0 +1,28 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILCLIENT_H
+#define MAILCLIENT_H
+
+#include <stddef.h>
+
+#include "mailindex.h"
+
+// Requests made by the mail front end to the mail server.
+// Each returns -1 if no server answered, so the caller reads the disk instead.
+// folder is 'u' for unread, 'r' for read, or 's' for sent
+
+// Fetches a folder listing. records must be freed and is NULL if the folder is empty.
+// Returns 0 on success, -1 on failure
+int requestFolder(const char* username, char folder, messageRecord** records, size_t* count);
+
+// Fetches the number of messages in a folder
+// Returns 0 on success, -1 on failure
+int requestCount(const char* username, char folder, size_t* count);
+
+// Writes the message named name in a folder to destFD
+// Returns 0 on success, -1 on failure
+int requestMessage(const char* username, char folder, const char* name, int destFD);
+
+#endif
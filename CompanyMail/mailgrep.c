@@ -0,0 +1,287 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "mailgrep.h"
+#include "archive.h"
+#include "arena.h"
+#include "mailindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// One message to scan and what was found in it
+typedef struct grepFile {
+	const messageRecord* record;
+	char folder;
+	char* output;
+	size_t outputLength;
+	size_t numMatches;
+} grepFile;
+
+// Shared by every worker of one scan. Files are claimed in order through nextFile
+typedef struct grepJob {
+	const paths* userPaths;
+	const char* pattern;
+	size_t patternLength;
+	bool tsv;
+	grepFile* files;
+	size_t numFiles;
+	size_t nextFile;
+} grepJob;
+
+const char* findPattern(const char* text, size_t length, const char* pattern, size_t patternLength) {
+	if (patternLength == 0 || patternLength > length) {
+		return NULL;
+	}
+	if (patternLength == 1) {
+		return memchr(text, pattern[0], length);
+	}
+
+	size_t position = 0;
+
+#ifdef __SSE2__
+	// A position is only compared in full when both its first and last bytes match
+	const __m128i first = _mm_set1_epi8(pattern[0]);
+	const __m128i last = _mm_set1_epi8(pattern[patternLength - 1]);
+
+	for (; position + patternLength - 1 + 16 <= length; position += 16) {
+		__m128i firstBlock = _mm_loadu_si128((const __m128i*) (text + position));
+		__m128i lastBlock = _mm_loadu_si128((const __m128i*) (text + position + patternLength - 1));
+		unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, firstBlock), _mm_cmpeq_epi8(last, lastBlock)));
+
+		while (candidates != 0) {
+			size_t offset = position + __builtin_ctz(candidates);
+
+			if (memcmp(text + offset + 1, pattern + 1, patternLength - 2) == 0) {
+				return text + offset;
+			}
+			candidates &= candidates - 1;
+		}
+	}
+#endif
+
+	// The rest is stepped through with memchr on the first byte
+	while (position + patternLength <= length) {
+		const char* candidate = memchr(text + position, pattern[0], length - patternLength + 1 - position);
+
+		if (candidate == NULL) {
+			return NULL;
+		}
+		if (memcmp(candidate + 1, pattern + 1, patternLength - 1) == 0) {
+			return candidate;
+		}
+		position = candidate - text + 1;
+	}
+
+	return NULL;
+}
+
+// Maps a message, trying each folder it may be in, or its archive segment.
+// Returns NULL if none has it
+static char* mapMessage(const char* const* folderPaths, const messageRecord* record, size_t* size) {
+	pathBuilder messagePath;
+	bool archived = record->flags & MESSAGE_FLAG_ARCHIVED;
+
+	for (int i = 0; i < 2 && folderPaths[i] != NULL; i++) {
+		int messageFD;
+
+		if (archived) {
+			messageFD = openArchivedPart(folderPaths[i], record, ARCHIVE_PART_MESSAGE);
+		}
+		else if (setPathFolder(&messagePath, folderPaths[i]) != 0 || buildPath(&messagePath, record->name, NULL) == NULL) {
+			continue;
+		}
+		else {
+			messageFD = open(messagePath.path, O_RDONLY | O_CLOEXEC);
+		}
+
+		if (messageFD < 0) {
+			continue;
+		}
+
+		struct stat messageStat;
+		char* message = NULL;
+
+		if (fstat(messageFD, &messageStat) == 0 && messageStat.st_size > 0) {
+			message = mmap(NULL, messageStat.st_size, PROT_READ, MAP_PRIVATE, messageFD, 0);
+
+			if (message == MAP_FAILED) {
+				message = NULL;
+			}
+			else {
+				// Pages are read ahead as the scan moves through them
+				madvise(message, messageStat.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+				*size = messageStat.st_size;
+			}
+		}
+		close(messageFD);
+
+		return message;
+	}
+
+	return NULL;
+}
+
+// Scans one message, writing its matching lines to the file's output
+static void grepFileLines(grepJob* job, grepFile* file) {
+	const paths* userPaths = job->userPaths;
+	const char* folderPaths[2] = {NULL, NULL};
+
+	if (file->folder == 'u') {
+		folderPaths[0] = userPaths->unreadPath;
+		folderPaths[1] = userPaths->newPath;
+	}
+	else {
+		folderPaths[0] = file->folder == 'r' ? userPaths->readPath : userPaths->sentPath;
+	}
+
+	size_t size;
+	char* message = mapMessage(folderPaths, file->record, &size);
+	if (message == NULL) {
+		return;
+	}
+
+	const char* folderName = file->folder == 'u' ? "unread" : file->folder == 'r' ? "read" : "sent";
+	char dateTime[32];
+	formatTimestamp(file->record->timestamp, dateTime, sizeof(dateTime));
+
+	FILE* output = NULL;
+	const char* position = message;
+	const char* end = message + size;
+	const char* match;
+
+	while ((match = findPattern(position, end - position, job->pattern, job->patternLength)) != NULL) {
+		const char* lineStart = memrchr(position, '\n', match - position);
+		lineStart = lineStart != NULL ? lineStart + 1 : position;
+
+		const char* lineEnd = memchr(match, '\n', end - match);
+		if (lineEnd == NULL) {
+			lineEnd = end;
+		}
+
+		if (output == NULL) {
+			output = open_memstream(&file->output, &file->outputLength);
+		}
+
+		int lineLength = lineEnd - lineStart;
+		if (job->tsv) {
+			fprintf(output, "%s\t%s\t%s\t%s\t%.*s\n", folderName, file->record->name, file->record->sender, dateTime, lineLength, lineStart);
+		}
+		else {
+			fprintf(output, "[%s] %s  From: %s  %.*s\n", folderName, dateTime, file->record->sender, lineLength, lineStart);
+		}
+		file->numMatches++;
+
+		// A line is reported once however many times it matches
+		if (lineEnd == end) {
+			break;
+		}
+		position = lineEnd + 1;
+	}
+
+	if (output != NULL) {
+		fclose(output);
+	}
+	munmap(message, size);
+}
+
+static void* grepWorker(void* arg) {
+	grepJob* job = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&job->nextFile, 1, __ATOMIC_RELAXED)) < job->numFiles) {
+		grepFileLines(job, &job->files[i]);
+	}
+
+	return NULL;
+}
+
+size_t grepMailbox(const paths* userPaths, const char* pattern, bool tsv, FILE* out) {
+	const char folders[] = {'u', 'r', 's'};
+	messageRecord* records[3];
+	size_t counts[3];
+	size_t numFiles = 0;
+
+	for (int f = 0; f < 3; f++) {
+		records[f] = readFolder(userPaths, folders[f], &counts[f]);
+		numFiles += counts[f];
+	}
+
+	grepFile* files = calloc(numFiles > 0 ? numFiles : 1, sizeof(grepFile));
+	size_t numListed = 0;
+
+	for (int f = 0; f < 3; f++) {
+		for (size_t i = 0; i < counts[f]; i++) {
+			files[numListed].record = &records[f][i];
+			files[numListed].folder = folders[f];
+			numListed++;
+		}
+	}
+
+	grepJob job = {
+		.userPaths = userPaths,
+		.pattern = pattern,
+		.patternLength = strlen(pattern),
+		.tsv = tsv,
+		.files = files,
+		.numFiles = numFiles,
+		.nextFile = 0
+	};
+
+	long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t numWorkers = numCores > 0 ? numCores : 1;
+
+	if (numWorkers > MAX_GREP_WORKERS) {
+		numWorkers = MAX_GREP_WORKERS;
+	}
+	if (numWorkers > numFiles) {
+		numWorkers = numFiles;
+	}
+
+	pthread_t workers[MAX_GREP_WORKERS];
+	size_t numStarted = 0;
+
+	// The calling thread is one of the workers
+	for (size_t i = 1; i < numWorkers; i++) {
+		if (pthread_create(&workers[numStarted], NULL, grepWorker, &job) == 0) {
+			numStarted++;
+		}
+	}
+
+	grepWorker(&job);
+
+	for (size_t i = 0; i < numStarted; i++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	// Output is written once every file is done so it keeps folder order
+	size_t numMatches = 0;
+
+	for (size_t i = 0; i < numFiles; i++) {
+		if (files[i].output != NULL) {
+			fwrite(files[i].output, 1, files[i].outputLength, out);
+			free(files[i].output);
+		}
+		numMatches += files[i].numMatches;
+	}
+
+	free(files);
+	for (int f = 0; f < 3; f++) {
+		free(records[f]);
+	}
+
+	return numMatches;
+}
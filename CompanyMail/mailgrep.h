@@ -0,0 +1,29 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILGREP_H
+#define MAILGREP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mailbox.h"
+
+// Upper bound on threads scanning one mailbox
+#define MAX_GREP_WORKERS 16
+
+// Returns the first occurrence of pattern in text, or NULL if there is none.
+// Candidates are found 16 positions at a time by their first and last bytes
+const char* findPattern(const char* text, size_t length, const char* pattern, size_t patternLength);
+
+// Scans every message in the user's unread, read and sent folders for pattern
+// without using any search index. Files are memory mapped and spread over a
+// bounded pool of worker threads. Each matching line is written to out with
+// its message's folder, sender and time, in folder order, as tab separated
+// fields if tsv is true.
+// Returns the number of matching lines
+size_t grepMailbox(const paths* userPaths, const char* pattern, bool tsv, FILE* out);
+
+#endif
@@ -0,0 +1,763 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "mailindex.h"
+#include "arena.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert(sizeof(messageRecord) == 400, "message records are a fixed 400 bytes on disk");
+
+int buildMessageRecord(messageRecord* record, const char* messagePath, const char* name, int64_t timestamp) {
+	memset(record, 0, sizeof(messageRecord));
+	snprintf(record->name, sizeof(record->name), "%s", name);
+	strcpy(record->attachment, "NONE");
+	record->timestamp = timestamp;
+
+	uint64_t start = metricsClock();
+
+	FILE* message = fopen(messagePath, "r");
+	if (message == NULL) {
+		return -1;
+	}
+
+	char line[MAX_LINE_LENGTH];
+	long lineStart = 0;
+
+	// Header is the From, Subject, and Attachment lines
+	for (int i = 0; i < 3 && fgets(line, sizeof(line), message) != NULL; i++) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "From: ", strlen("From: "))) {
+			snprintf(record->sender, sizeof(record->sender), "%s", line + strlen("From: "));
+		}
+		else if (!strncmp(line, "Subject: ", strlen("Subject: "))) {
+			snprintf(record->subject, sizeof(record->subject), "%s", line + strlen("Subject: "));
+			record->subjectOffset = lineStart + strlen("Subject: ");
+		}
+		else if (!strncmp(line, "Attachment: ", strlen("Attachment: "))) {
+			snprintf(record->attachment, sizeof(record->attachment), "%s", line + strlen("Attachment: "));
+		}
+		lineStart = ftell(message);
+	}
+
+	struct stat messageStat;
+	if (fstat(fileno(message), &messageStat) == 0) {
+		record->size = messageStat.st_size;
+	}
+
+	fclose(message);
+
+	recordMetric(METRIC_HEADER_SCAN, start, 0);
+
+	return 0;
+}
+
+int openLockedIndexAt(int dirFD, const char* name, int flags, int operation, uint64_t* lockedAt) {
+	while (true) {
+		int indexFD = openat(dirFD, name, flags | O_CREAT | O_CLOEXEC, 0644);
+		if (indexFD < 0) {
+			return -1;
+		}
+
+		*lockedAt = timedLock(indexFD, operation);
+
+		struct stat openedStat, currentStat;
+		if (fstat(indexFD, &openedStat) == 0 && fstatat(dirFD, name, &currentStat, 0) == 0
+				&& openedStat.st_ino == currentStat.st_ino) {
+			return indexFD;
+		}
+		closeLockedIndex(indexFD, *lockedAt);
+	}
+}
+
+int openLockedIndex(const char* indexPath, int flags, int operation, uint64_t* lockedAt) {
+	return openLockedIndexAt(AT_FDCWD, indexPath, flags, operation, lockedAt);
+}
+
+int closeLockedIndex(int indexFD, uint64_t lockedAt) {
+	timedUnlock(indexFD, lockedAt);
+
+	return close(indexFD);
+}
+
+int appendMessageRecordAt(int dirFD, const char* name, const messageRecord* record) {
+	TRACE_BEGIN(TRACE_INDEX_APPEND);
+
+	// Appends share the lock, only compaction takes it exclusively
+	uint64_t lockedAt;
+	int indexFD = openLockedIndexAt(dirFD, name, O_WRONLY | O_APPEND, LOCK_SH, &lockedAt);
+	if (indexFD < 0) {
+		TRACE_END(TRACE_INDEX_APPEND);
+		return -1;
+	}
+
+	// A single write keeps concurrent appends from interleaving
+	ssize_t written = write(indexFD, record, sizeof(messageRecord));
+
+	int status = closeLockedIndex(indexFD, lockedAt) != 0 || written != sizeof(messageRecord) ? -1 : 0;
+
+	TRACE_END(TRACE_INDEX_APPEND);
+
+	return status;
+}
+
+int appendMessageRecord(const char* indexPath, const messageRecord* record) {
+	return appendMessageRecordAt(AT_FDCWD, indexPath, record);
+}
+
+messageRecord* readMessageIndexFrom(const char* indexPath, size_t start, size_t* count) {
+	*count = 0;
+
+	int indexFD = open(indexPath, O_RDONLY);
+	if (indexFD < 0) {
+		return NULL;
+	}
+
+	struct stat indexStat;
+	if (fstat(indexFD, &indexStat) != 0 || indexStat.st_size / sizeof(messageRecord) <= start) {
+		close(indexFD);
+		return NULL;
+	}
+
+	// A torn record at the end of the file is ignored
+	size_t numRecords = indexStat.st_size / sizeof(messageRecord) - start;
+	messageRecord* records = malloc(numRecords * sizeof(messageRecord));
+	size_t bytesWanted = numRecords * sizeof(messageRecord);
+	size_t bytesRead = 0;
+
+	while (bytesRead < bytesWanted) {
+		ssize_t n = pread(indexFD, (char*) records + bytesRead, bytesWanted - bytesRead,
+			start * sizeof(messageRecord) + bytesRead);
+		if (n <= 0) {
+			break;
+		}
+		bytesRead += n;
+	}
+	close(indexFD);
+
+	*count = bytesRead / sizeof(messageRecord);
+	if (*count == 0) {
+		free(records);
+		return NULL;
+	}
+
+	return records;
+}
+
+messageRecord* readMessageIndex(const char* indexPath, size_t* count) {
+	return readMessageIndexFrom(indexPath, 0, count);
+}
+
+// Orders records oldest first
+static int compareRecordTimes(const void* a, const void* b) {
+	const messageRecord* first = a;
+	const messageRecord* second = b;
+
+	return (first->timestamp > second->timestamp) - (first->timestamp < second->timestamp);
+}
+
+messageRecord* readMessageDirectory(const char* folderPath, size_t* count) {
+	*count = 0;
+
+	DIR* folder = opendir(folderPath);
+	if (folder == NULL) {
+		return NULL;
+	}
+
+	size_t capacity = 16;
+	messageRecord* records = malloc(capacity * sizeof(messageRecord));
+	struct dirent* entry;
+
+	pathBuilder messagePaths;
+	setPathFolder(&messagePaths, folderPath);
+
+	while ((entry = readdir(folder)) != NULL) {
+		size_t nameLength = strlen(entry->d_name);
+
+		// Attachments are picked up with their message
+		if (entry->d_name[0] == '.' || nameLength >= MESSAGE_NAME_LENGTH
+				|| (nameLength > strlen("_attachment") && !strcmp(entry->d_name + nameLength - strlen("_attachment"), "_attachment"))) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity *= 2;
+			records = realloc(records, capacity * sizeof(messageRecord));
+		}
+
+		const char* messagePath = buildPath(&messagePaths, entry->d_name, NULL);
+		const char* timeStr = strchr(entry->d_name, '_') != NULL ? strchr(entry->d_name, '_') + 1 : entry->d_name;
+
+		if (messagePath != NULL && buildMessageRecord(&records[*count], messagePath, entry->d_name, parseMessageTime(timeStr)) == 0) {
+			(*count)++;
+		}
+	}
+	closedir(folder);
+
+	if (*count == 0) {
+		free(records);
+		return NULL;
+	}
+
+	qsort(records, *count, sizeof(messageRecord), compareRecordTimes);
+
+	return records;
+}
+
+int writeMessageIndex(const char* indexPath, const messageRecord* records, size_t count) {
+	char* tempPath = malloc(strlen(indexPath) + strlen(".tmp") + 1);
+	sprintf(tempPath, "%s.tmp", indexPath);
+
+	uint64_t start = metricsClock();
+	int status = -1;
+	FILE* indexFile = fopen(tempPath, "wb");
+
+	if (indexFile != NULL) {
+		bool written = fwrite(records, sizeof(messageRecord), count, indexFile) == count;
+
+		if (fclose(indexFile) == 0 && written && rename(tempPath, indexPath) == 0) {
+			status = 0;
+		}
+		else {
+			remove(tempPath);
+		}
+	}
+
+	recordMetric(METRIC_INDEX_REWRITE, start, count * sizeof(messageRecord));
+
+	free(tempPath);
+
+	return status;
+}
+
+int appendTombstone(const char* indexPath, const char* tombstonePath, const char* name) {
+	char tombstone[MESSAGE_NAME_LENGTH];
+
+	memset(tombstone, 0, sizeof(tombstone));
+	snprintf(tombstone, sizeof(tombstone), "%s", name);
+
+	TRACE_BEGIN(TRACE_INDEX_APPEND);
+
+	// Held so compaction cannot discard the tombstone file while this is added to it
+	uint64_t lockedAt;
+	int indexFD = openLockedIndex(indexPath, O_RDONLY, LOCK_SH, &lockedAt);
+	if (indexFD < 0) {
+		TRACE_END(TRACE_INDEX_APPEND);
+		return -1;
+	}
+
+	int status = -1;
+	int tombstoneFD = open(tombstonePath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+	if (tombstoneFD >= 0) {
+		ssize_t written = write(tombstoneFD, tombstone, sizeof(tombstone));
+
+		if (close(tombstoneFD) == 0 && written == sizeof(tombstone)) {
+			status = 0;
+		}
+	}
+	closeLockedIndex(indexFD, lockedAt);
+
+	TRACE_END(TRACE_INDEX_APPEND);
+
+	return status;
+}
+
+// Orders tombstones by name
+static int compareTombstones(const void* a, const void* b) {
+	return strncmp(a, b, MESSAGE_NAME_LENGTH);
+}
+
+char* readTombstones(const char* tombstonePath, size_t* count) {
+	*count = 0;
+
+	int tombstoneFD = open(tombstonePath, O_RDONLY);
+	if (tombstoneFD < 0) {
+		return NULL;
+	}
+
+	struct stat tombstoneStat;
+	char* tombstones = NULL;
+
+	if (fstat(tombstoneFD, &tombstoneStat) == 0 && tombstoneStat.st_size >= MESSAGE_NAME_LENGTH) {
+		tombstones = malloc(tombstoneStat.st_size);
+		ssize_t bytesRead = pread(tombstoneFD, tombstones, tombstoneStat.st_size, 0);
+		*count = bytesRead > 0 ? bytesRead / MESSAGE_NAME_LENGTH : 0;
+	}
+	close(tombstoneFD);
+
+	if (*count == 0) {
+		free(tombstones);
+		return NULL;
+	}
+
+	// Sorted once so each record is checked with a binary search
+	qsort(tombstones, *count, MESSAGE_NAME_LENGTH, compareTombstones);
+
+	return tombstones;
+}
+
+bool isTombstoned(const char* tombstones, size_t count, const char* name) {
+	return count > 0 && bsearch(name, tombstones, count, MESSAGE_NAME_LENGTH, compareTombstones) != NULL;
+}
+
+void dropTombstoned(const char* tombstonePath, messageRecord* records, size_t* count) {
+	size_t numTombstones;
+	char* tombstones = readTombstones(tombstonePath, &numTombstones);
+
+	if (numTombstones == 0) {
+		return;
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < *count; i++) {
+		if (!isTombstoned(tombstones, numTombstones, records[i].name)) {
+			records[kept++] = records[i];
+		}
+	}
+	*count = kept;
+
+	free(tombstones);
+}
+
+messageRecord* readLiveMessageIndex(const char* indexPath, const char* tombstonePath, size_t* count) {
+	messageRecord* records = readMessageIndex(indexPath, count);
+
+	if (records != NULL) {
+		dropTombstoned(tombstonePath, records, count);
+	}
+
+	return records;
+}
+
+int compactTombstones(const char* indexPath, const char* tombstonePath) {
+	struct stat indexStat, tombstoneStat;
+
+	if (stat(tombstonePath, &tombstoneStat) != 0) {
+		return 0;
+	}
+
+	size_t numTombstones = tombstoneStat.st_size / MESSAGE_NAME_LENGTH;
+	size_t numRecords = stat(indexPath, &indexStat) == 0 ? indexStat.st_size / sizeof(messageRecord) : 0;
+
+	// Below the threshold deletions stay as tombstones
+	if (numTombstones * 100 < numRecords * TOMBSTONE_COMPACT_PERCENT) {
+		return 0;
+	}
+
+	uint64_t lockedAt;
+	int indexFD = openLockedIndex(indexPath, O_RDONLY, LOCK_EX, &lockedAt);
+	if (indexFD < 0) {
+		return -1;
+	}
+
+	size_t count;
+	messageRecord* records = readLiveMessageIndex(indexPath, tombstonePath, &count);
+
+	// The rewritten index holds no tombstoned records, so their tombstones go with it
+	int status = writeMessageIndex(indexPath, records, count);
+	if (status == 0) {
+		remove(tombstonePath);
+		status = 1;
+	}
+	closeLockedIndex(indexFD, lockedAt);
+
+	free(records);
+
+	return status;
+}
+
+void readIndexCursor(const char* cursorPath, const char* indexPath, indexCursor* cursor) {
+	struct stat indexStat;
+
+	cursor->indexInode = stat(indexPath, &indexStat) == 0 ? indexStat.st_ino : 0;
+	cursor->position = 0;
+
+	int cursorFD = open(cursorPath, O_RDONLY);
+	if (cursorFD < 0) {
+		return;
+	}
+
+	indexCursor saved;
+	if (read(cursorFD, &saved, sizeof(saved)) == sizeof(saved) && saved.indexInode == cursor->indexInode) {
+		cursor->position = saved.position;
+	}
+	close(cursorFD);
+}
+
+int writeIndexCursor(const char* cursorPath, const char* indexPath, const indexCursor* cursor) {
+	struct stat indexStat;
+
+	if (stat(indexPath, &indexStat) != 0 || indexStat.st_ino != cursor->indexInode) {
+		return -1;
+	}
+
+	int cursorFD = open(cursorPath, O_WRONLY | O_CREAT, 0644);
+	if (cursorFD < 0) {
+		return -1;
+	}
+
+	// The cursor is small enough to be replaced by a single write
+	ssize_t written = pwrite(cursorFD, cursor, sizeof(indexCursor), 0);
+
+	if (close(cursorFD) != 0 || written != sizeof(indexCursor)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Finds the record named name, at position if it is still there, otherwise by
+// searching the index. Returns 0 with its position stored, -1 if it is not there
+static int findRecord(int indexFD, const char* name, size_t* position) {
+	messageRecord records[64];
+
+	if (pread(indexFD, records, sizeof(messageRecord), *position * sizeof(messageRecord)) == sizeof(messageRecord)
+			&& !strncmp(records[0].name, name, MESSAGE_NAME_LENGTH)) {
+		return 0;
+	}
+
+	off_t offset = 0;
+	ssize_t bytesRead;
+
+	// A torn record at the end of the file is ignored
+	while ((bytesRead = pread(indexFD, records, sizeof(records), offset)) >= (ssize_t) sizeof(messageRecord)) {
+		size_t numRead = bytesRead / sizeof(messageRecord);
+
+		for (size_t i = 0; i < numRead; i++) {
+			if (!strncmp(records[i].name, name, MESSAGE_NAME_LENGTH)) {
+				*position = offset / sizeof(messageRecord) + i;
+				return 0;
+			}
+		}
+		offset += numRead * sizeof(messageRecord);
+	}
+
+	return -1;
+}
+
+// Locks or unlocks one record's flags word against other sessions changing it
+static int lockRecordFlags(int indexFD, size_t position, short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = position * sizeof(messageRecord) + offsetof(messageRecord, flags),
+		.l_len = sizeof(uint32_t)
+	};
+	int status;
+
+	while ((status = fcntl(indexFD, F_OFD_SETLKW, &lock)) != 0 && errno == EINTR);
+
+	return status;
+}
+
+// Sets or clears a record's consumed flag. Returns 1 if it is missing or already as asked
+static int changeConsumed(const char* indexPath, size_t* position, const messageRecord* record, bool consumed) {
+	int indexFD = open(indexPath, O_RDWR | O_CLOEXEC);
+	if (indexFD < 0) {
+		return -1;
+	}
+
+	int status = 1;
+
+	if (findRecord(indexFD, record->name, position) == 0) {
+		off_t flagsOffset = *position * sizeof(messageRecord) + offsetof(messageRecord, flags);
+		uint32_t flags;
+
+		status = -1;
+
+		// Only the flags word is rewritten, so appends past the end are never disturbed.
+		// It is read again under the lock, so only one session sees it change
+		if (lockRecordFlags(indexFD, *position, F_WRLCK) == 0) {
+			if (pread(indexFD, &flags, sizeof(flags), flagsOffset) == sizeof(flags)) {
+				if (((flags & MESSAGE_FLAG_CONSUMED) != 0) == consumed) {
+					status = 1;
+				}
+				else {
+					flags ^= MESSAGE_FLAG_CONSUMED;
+					status = pwrite(indexFD, &flags, sizeof(flags), flagsOffset) == sizeof(flags) ? 0 : -1;
+				}
+			}
+			lockRecordFlags(indexFD, *position, F_UNLCK);
+		}
+	}
+
+	if (close(indexFD) != 0) {
+		status = -1;
+	}
+
+	return status;
+}
+
+int markRecordConsumed(const char* indexPath, size_t* position, const messageRecord* record) {
+	return changeConsumed(indexPath, position, record, true);
+}
+
+int unmarkRecordConsumed(const char* indexPath, size_t position, const messageRecord* record) {
+	return changeConsumed(indexPath, &position, record, false);
+}
+
+int markMessageRead(const mailboxHandle* mailbox, const paths* userPaths, int lockFD, int newFD,
+		const messageRecord* record, bool indexed, size_t position) {
+	bool attachment = recordHasAttachment(record);
+
+	// Moves are made relative to the open folders
+	char attachmentName[MESSAGE_NAME_LENGTH + strlen("_attachment")];
+	snprintf(attachmentName, sizeof(attachmentName), "%s_attachment", record->name);
+
+	if (!indexed) {
+		// The read folder serves as cur. Whichever session renames the entry first owns it
+		if (renameat(newFD, record->name, mailbox->readFD, record->name) != 0) {
+			return errno == ENOENT ? 1 : -1;
+		}
+
+		// Add to the read index, or give the message back to new
+		if ((attachment && renameat(newFD, attachmentName, mailbox->readFD, attachmentName) != 0)
+				|| appendMessageRecord(userPaths->readIndex, record) != 0) {
+			int error = errno;
+
+			if (attachment) {
+				renameat(mailbox->readFD, attachmentName, newFD, attachmentName);
+			}
+			renameat(mailbox->readFD, record->name, newFD, record->name);
+
+			errno = error;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	// Flag the entry as read in place instead of rewriting the unread index.
+	// Whichever session flags it first owns it
+	uint64_t lockedAt = timedLock(lockFD, LOCK_SH);
+	int status = markRecordConsumed(userPaths->unreadIndex, &position, record);
+	timedUnlock(lockFD, lockedAt);
+
+	if (status != 0) {
+		return status;
+	}
+
+	// Linked into the read folder and added to the read index before anything leaves unread
+	bool linkedMessage = linkat(mailbox->unreadFD, record->name, mailbox->readFD, record->name, 0) == 0;
+	bool linkedAttachment = linkedMessage && attachment
+		&& linkat(mailbox->unreadFD, attachmentName, mailbox->readFD, attachmentName, 0) == 0;
+
+	if (!linkedMessage || (attachment && !linkedAttachment) || appendMessageRecord(userPaths->readIndex, record) != 0) {
+		int error = errno;
+
+		if (linkedMessage) {
+			unlinkat(mailbox->readFD, record->name, 0);
+		}
+		if (linkedAttachment) {
+			unlinkat(mailbox->readFD, attachmentName, 0);
+		}
+
+		lockedAt = timedLock(lockFD, LOCK_SH);
+		unmarkRecordConsumed(userPaths->unreadIndex, position, record);
+		timedUnlock(lockFD, lockedAt);
+
+		errno = error;
+		return -1;
+	}
+
+	unlinkat(mailbox->unreadFD, record->name, 0);
+	if (attachment) {
+		unlinkat(mailbox->unreadFD, attachmentName, 0);
+	}
+
+	return 0;
+}
+
+int compactMessageIndex(const char* indexPath, const char* cursorPath) {
+	indexCursor cursor;
+	readIndexCursor(cursorPath, indexPath, &cursor);
+
+	size_t count;
+	messageRecord* records = readMessageIndexFrom(indexPath, cursor.position, &count);
+	size_t kept = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (!(records[i].flags & MESSAGE_FLAG_CONSUMED)) {
+			records[kept++] = records[i];
+		}
+	}
+
+	// The rewritten index is a new file, so the old cursor no longer applies to it
+	int status = writeMessageIndex(indexPath, records, kept);
+	if (status == 0) {
+		remove(cursorPath);
+	}
+
+	free(records);
+
+	return status;
+}
+
+int migrateLogToIndex(const char* logPath, const char* folderPath, const char* indexPath, bool inbox) {
+	FILE* logFile = fopen(logPath, "r");
+	if (logFile == NULL) {
+		return 0;
+	}
+
+	size_t capacity = 64;
+	size_t count = 0;
+	messageRecord* records = malloc(capacity * sizeof(messageRecord));
+	char buffer[MAX_LINE_LENGTH];
+
+	// Anything already indexed arrived after the log was last written
+	size_t existingCount;
+	messageRecord* existing = readMessageIndex(indexPath, &existingCount);
+
+	// Message and destinations paths are built in place for each entry
+	pathBuilder messagePaths;
+	setPathFolder(&messagePaths, folderPath);
+
+	while (fscanf(logFile, "%1023s", buffer) != EOF) {
+		if (count == capacity) {
+			capacity *= 2;
+			records = realloc(records, capacity * sizeof(messageRecord));
+		}
+
+		const char* messagePath = buildPath(&messagePaths, buffer, NULL);
+
+		// Inbox entries are <sender>_<time>, sent entries are <time>
+		const char* timeStr = inbox && strchr(buffer, '_') != NULL ? strchr(buffer, '_') + 1 : buffer;
+
+		if (messagePath != NULL && buildMessageRecord(&records[count], messagePath, buffer, parseMessageTime(timeStr)) == 0) {
+			// Sent messages keep their destinations in a side file
+			if (!inbox) {
+				FILE* destinationsFile = fopen(buildPath(&messagePaths, buffer, "_destinations.txt"), "r");
+				char destination[33];
+
+				while (destinationsFile != NULL && fscanf(destinationsFile, "%32s", destination) != EOF) {
+					if (records[count].recipientCount++ == 0) {
+						strcpy(records[count].firstRecipient, destination);
+					}
+				}
+				if (destinationsFile != NULL) {
+					fclose(destinationsFile);
+				}
+			}
+			count++;
+		}
+	}
+	fclose(logFile);
+
+	if (existingCount > 0) {
+		records = realloc(records, (existingCount + count) * sizeof(messageRecord));
+		memcpy(records + count, existing, existingCount * sizeof(messageRecord));
+		count += existingCount;
+	}
+	free(existing);
+
+	int status = writeMessageIndex(indexPath, records, count);
+	if (status == 0) {
+		remove(logPath);
+	}
+
+	free(records);
+
+	return status;
+}
+
+bool recordHasAttachment(const messageRecord* record) {
+	return strcmp(record->attachment, "NONE") != 0;
+}
+
+int64_t parseMessageTime(const char* timeStr) {
+	struct tm timeInfo;
+	long nanoseconds = 0;
+
+	memset(&timeInfo, 0, sizeof(timeInfo));
+
+	if (sscanf(timeStr, "%d_%d_%d_%d_%d_%d_%ld", &timeInfo.tm_year, &timeInfo.tm_mon, &timeInfo.tm_mday,
+			&timeInfo.tm_hour, &timeInfo.tm_min, &timeInfo.tm_sec, &nanoseconds) < 6) {
+		return 0;
+	}
+
+	timeInfo.tm_year -= 1900;
+	timeInfo.tm_mon -= 1;
+	timeInfo.tm_isdst = -1;
+
+	return (int64_t) mktime(&timeInfo) * 1000000000 + nanoseconds;
+}
+
+void formatTimestamp(int64_t timestamp, char* buffer, size_t bufferSize) {
+	time_t seconds = timestamp / 1000000000;
+	struct tm timeInfo;
+
+	localtime_r(&seconds, &timeInfo);
+	strftime(buffer, bufferSize, "%Y/%m/%d %H:%M:%S", &timeInfo);
+}
+
+messageRecord* readFolder(const paths* userPaths, char folder, size_t* count) {
+	const char* indexPath = folder == 'u' ? userPaths->unreadIndex : folder == 'r' ? userPaths->readIndex : userPaths->sentIndex;
+
+	// The shared lock keeps the unread index from being compacted under the cursor
+	FILE* unreadLockFile = NULL;
+	indexCursor cursor = {0, 0};
+	uint64_t lockedAt = 0;
+	if (folder == 'u') {
+		unreadLockFile = fopen(userPaths->unreadLock, "r");
+		if (unreadLockFile != NULL) {
+			lockedAt = timedLock(fileno(unreadLockFile), LOCK_SH);
+		}
+		readIndexCursor(userPaths->unreadCursor, indexPath, &cursor);
+	}
+
+	size_t numRecords;
+	messageRecord* records = readMessageIndexFrom(indexPath, cursor.position, &numRecords);
+
+	if (unreadLockFile != NULL) {
+		timedUnlock(fileno(unreadLockFile), lockedAt);
+		fclose(unreadLockFile);
+	}
+
+	if (folder == 'u') {
+		// Already read, waiting for compaction
+		size_t kept = 0;
+		for (size_t i = 0; i < numRecords; i++) {
+			if (!(records[i].flags & MESSAGE_FLAG_CONSUMED)) {
+				records[kept++] = records[i];
+			}
+		}
+		numRecords = kept;
+
+		// Unread mail delivered maildir-style follows the indexed entries
+		size_t numDelivered;
+		messageRecord* delivered = readMessageDirectory(userPaths->newPath, &numDelivered);
+
+		if (numDelivered > 0) {
+			records = realloc(records, (numRecords + numDelivered) * sizeof(messageRecord));
+			memcpy(records + numRecords, delivered, numDelivered * sizeof(messageRecord));
+			numRecords += numDelivered;
+		}
+		free(delivered);
+	}
+	// Deleted entries wait in the read and sent indexes until compaction
+	else if (records != NULL) {
+		dropTombstoned(folder == 'r' ? userPaths->readTombstones : userPaths->sentTombstones, records, &numRecords);
+	}
+
+	*count = numRecords;
+
+	return records;
+}
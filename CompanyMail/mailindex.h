@@ -0,0 +1,178 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILINDEX_H
+#define MAILINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mailbox.h"
+
+#define MESSAGE_NAME_LENGTH 96
+
+// Set in a record's flags once its message has left an append-only folder
+#define MESSAGE_FLAG_CONSUMED 0x1
+
+// Set in a record's flags once its message has been packed into an archive segment
+#define MESSAGE_FLAG_ARCHIVED 0x2
+
+// Consumed records an append-only index may hold before it is compacted
+#define INDEX_COMPACT_THRESHOLD 256
+
+// Share of an index that may be deleted before it is rewritten without them
+#define TOMBSTONE_COMPACT_PERCENT 25
+
+// One message in a folder index. Everything a listing shows is kept here
+// so listing a folder never opens the message files.
+// name is the message's file name in the folder, which is its id.
+// timestamp is nanoseconds since the epoch and size is the message file size.
+// subjectOffset is the byte offset of the subject text in the message file.
+// firstRecipient and recipientCount describe who the message was sent to.
+// segment is the archive segment holding an archived message.
+typedef struct messageRecord {
+	int64_t timestamp;
+	uint64_t size;
+	uint32_t subjectOffset;
+	uint32_t recipientCount;
+	uint32_t flags;
+	uint32_t segment;
+	char name[MESSAGE_NAME_LENGTH];
+	char sender[33];
+	char firstRecipient[33];
+	char attachment[101];
+	char subject[105];
+} messageRecord;
+
+// Fills in a record from a message file's header and size
+// Returns 0 on success, -1 if the message could not be read
+int buildMessageRecord(messageRecord* record, const char* messagePath, const char* name, int64_t timestamp);
+
+// Opens a file that is replaced by rename when compacted, creating it if
+// needed, and flocks it with operation. The lock is only kept once it is known
+// to be on the current file. When it was taken is stored in lockedAt, to be
+// passed to closeLockedIndex(). Returns the locked descriptor, or -1 on failure
+int openLockedIndex(const char* indexPath, int flags, int operation, uint64_t* lockedAt);
+
+// As openLockedIndex(), with the index named relative to the directory dirFD
+int openLockedIndexAt(int dirFD, const char* name, int flags, int operation, uint64_t* lockedAt);
+
+// Releases and closes a descriptor from openLockedIndex(), recording how long it was locked.
+// Returns the result of close()
+int closeLockedIndex(int indexFD, uint64_t lockedAt);
+
+// Appends one record to an index, creating it if needed
+// Returns 0 on success, -1 on failure
+int appendMessageRecord(const char* indexPath, const messageRecord* record);
+
+// As appendMessageRecord(), with the index named relative to the directory dirFD
+int appendMessageRecordAt(int dirFD, const char* name, const messageRecord* record);
+
+// Reads a whole index in one sequential pass. The array must be freed.
+// A missing index reads as empty. Returns NULL with count 0 if empty or on failure
+messageRecord* readMessageIndex(const char* indexPath, size_t* count);
+
+// Reads the records at or after position start, as appended since a
+// reader took a snapshot of count start. The array must be freed
+messageRecord* readMessageIndexFrom(const char* indexPath, size_t start, size_t* count);
+
+// Builds records for the messages in a maildir-style folder from its
+// directory contents, oldest first. Entries are named <sender>_<id>,
+// with any attachment beside them as <sender>_<id>_attachment.
+// The array must be freed. Returns NULL with count 0 if empty or missing
+messageRecord* readMessageDirectory(const char* folderPath, size_t* count);
+
+// Atomically replaces an index with the given records
+// Returns 0 on success, -1 on failure
+int writeMessageIndex(const char* indexPath, const messageRecord* records, size_t count);
+
+// Deletions from the read and sent folders are recorded as tombstones, one
+// MESSAGE_NAME_LENGTH name per deleted message, in a file beside the index.
+// The index itself is only rewritten by compactTombstones()
+
+// Records that a message has been deleted. Costs one small append
+// Returns 0 on success, -1 on failure
+int appendTombstone(const char* indexPath, const char* tombstonePath, const char* name);
+
+// Reads a folder's tombstones, sorted for isTombstoned(). The array must be freed.
+// Returns NULL with count 0 if there are none
+char* readTombstones(const char* tombstonePath, size_t* count);
+
+// True if name is among tombstones from readTombstones()
+bool isTombstoned(const char* tombstones, size_t count, const char* name);
+
+// Removes records that have a tombstone from an array, keeping their order
+void dropTombstoned(const char* tombstonePath, messageRecord* records, size_t* count);
+
+// Reads an index without its deleted records. The array must be freed
+messageRecord* readLiveMessageIndex(const char* indexPath, const char* tombstonePath, size_t* count);
+
+// Rewrites an index without its deleted records and clears its tombstones,
+// but only once tombstones reach TOMBSTONE_COMPACT_PERCENT of the index.
+// Returns 1 if the index was compacted, 0 if not needed, -1 on failure
+int compactTombstones(const char* indexPath, const char* tombstonePath);
+
+// Where a reader of an append-only index has got to. Every record before
+// position has been consumed. indexInode ties the cursor to one version of
+// the index, so a rewritten index never inherits an old cursor
+typedef struct indexCursor {
+	uint64_t indexInode;
+	uint64_t position;
+} indexCursor;
+
+// Reads the cursor for an index. A missing cursor, or one saved against an
+// earlier version of the index, reads as position 0
+void readIndexCursor(const char* cursorPath, const char* indexPath, indexCursor* cursor);
+
+// Saves a cursor unless the index has been rewritten since it was read
+// Returns 0 on success, -1 on failure
+int writeIndexCursor(const char* cursorPath, const char* indexPath, const indexCursor* cursor);
+
+// Flags a record as consumed, in place. It is looked for at position first,
+// then by name if compaction has moved it, with where it was found stored in
+// position. Sessions marking the same record take turns on its flags, so
+// only one of them succeeds.
+// Returns 0 on success, 1 if it is missing or already consumed, -1 on failure
+int markRecordConsumed(const char* indexPath, size_t* position, const messageRecord* record);
+
+// Undoes markRecordConsumed(), found the same way.
+// Returns 0 on success, 1 if it is missing or not consumed, -1 on failure
+int unmarkRecordConsumed(const char* indexPath, size_t position, const messageRecord* record);
+
+// Moves an unread message and its attachment into the read folder and adds it
+// to the read index. An indexed message is first flagged at position in the
+// unread index, while holding the unread lock lockFD shared, and only then
+// linked into read, indexed there and unlinked from unread. Otherwise it is a
+// maildir-style delivery, renamed out of newFD. If any step fails the earlier
+// ones are undone, so the message stays unread.
+// Returns 0 on success, 1 if another session has already taken it, -1 on failure
+int markMessageRead(const mailboxHandle* mailbox, const paths* userPaths, int lockFD, int newFD,
+		const messageRecord* record, bool indexed, size_t position);
+
+// Rewrites an append-only index without its consumed records and resets its cursor.
+// Callers must hold the folder's lock exclusively. Returns 0 on success, -1 on failure
+int compactMessageIndex(const char* indexPath, const char* cursorPath);
+
+// Builds an index for a folder still using a text log.txt and removes the log.
+// Entries already in the index are kept after the migrated ones.
+// inbox is true if entries are named <sender>_<time> rather than <time>.
+// Does nothing if there is no log. Returns 0 on success, -1 on failure
+int migrateLogToIndex(const char* logPath, const char* folderPath, const char* indexPath, bool inbox);
+
+// Reads the messages currently in one of a user's folders, as listings show them.
+// folder is 'u' for unread, 'r' for read, or 's' for sent. Unread mail already
+// read and deleted read or sent mail are left out. The array must be freed
+messageRecord* readFolder(const paths* userPaths, char folder, size_t* count);
+
+// True if the message has an attachment
+bool recordHasAttachment(const messageRecord* record);
+
+// Converts a message time string into nanoseconds since the epoch
+int64_t parseMessageTime(const char* timeStr);
+
+// Formats a timestamp as YYYY/MM/DD HH:MM:SS in local time
+void formatTimestamp(int64_t timestamp, char* buffer, size_t bufferSize);
+
+#endif
@@ -0,0 +1,15 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILROOT_H
+#define MAILROOT_H
+
+// Directory holding the whole mail tree. It is fixed when a program is built
+// (make MAIL_ROOT=/some/dir) rather than read at run time, since the front end
+// runs setuid root and must not be pointed at a tree its caller controls
+#ifndef MAIL_ROOT
+#define MAIL_ROOT "/CompanyMail"
+#endif
+
+#endif
@@ -0,0 +1,356 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "mailserver.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const char* usersFilename = MAIL_ROOT "/Config/users";
+const char* adminFilename = MAIL_ROOT "/Config/admins";
+const char* userIndexFilename = MAIL_ROOT "/Config/users.idx";
+
+// Files whose metadata identifies one version of a folder
+#define SIGNATURE_FILES 3
+
+typedef struct fileSignature {
+	uint64_t inode;
+	int64_t size;
+	int64_t mtimeSec;
+	int64_t mtimeNsec;
+} fileSignature;
+
+// One folder listing held in memory, with the signature it was read under.
+// A listing read within a second of its files changing is not reused, since
+// a second change in the same clock tick would leave the signature the same
+typedef struct folderCache {
+	bool loaded;
+	bool reusable;
+	fileSignature signature[SIGNATURE_FILES];
+	messageRecord* records;
+	size_t count;
+} folderCache;
+
+typedef struct cachedMailbox {
+	bool inUse;
+	uint64_t lastUsed;
+	char username[USERNAME_LENGTH];
+	paths userPaths;
+	folderCache folders[3];
+} cachedMailbox;
+
+static cachedMailbox mailboxCache[MAX_CACHED_MAILBOXES];
+static uint64_t useCounter = 0;
+
+static userIndex userDirectory;
+
+// Position of a folder in cachedMailbox.folders
+static int folderSlot(char folder) {
+	return folder == 'u' ? 0 : folder == 'r' ? 1 : 2;
+}
+
+// Stats the files a folder listing is built from
+static void folderSignature(const paths* userPaths, char folder, fileSignature* signature) {
+	const char* files[SIGNATURE_FILES];
+
+	if (folder == 'u') {
+		files[0] = userPaths->unreadIndex;
+		files[1] = userPaths->unreadCursor;
+		files[2] = userPaths->newPath;
+	}
+	else if (folder == 'r') {
+		files[0] = userPaths->readIndex;
+		files[1] = userPaths->readTombstones;
+		files[2] = NULL;
+	}
+	else {
+		files[0] = userPaths->sentIndex;
+		files[1] = userPaths->sentTombstones;
+		files[2] = NULL;
+	}
+
+	memset(signature, 0, SIGNATURE_FILES * sizeof(fileSignature));
+
+	for (int i = 0; i < SIGNATURE_FILES; i++) {
+		struct stat fileStat;
+
+		if (files[i] != NULL && stat(files[i], &fileStat) == 0) {
+			signature[i].inode = fileStat.st_ino;
+			signature[i].size = fileStat.st_size;
+			signature[i].mtimeSec = fileStat.st_mtim.tv_sec;
+			signature[i].mtimeNsec = fileStat.st_mtim.tv_nsec;
+		}
+	}
+}
+
+// Finds a user's mailbox in the cache, replacing the least recently used one if needed
+static cachedMailbox* findMailbox(const char* username) {
+	cachedMailbox* victim = &mailboxCache[0];
+
+	for (int i = 0; i < MAX_CACHED_MAILBOXES; i++) {
+		cachedMailbox* mailbox = &mailboxCache[i];
+
+		if (mailbox->inUse && !strcmp(mailbox->username, username)) {
+			mailbox->lastUsed = ++useCounter;
+			return mailbox;
+		}
+		if (!mailbox->inUse || (victim->inUse && mailbox->lastUsed < victim->lastUsed)) {
+			victim = mailbox;
+		}
+	}
+
+	if (victim->inUse) {
+		for (int i = 0; i < 3; i++) {
+			free(victim->folders[i].records);
+		}
+		freePaths(&victim->userPaths);
+	}
+
+	memset(victim, 0, sizeof(cachedMailbox));
+	victim->inUse = true;
+	victim->lastUsed = ++useCounter;
+	snprintf(victim->username, sizeof(victim->username), "%s", username);
+	generatePaths(&victim->userPaths, username);
+
+	return victim;
+}
+
+// Returns a folder's listing, reading the disk only if the folder changed
+static folderCache* loadFolder(cachedMailbox* mailbox, char folder) {
+	folderCache* cache = &mailbox->folders[folderSlot(folder)];
+	fileSignature signature[SIGNATURE_FILES];
+
+	folderSignature(&mailbox->userPaths, folder, signature);
+
+	if (cache->loaded && cache->reusable && !memcmp(signature, cache->signature, sizeof(signature))) {
+		return cache;
+	}
+
+	free(cache->records);
+	cache->records = readFolder(&mailbox->userPaths, folder, &cache->count);
+	memcpy(cache->signature, signature, sizeof(signature));
+	cache->loaded = true;
+	cache->reusable = true;
+
+	time_t now = time(NULL);
+	for (int i = 0; i < SIGNATURE_FILES; i++) {
+		if (signature[i].mtimeSec >= now - 1) {
+			cache->reusable = false;
+		}
+	}
+
+	return cache;
+}
+
+// Writes all of a buffer to the client. Returns 0 on success, -1 on failure
+static int sendAll(int clientFD, const void* buffer, size_t length) {
+	const char* position = buffer;
+
+	while (length > 0) {
+		ssize_t sent = send(clientFD, position, length, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return -1;
+		}
+		position += sent;
+		length -= sent;
+	}
+
+	return 0;
+}
+
+// Sends a message file straight from the page cache to the client
+static void sendMessage(int clientFD, const cachedMailbox* mailbox, const mailRequest* request) {
+	mailResponse response = {0, 0, 0};
+
+	// Only plain names inside the user's own folder are served
+	if (request->name[0] == '\0' || request->name[0] == '.' || strchr(request->name, '/') != NULL) {
+		response.status = EINVAL;
+		sendAll(clientFD, &response, sizeof(response));
+		return;
+	}
+
+	const char* folderPaths[2] = {NULL, NULL};
+
+	if (request->folder == 'u') {
+		folderPaths[0] = mailbox->userPaths.unreadPath;
+		folderPaths[1] = mailbox->userPaths.newPath;
+	}
+	else {
+		folderPaths[0] = request->folder == 'r' ? mailbox->userPaths.readPath : mailbox->userPaths.sentPath;
+	}
+
+	int messageFD = -1;
+	for (int i = 0; i < 2 && messageFD < 0 && folderPaths[i] != NULL; i++) {
+		char* messagePath = malloc(strlen(folderPaths[i]) + strlen("/") + strlen(request->name) + 1);
+		sprintf(messagePath, "%s/%s", folderPaths[i], request->name);
+		messageFD = open(messagePath, O_RDONLY);
+		free(messagePath);
+	}
+
+	struct stat messageStat;
+	if (messageFD < 0 || fstat(messageFD, &messageStat) != 0) {
+		response.status = ENOENT;
+		sendAll(clientFD, &response, sizeof(response));
+		if (messageFD >= 0) {
+			close(messageFD);
+		}
+		return;
+	}
+
+	response.length = messageStat.st_size;
+
+	if (sendAll(clientFD, &response, sizeof(response)) == 0) {
+		off_t offset = 0;
+
+		while (offset < messageStat.st_size) {
+			ssize_t sent = sendfile(clientFD, messageFD, &offset, messageStat.st_size - offset);
+
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+			if (sent <= 0) {
+				break;
+			}
+		}
+	}
+	close(messageFD);
+}
+
+// Answers one request on a client connection
+static void handleRequest(int clientFD) {
+	mailRequest request;
+	mailResponse response = {0, 0, 0};
+
+	if (recv(clientFD, &request, sizeof(request), MSG_WAITALL) != sizeof(request)) {
+		return;
+	}
+	request.username[USERNAME_LENGTH - 1] = '\0';
+	request.name[MESSAGE_NAME_LENGTH - 1] = '\0';
+
+	// The user table is remapped whenever update_users or setup changes it
+	if (!userIndexIsCurrent(&userDirectory, usersFilename, adminFilename)) {
+		closeUserIndex(&userDirectory);
+		loadUserIndex(&userDirectory, usersFilename, adminFilename, userIndexFilename);
+	}
+
+	if (userDirectory.map == NULL || findUserByName(&userDirectory, request.username) == NULL
+			|| (request.folder != 'u' && request.folder != 'r' && request.folder != 's')) {
+		response.status = EINVAL;
+		sendAll(clientFD, &response, sizeof(response));
+		return;
+	}
+
+	cachedMailbox* mailbox = findMailbox(request.username);
+
+	switch (request.type) {
+		case REQUEST_LIST: {
+			folderCache* cache = loadFolder(mailbox, request.folder);
+
+			response.length = cache->count;
+			if (sendAll(clientFD, &response, sizeof(response)) == 0 && cache->count > 0) {
+				sendAll(clientFD, cache->records, cache->count * sizeof(messageRecord));
+			}
+			break;
+		}
+		case REQUEST_COUNT:
+			response.length = loadFolder(mailbox, request.folder)->count;
+			sendAll(clientFD, &response, sizeof(response));
+			break;
+		case REQUEST_FETCH:
+			sendMessage(clientFD, mailbox, &request);
+			break;
+		default:
+			response.status = EINVAL;
+			sendAll(clientFD, &response, sizeof(response));
+			break;
+	}
+}
+
+int main(void) {
+	if (geteuid() != 0) {
+		fprintf(stderr, "The mail server must be run as root\n");
+		return 1;
+	}
+
+	// Clients that disconnect early must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	umask(077);
+
+	// Lock waits and index reads made here count along with the front end's
+	openMetrics();
+	openTrace("maild");
+
+	if (loadUserIndex(&userDirectory, usersFilename, adminFilename, userIndexFilename) != 0) {
+		fprintf(stderr, "Error loading user directory\n");
+		return 1;
+	}
+
+	int serverFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (serverFD < 0) {
+		perror("Error creating socket");
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", MAIL_SERVER_SOCKET);
+
+	// A socket left by an earlier server is replaced
+	unlink(MAIL_SERVER_SOCKET);
+
+	if (bind(serverFD, (struct sockaddr*) &address, sizeof(address)) != 0
+			|| chmod(MAIL_SERVER_SOCKET, 0600) != 0 || listen(serverFD, SOMAXCONN) != 0) {
+		perror("Error listening on socket");
+		return 1;
+	}
+
+	while (true) {
+		int clientFD = accept4(serverFD, NULL, NULL, SOCK_CLOEXEC);
+
+		if (clientFD < 0) {
+			if (errno != EINTR) {
+				perror("Error accepting connection");
+			}
+			continue;
+		}
+
+		// Only the setuid front end, running as root, may ask for a user's mail
+		struct ucred peer;
+		socklen_t peerLength = sizeof(peer);
+
+		// A client that stops talking cannot hold up everyone else
+		struct timeval timeout = {MAIL_SERVER_TIMEOUT, 0};
+		setsockopt(clientFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(clientFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if (getsockopt(clientFD, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) == 0 && peer.uid == 0) {
+			handleRequest(clientFD);
+		}
+		close(clientFD);
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef MAILSERVER_H
+#define MAILSERVER_H
+
+#include <stdint.h>
+
+#include "mailindex.h"
+#include "userindex.h"
+#include "mailroot.h"
+
+// The optional mail server keeps folder listings in memory and answers the
+// mail front end over a Unix socket only root can connect to.
+// Each connection carries one request and its response.
+
+#define MAIL_SERVER_SOCKET MAIL_ROOT "/maild.sock"
+
+// Mailboxes kept in memory before the least recently used one is dropped
+#define MAX_CACHED_MAILBOXES 64
+
+// Seconds the front end waits on the server before reading the disk itself
+#define MAIL_SERVER_TIMEOUT 2
+
+// Request types
+#define REQUEST_LIST 1
+#define REQUEST_COUNT 2
+#define REQUEST_FETCH 3
+
+// folder is 'u' for unread, 'r' for read, or 's' for sent.
+// name is only used by REQUEST_FETCH and names the message to send back
+typedef struct mailRequest {
+	uint32_t type;
+	char folder;
+	char username[USERNAME_LENGTH];
+	char name[MESSAGE_NAME_LENGTH];
+} mailRequest;
+
+// status is 0 or an errno. On success length records follow a
+// REQUEST_LIST response and length bytes of message follow a REQUEST_FETCH
+// response. A REQUEST_COUNT response carries the count in length only
+typedef struct mailResponse {
+	int32_t status;
+	uint32_t reserved;
+	uint64_t length;
+} mailResponse;
+
+#endif
@@ -0,0 +1,187 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "metrics.h"
+#include "trace.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static const char* metricNames[NUM_METRICS] = {
+	"lock_wait",
+	"lock_hold",
+	"delivery",
+	"index_rewrite",
+	"header_scan",
+	"file_copy",
+	"login_lookup"
+};
+
+static metricsArea* metricsMap = NULL;
+
+// Maps the stats file. Returns the area, or NULL if it is missing or from another version
+static metricsArea* mapMetrics(bool create) {
+	int metricsFD = open(METRICS_FILENAME, create ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+	if (metricsFD < 0) {
+		return NULL;
+	}
+
+	struct stat metricsStat;
+	if (fstat(metricsFD, &metricsStat) != 0
+			|| (metricsStat.st_size < sizeof(metricsArea) && (!create || ftruncate(metricsFD, sizeof(metricsArea)) != 0))) {
+		close(metricsFD);
+		return NULL;
+	}
+
+	metricsArea* area = mmap(NULL, sizeof(metricsArea), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, metricsFD, 0);
+	close(metricsFD);
+
+	if (area == MAP_FAILED) {
+		return NULL;
+	}
+
+	// A new file is zero filled. Every process that finds it so writes the same
+	// header, and the magic goes in last so readers never see half of one
+	if (create && __atomic_load_n(&area->magic, __ATOMIC_ACQUIRE) == 0) {
+		area->version = METRICS_VERSION;
+		area->numMetrics = NUM_METRICS;
+		area->since = time(NULL);
+		__atomic_store_n(&area->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	if (__atomic_load_n(&area->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC
+			|| area->version != METRICS_VERSION || area->numMetrics != NUM_METRICS) {
+		munmap(area, sizeof(metricsArea));
+		return NULL;
+	}
+
+	return area;
+}
+
+int openMetrics(void) {
+	if (metricsMap == NULL) {
+		metricsMap = mapMetrics(true);
+	}
+
+	return metricsMap != NULL ? 0 : -1;
+}
+
+uint64_t metricsClock(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void recordMetric(metricId metric, uint64_t startNanos, uint64_t bytes) {
+	if (metricsMap == NULL) {
+		return;
+	}
+
+	uint64_t nanos = metricsClock() - startNanos;
+	metricCounter* counter = &metricsMap->metrics[metric];
+
+	unsigned int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+	if (bucket >= METRIC_BUCKETS) {
+		bucket = METRIC_BUCKETS - 1;
+	}
+
+	__atomic_fetch_add(&counter->totalNanos, nanos, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&counter->maxNanos, __ATOMIC_RELAXED);
+	while (nanos > max && !__atomic_compare_exchange_n(&counter->maxNanos, &max, nanos, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t timedLock(int fd, int operation) {
+	uint64_t start = metricsClock();
+
+	TRACE_BEGIN(TRACE_LOCK_WAIT);
+	while (flock(fd, operation) != 0 && errno == EINTR);
+	TRACE_END(TRACE_LOCK_WAIT);
+
+	recordMetric(METRIC_LOCK_WAIT, start, 0);
+	TRACE_BEGIN(TRACE_LOCK_HELD);
+
+	return metricsClock();
+}
+
+void timedUnlock(int fd, uint64_t lockedAt) {
+	flock(fd, LOCK_UN);
+
+	TRACE_END(TRACE_LOCK_HELD);
+	recordMetric(METRIC_LOCK_HOLD, lockedAt, 0);
+}
+
+// Upper bound of the bucket holding the given percentile, in microseconds
+static double bucketPercentile(const metricCounter* counter, uint64_t count, unsigned int percent) {
+	uint64_t rank = (count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < METRIC_BUCKETS; i++) {
+		seen += counter->buckets[i];
+		// No bound is reported past the slowest operation actually seen
+		if (seen >= rank) {
+			uint64_t bound = 2ULL << i;
+			return (double) (bound < counter->maxNanos ? bound : counter->maxNanos) / 1000;
+		}
+	}
+
+	return (double) counter->maxNanos / 1000;
+}
+
+int printMetrics(FILE* stream) {
+	metricsArea* area = metricsMap != NULL ? metricsMap : mapMetrics(false);
+	if (area == NULL) {
+		return -1;
+	}
+
+	char since[32];
+	time_t sinceTime = area->since;
+	struct tm sinceInfo;
+	localtime_r(&sinceTime, &sinceInfo);
+	strftime(since, sizeof(since), "%Y/%m/%d %H:%M:%S", &sinceInfo);
+
+	fprintf(stream, "Mail statistics since %s\n", since);
+	fprintf(stream, "Percentiles are the upper bound of their histogram bucket\n\n");
+	fprintf(stream, "%-14s %10s %12s %10s %10s %10s %12s %14s\n",
+		"operation", "count", "total_ms", "avg_us", "p50_us", "p99_us", "max_us", "bytes");
+
+	for (int i = 0; i < NUM_METRICS; i++) {
+		metricCounter counter;
+
+		// A snapshot, since other processes keep adding while it is printed
+		for (unsigned int j = 0; j < sizeof(metricCounter) / sizeof(uint64_t); j++) {
+			((uint64_t*) &counter)[j] = __atomic_load_n(&((uint64_t*) &area->metrics[i])[j], __ATOMIC_RELAXED);
+		}
+
+		uint64_t count = 0;
+		for (unsigned int j = 0; j < METRIC_BUCKETS; j++) {
+			count += counter.buckets[j];
+		}
+
+		if (count == 0) {
+			fprintf(stream, "%-14s %10d %12s %10s %10s %10s %12s %14s\n", metricNames[i], 0, "-", "-", "-", "-", "-", "-");
+			continue;
+		}
+
+		fprintf(stream, "%-14s %10llu %12.1f %10.1f %10.1f %10.1f %12.1f %14llu\n", metricNames[i],
+			(unsigned long long) count, counter.totalNanos / 1e6, counter.totalNanos / 1e3 / count,
+			bucketPercentile(&counter, count, 50), bucketPercentile(&counter, count, 99),
+			counter.maxNanos / 1e3, (unsigned long long) counter.bytes);
+	}
+
+	if (area != metricsMap) {
+		munmap(area, sizeof(metricsArea));
+	}
+
+	return 0;
+}
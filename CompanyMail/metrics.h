@@ -0,0 +1,74 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mailroot.h"
+
+#define METRICS_FILENAME MAIL_ROOT "/Config/stats.dat"
+#define METRICS_MAGIC 0x5254454d
+#define METRICS_VERSION 1
+
+// Bucket i counts operations that took from 2^i up to 2^(i+1) nanoseconds
+#define METRIC_BUCKETS 40
+
+// Operations that are counted and timed
+typedef enum metricId {
+	METRIC_LOCK_WAIT,
+	METRIC_LOCK_HOLD,
+	METRIC_DELIVERY,
+	METRIC_INDEX_REWRITE,
+	METRIC_HEADER_SCAN,
+	METRIC_FILE_COPY,
+	METRIC_LOGIN_LOOKUP,
+	NUM_METRICS
+} metricId;
+
+// count is the sum of the buckets
+typedef struct metricCounter {
+	uint64_t totalNanos;
+	uint64_t maxNanos;
+	uint64_t bytes;
+	uint64_t buckets[METRIC_BUCKETS];
+} metricCounter;
+
+// Layout of the stats file, which every mail process maps shared.
+// Counters are only ever added to with atomic instructions, so recording
+// never takes a lock
+typedef struct metricsArea {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numMetrics;
+	uint32_t reserved;
+	int64_t since;
+	metricCounter metrics[NUM_METRICS];
+} metricsArea;
+
+// Maps the stats file, creating it if needed.
+// Until this succeeds every recordMetric() call does nothing.
+// Returns 0 on success, -1 on failure
+int openMetrics(void);
+
+// Monotonic time in nanoseconds to pass to recordMetric() as a start time
+uint64_t metricsClock(void);
+
+// Counts one operation that began at startNanos and moved bytes bytes
+void recordMetric(metricId metric, uint64_t startNanos, uint64_t bytes);
+
+// flock() that records how long it waited for the lock.
+// Returns the time the lock was acquired, to be passed to timedUnlock()
+uint64_t timedLock(int fd, int operation);
+
+// Releases a lock taken with timedLock() and records how long it was held
+void timedUnlock(int fd, uint64_t lockedAt);
+
+// Prints a table of every metric to stream.
+// Returns 0 on success, -1 if there are no statistics to show
+int printMetrics(FILE* stream);
+
+#endif
@@ -0,0 +1,324 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "recipients.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LENGTH 1024
+
+// Bytes read from a recipients file at a time
+#define RECIPIENT_READ_SIZE (64 << 10)
+
+// FNV-1a hash of a name
+static uint32_t hashRecipient(const char* name) {
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Returns the slot holding name, or the empty slot it would go in
+static size_t findSlot(const recipientList* list, const char* name) {
+	size_t mask = list->numSlots - 1;
+	size_t slot = hashRecipient(name) & mask;
+
+	while (list->slots[slot] != 0 && strcmp(list->entries[list->slots[slot] - 1].name, name) != 0) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+// Doubles the entries and the table, keeping the table at most half full
+static int growRecipientList(recipientList* list) {
+	size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+	recipient* entries = realloc(list->entries, capacity * sizeof(recipient));
+	uint32_t* slots = calloc(capacity * 2, sizeof(uint32_t));
+
+	if (entries == NULL || slots == NULL) {
+		free(slots);
+		if (entries != NULL) {
+			list->entries = entries;
+		}
+		return -1;
+	}
+
+	free(list->slots);
+	list->entries = entries;
+	list->capacity = capacity;
+	list->slots = slots;
+	list->numSlots = capacity * 2;
+
+	for (size_t i = 0; i < list->count; i++) {
+		list->slots[findSlot(list, list->entries[i].name)] = i + 1;
+	}
+
+	return 0;
+}
+
+void initRecipientList(recipientList* list) {
+	memset(list, 0, sizeof(recipientList));
+}
+
+void freeRecipientList(recipientList* list) {
+	free(list->entries);
+	free(list->slots);
+	initRecipientList(list);
+}
+
+bool addRecipient(recipientList* list, const char* name, size_t length) {
+	char key[RECIPIENT_NAME_LENGTH];
+	bool tooLong = length >= RECIPIENT_NAME_LENGTH;
+
+	// An overlong name is reported by its start
+	if (tooLong) {
+		memcpy(key, name, RECIPIENT_NAME_LENGTH - 4);
+		strcpy(key + RECIPIENT_NAME_LENGTH - 4, "...");
+	}
+	else {
+		memcpy(key, name, length);
+		key[length] = '\0';
+	}
+
+	if (list->count == list->capacity && growRecipientList(list) != 0) {
+		return false;
+	}
+
+	size_t slot = findSlot(list, key);
+
+	if (list->slots[slot] != 0) {
+		list->numDuplicates++;
+		return false;
+	}
+
+	recipient* entry = &list->entries[list->count];
+
+	strcpy(entry->name, key);
+	entry->state = tooLong ? RECIPIENT_INVALID : RECIPIENT_PENDING;
+	list->slots[slot] = ++list->count;
+
+	if (key[0] == GROUP_PREFIX) {
+		list->numGroupNames++;
+	}
+
+	return true;
+}
+
+size_t addRecipientsFromText(recipientList* list, const char* text) {
+	size_t numAdded = 0;
+
+	while (*text != '\0') {
+		text += strspn(text, RECIPIENT_SEPARATORS);
+
+		size_t length = strcspn(text, RECIPIENT_SEPARATORS);
+		if (length > 0 && addRecipient(list, text, length)) {
+			numAdded++;
+		}
+		text += length;
+	}
+
+	return numAdded;
+}
+
+long readRecipients(recipientList* list, int fd, bool stopAtBlankLine) {
+	// A pipe cannot be rewound, so nothing past the blank line may be read from it
+	bool seekable = lseek(fd, 0, SEEK_CUR) != -1;
+	size_t readSize = stopAtBlankLine && !seekable ? 1 : RECIPIENT_READ_SIZE;
+
+	char* buffer = malloc(readSize);
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	// Names can be split across reads, so the current one is gathered here
+	char name[RECIPIENT_NAME_LENGTH];
+	size_t nameLength = 0;
+	bool lineEmpty = true;
+	long numAdded = 0;
+	ssize_t numRead;
+	bool done = false;
+
+	while (!done && (numRead = read(fd, buffer, readSize)) > 0) {
+		for (ssize_t i = 0; i < numRead; i++) {
+			char c = buffer[i];
+
+			if (strchr(RECIPIENT_SEPARATORS, c) == NULL) {
+				if (nameLength < sizeof(name)) {
+					name[nameLength] = c;
+				}
+				nameLength++;
+				lineEmpty = false;
+				continue;
+			}
+
+			if (nameLength > 0) {
+				numAdded += addRecipient(list, name, nameLength < sizeof(name) ? nameLength : sizeof(name));
+				nameLength = 0;
+			}
+
+			if (c == '\n') {
+				if (lineEmpty && stopAtBlankLine) {
+					// What was read past the blank line is handed back
+					if (i + 1 < numRead) {
+						lseek(fd, i + 1 - numRead, SEEK_CUR);
+					}
+					done = true;
+					break;
+				}
+				lineEmpty = true;
+			}
+		}
+	}
+
+	if (nameLength > 0) {
+		numAdded += addRecipient(list, name, nameLength < sizeof(name) ? nameLength : sizeof(name));
+	}
+	free(buffer);
+
+	return numRead < 0 ? -1 : numAdded;
+}
+
+// Replaces a group with its members, which the index only holds if they
+// have accounts. Returns false if there is no such group
+static bool expandRecipientGroup(recipientList* list, const groupIndex* groups, size_t entryNumber) {
+	const groupRecord* group = findGroup(groups, list->entries[entryNumber].name + 1);
+
+	if (group == NULL) {
+		return false;
+	}
+
+	list->entries[entryNumber].state = RECIPIENT_GROUP;
+
+	for (uint32_t i = 0; i < group->numMembers; i++) {
+		const char* member = groups->members[group->firstMember + i];
+
+		if (addRecipient(list, member, strlen(member))) {
+			list->entries[list->count - 1].state = RECIPIENT_VALID;
+		}
+	}
+
+	return true;
+}
+
+size_t validateRecipients(recipientList* list, const userIndex* directory, const groupIndex* groups, const char* usersFilename) {
+	size_t numPending = 0;
+
+	// Constant time lookups when the indexed directory is available.
+	// Members of a group are added to the end and need no lookup
+	for (size_t i = list->numChecked; i < list->count; i++) {
+		recipient* entry = &list->entries[i];
+
+		if (entry->state == RECIPIENT_PENDING && entry->name[0] == GROUP_PREFIX) {
+			if (!expandRecipientGroup(list, groups, i)) {
+				list->entries[i].state = RECIPIENT_INVALID;
+			}
+		}
+		else if (entry->state == RECIPIENT_PENDING) {
+			if (directory->map == NULL) {
+				numPending++;
+			}
+			else {
+				entry->state = findUserByName(directory, entry->name) != NULL ? RECIPIENT_VALID : RECIPIENT_INVALID;
+			}
+		}
+	}
+
+	// Otherwise the users file is read once and each account looked up in the set
+	if (numPending > 0) {
+		FILE* usrFile = fopen(usersFilename, "r");
+		char line[MAX_LINE_LENGTH];
+
+		while (usrFile != NULL && numPending > 0 && fgets(line, sizeof(line), usrFile) != NULL) {
+			char* savePtr;
+			char* username = strtok_r(line, ":\n", &savePtr);
+
+			if (username == NULL || strlen(username) >= USERNAME_LENGTH) {
+				continue;
+			}
+
+			uint32_t entryNumber = list->slots[findSlot(list, username)];
+
+			if (entryNumber > list->numChecked && list->entries[entryNumber - 1].state == RECIPIENT_PENDING) {
+				list->entries[entryNumber - 1].state = RECIPIENT_VALID;
+				numPending--;
+			}
+		}
+		if (usrFile != NULL) {
+			fclose(usrFile);
+		}
+	}
+
+	size_t numInvalid = 0;
+
+	for (size_t i = list->numChecked; i < list->count; i++) {
+		recipient* entry = &list->entries[i];
+
+		if (entry->state == RECIPIENT_PENDING) {
+			entry->state = RECIPIENT_INVALID;
+		}
+
+		if (entry->state == RECIPIENT_VALID) {
+			list->numValid++;
+		}
+		else if (entry->state == RECIPIENT_INVALID) {
+			numInvalid++;
+		}
+	}
+
+	list->numInvalid += numInvalid;
+	list->numChecked = list->count;
+
+	return numInvalid;
+}
+
+void printInvalidRecipients(const recipientList* list, FILE* out) {
+	if (list->numInvalid == 0) {
+		return;
+	}
+
+	fprintf(out, "%zu invalid destination(s):", list->numInvalid);
+
+	for (size_t i = 0; i < list->numChecked; i++) {
+		if (list->entries[i].state == RECIPIENT_INVALID) {
+			fprintf(out, " %s", list->entries[i].name);
+		}
+	}
+	fprintf(out, "\n");
+}
+
+int writeRecipients(const recipientList* list, const char* destinationsFilename) {
+	char* buffer = malloc(list->numValid * USERNAME_LENGTH + 1);
+	if (buffer == NULL) {
+		return -1;
+	}
+
+	size_t length = 0;
+
+	for (size_t i = 0; i < list->numChecked; i++) {
+		if (list->entries[i].state == RECIPIENT_VALID) {
+			length += sprintf(buffer + length, "%s\n", list->entries[i].name);
+		}
+	}
+
+	FILE* destinationsFile = fopen(destinationsFilename, "w");
+	int status = -1;
+
+	if (destinationsFile != NULL) {
+		status = fwrite(buffer, 1, length, destinationsFile) == length ? 0 : -1;
+
+		if (fclose(destinationsFile) != 0) {
+			status = -1;
+		}
+	}
+	free(buffer);
+
+	return status;
+}
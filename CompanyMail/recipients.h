@@ -0,0 +1,88 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef RECIPIENTS_H
+#define RECIPIENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "groupindex.h"
+#include "userindex.h"
+
+// States of a recipient
+#define RECIPIENT_PENDING 0
+#define RECIPIENT_VALID 1
+#define RECIPIENT_INVALID 2
+#define RECIPIENT_GROUP 3
+
+// Longest name kept, with room for a group's prefix
+#define RECIPIENT_NAME_LENGTH (USERNAME_LENGTH + 1)
+
+// Separators between names in a recipient list
+#define RECIPIENT_SEPARATORS ", \t\r\n"
+
+typedef struct recipient {
+	char name[RECIPIENT_NAME_LENGTH];
+	uint8_t state;
+} recipient;
+
+// The distinct recipients of a message in the order first given. A hash set
+// over the names drops repeats as they are added, so building a list of n
+// names is O(n) no matter how it is gathered. Names are checked against the
+// user table in one pass by validateRecipients(), which also replaces each
+// @group with the members cached in the group index
+typedef struct recipientList {
+	recipient* entries;
+	size_t count;
+	size_t capacity;
+
+	// Open addressing table of entry number + 1, 0 for an empty slot
+	uint32_t* slots;
+	size_t numSlots;
+
+	// Entries before numChecked have been validated
+	size_t numChecked;
+	size_t numValid;
+	size_t numInvalid;
+	size_t numDuplicates;
+
+	// Entries naming a group
+	size_t numGroupNames;
+} recipientList;
+
+void initRecipientList(recipientList* list);
+
+void freeRecipientList(recipientList* list);
+
+// Adds one name. Names too long to be a username are kept as invalid.
+// Returns true if it was added, false if it was already in the list
+bool addRecipient(recipientList* list, const char* name, size_t length);
+
+// Adds every name in text separated by commas or whitespace.
+// Returns the number of new names
+size_t addRecipientsFromText(recipientList* list, const char* text);
+
+// Adds the names read from fd, until end of file or, if stopAtBlankLine, up
+// to the first empty line. Nothing after that line is consumed, so the rest
+// of fd (such as a message body on stdin) can still be read.
+// Returns the number of new names, or -1 if fd could not be read
+long readRecipients(recipientList* list, int fd, bool stopAtBlankLine);
+
+// Checks every name added since the last call against the user table: the
+// index when it is mapped, otherwise one pass over usersFilename. Each group
+// named is looked up once in groups and its members added as valid.
+// Returns the number of names newly found invalid
+size_t validateRecipients(recipientList* list, const userIndex* directory, const groupIndex* groups, const char* usersFilename);
+
+// Prints every invalid name in a single report
+void printInvalidRecipients(const recipientList* list, FILE* out);
+
+// Writes the valid names to a destinations file, one per line, in one write.
+// Returns 0 on success, -1 on failure
+int writeRecipients(const recipientList* list, const char* destinationsFilename);
+
+#endif
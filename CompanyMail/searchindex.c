@@ -0,0 +1,1041 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#define _GNU_SOURCE
+
+#include "searchindex.h"
+#include "archive.h"
+#include "arena.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Set in memory on a doc that a later log entry deleted or replaced
+#define SEARCH_DOC_REMOVED 0x1
+
+// Open addressing hash table from NUL terminated strings of fewer than
+// keyLength chars to numbers. An empty key marks an empty slot
+typedef struct stringTable {
+	char* keys;
+	uint32_t* values;
+	size_t keyLength;
+	size_t capacity;
+	size_t count;
+} stringTable;
+
+static uint64_t hashKey(const char* key, size_t keyLength) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < keyLength && key[i] != '\0'; i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// capacity must be a power of two
+static void initTable(stringTable* table, size_t keyLength, size_t capacity) {
+	table->keys = calloc(capacity, keyLength);
+	table->values = malloc(capacity * sizeof(uint32_t));
+	table->keyLength = keyLength;
+	table->capacity = capacity;
+	table->count = 0;
+}
+
+static void freeTable(stringTable* table) {
+	free(table->keys);
+	free(table->values);
+	memset(table, 0, sizeof(stringTable));
+}
+
+static size_t findSlot(const stringTable* table, const char* key) {
+	size_t slot = hashKey(key, table->keyLength) & (table->capacity - 1);
+
+	while (table->keys[slot * table->keyLength] != '\0'
+			&& strncmp(&table->keys[slot * table->keyLength], key, table->keyLength) != 0) {
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	return slot;
+}
+
+// Returns the value stored for key, or NULL if there is none
+static uint32_t* findKey(const stringTable* table, const char* key) {
+	size_t slot = findSlot(table, key);
+
+	return table->keys[slot * table->keyLength] != '\0' ? &table->values[slot] : NULL;
+}
+
+// Returns the value stored for key, adding key with value first if it is missing.
+// inserted tells which happened
+static uint32_t* findOrInsert(stringTable* table, const char* key, uint32_t value, bool* inserted) {
+	// Kept at most half full so probes stay short
+	if ((table->count + 1) * 2 > table->capacity) {
+		stringTable grown;
+		initTable(&grown, table->keyLength, table->capacity * 2);
+
+		for (size_t i = 0; i < table->capacity; i++) {
+			const char* oldKey = &table->keys[i * table->keyLength];
+
+			if (*oldKey != '\0') {
+				size_t slot = findSlot(&grown, oldKey);
+				memcpy(&grown.keys[slot * grown.keyLength], oldKey, table->keyLength);
+				grown.values[slot] = table->values[i];
+			}
+		}
+		grown.count = table->count;
+
+		freeTable(table);
+		*table = grown;
+	}
+
+	size_t slot = findSlot(table, key);
+	char* slotKey = &table->keys[slot * table->keyLength];
+
+	*inserted = *slotKey == '\0';
+	if (*inserted) {
+		strncpy(slotKey, key, table->keyLength - 1);
+		table->values[slot] = value;
+		table->count++;
+	}
+
+	return &table->values[slot];
+}
+
+// Letters, digits, and any byte of a multibyte character make up terms
+static bool isTermChar(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+// Reads the next term from text into term, lower cased.
+// Returns its length, or 0 once the text runs out
+static size_t nextTerm(const char** position, const char* end, char* term) {
+	const char* c = *position;
+
+	while (true) {
+		while (c < end && !isTermChar(*c)) {
+			c++;
+		}
+		if (c == end) {
+			*position = c;
+			return 0;
+		}
+
+		size_t length = 0;
+		while (c < end && isTermChar(*c)) {
+			if (length < SEARCH_TERM_LENGTH - 1) {
+				term[length++] = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+			}
+			c++;
+		}
+
+		if (length >= SEARCH_MIN_TERM_LENGTH) {
+			term[length] = '\0';
+			*position = c;
+			return length;
+		}
+	}
+}
+
+// Adds the terms of text that are not already in seen to terms
+static void addTerms(const char* text, size_t length, stringTable* seen, searchTerms* terms, size_t* capacity) {
+	const char* position = text;
+	const char* end = text + length;
+	char term[SEARCH_TERM_LENGTH];
+	size_t termLength;
+
+	while ((termLength = nextTerm(&position, end, term)) > 0) {
+		bool inserted;
+		findOrInsert(seen, term, 0, &inserted);
+
+		if (inserted) {
+			if (terms->length + termLength + 1 > *capacity) {
+				*capacity = *capacity * 2 + SEARCH_TERM_LENGTH;
+				terms->buffer = realloc(terms->buffer, *capacity);
+			}
+			memcpy(terms->buffer + terms->length, term, termLength + 1);
+			terms->length += termLength + 1;
+			terms->count++;
+		}
+	}
+}
+
+// Gathers the terms of a message already opened as messageFD
+static void extractTermsFrom(int messageFD, const messageRecord* record, searchTerms* terms) {
+	memset(terms, 0, sizeof(searchTerms));
+
+	stringTable seen;
+	size_t capacity = 0;
+	initTable(&seen, SEARCH_TERM_LENGTH, 1024);
+
+	addTerms(record->sender, strlen(record->sender), &seen, terms, &capacity);
+	addTerms(record->subject, strlen(record->subject), &seen, terms, &capacity);
+	if (strcmp(record->attachment, "NONE") != 0) {
+		addTerms(record->attachment, strlen(record->attachment), &seen, terms, &capacity);
+	}
+
+	// The body starts after the blank line that ends the header
+	struct stat messageStat;
+	if (fstat(messageFD, &messageStat) == 0 && messageStat.st_size > 0) {
+		size_t size = messageStat.st_size < SEARCH_MAX_SCAN_BYTES ? messageStat.st_size : SEARCH_MAX_SCAN_BYTES;
+		char* message = mmap(NULL, size, PROT_READ, MAP_PRIVATE, messageFD, 0);
+
+		if (message != MAP_FAILED) {
+			char* body = memmem(message, size, "\n\n", 2);
+
+			if (body != NULL) {
+				addTerms(body + 2, message + size - (body + 2), &seen, terms, &capacity);
+			}
+			munmap(message, size);
+		}
+	}
+	freeTable(&seen);
+}
+
+int extractSearchTerms(const char* messagePath, const messageRecord* record, searchTerms* terms) {
+	memset(terms, 0, sizeof(searchTerms));
+
+	int messageFD = open(messagePath, O_RDONLY | O_CLOEXEC);
+	if (messageFD < 0) {
+		return -1;
+	}
+
+	extractTermsFrom(messageFD, record, terms);
+	close(messageFD);
+
+	return 0;
+}
+
+void freeSearchTerms(searchTerms* terms) {
+	free(terms->buffer);
+	memset(terms, 0, sizeof(searchTerms));
+}
+
+// Entries are padded so the one after always starts aligned
+static size_t paddedLength(size_t length) {
+	return (length + 7) & ~(size_t) 7;
+}
+
+// Appends one entry and its terms to the log in a single writev, so nothing
+// is copied or allocated for it
+static int appendSearchEntry(const paths* userPaths, searchLogEntry* entry, const searchTerms* terms) {
+	static const char padding[7];
+	size_t termsLength = terms != NULL ? terms->length : 0;
+
+	entry->length = paddedLength(sizeof(searchLogEntry) + termsLength);
+
+	struct iovec parts[3] = {
+		{entry, sizeof(searchLogEntry)},
+		{termsLength > 0 ? terms->buffer : NULL, termsLength},
+		{(void*) padding, entry->length - sizeof(searchLogEntry) - termsLength}
+	};
+
+	// Appends share the lock, only compaction takes it exclusively
+	uint64_t lockedAt;
+	int logFD = openLockedIndex(userPaths->searchLog, O_WRONLY | O_APPEND, LOCK_SH, &lockedAt);
+	if (logFD < 0) {
+		return -1;
+	}
+
+	ssize_t written = writev(logFD, parts, 3);
+
+	return closeLockedIndex(logFD, lockedAt) != 0 || written != entry->length ? -1 : 0;
+}
+
+int addToSearchIndex(const paths* userPaths, char folder, const messageRecord* record, const searchTerms* terms) {
+	searchLogEntry entry;
+	memset(&entry, 0, sizeof(entry));
+
+	entry.op = SEARCH_ADD;
+	entry.folder = folder;
+	entry.numTerms = terms->count;
+	entry.record = *record;
+
+	return appendSearchEntry(userPaths, &entry, terms);
+}
+
+int moveInSearchIndex(const paths* userPaths, const char* name, char folder) {
+	searchLogEntry entry;
+	memset(&entry, 0, sizeof(entry));
+
+	entry.op = SEARCH_MOVE;
+	entry.folder = folder;
+	snprintf(entry.record.name, sizeof(entry.record.name), "%s", name);
+
+	return appendSearchEntry(userPaths, &entry, NULL);
+}
+
+int removeFromSearchIndex(const paths* userPaths, const char* name) {
+	searchLogEntry entry;
+	memset(&entry, 0, sizeof(entry));
+
+	entry.op = SEARCH_REMOVE;
+	snprintf(entry.record.name, sizeof(entry.record.name), "%s", name);
+
+	return appendSearchEntry(userPaths, &entry, NULL);
+}
+
+// Returns the log entry at offset, or NULL if there is no whole entry there.
+// A SEARCH_ADD's terms must all end inside it
+static const searchLogEntry* logEntryAt(const char* log, size_t size, size_t offset) {
+	if (offset + sizeof(searchLogEntry) > size) {
+		return NULL;
+	}
+
+	const searchLogEntry* entry = (const searchLogEntry*) (log + offset);
+
+	if (entry->length < sizeof(searchLogEntry) || entry->length % 8 != 0 || entry->length > size - offset) {
+		return NULL;
+	}
+	if (entry->record.name[0] == '\0' || memchr(entry->record.name, '\0', MESSAGE_NAME_LENGTH) == NULL) {
+		return NULL;
+	}
+
+	if (entry->op == SEARCH_ADD) {
+		const char* term = (const char*) (entry + 1);
+		const char* end = log + offset + entry->length;
+
+		for (uint32_t i = 0; i < entry->numTerms; i++) {
+			const char* termEnd = memchr(term, '\0', end - term);
+			if (termEnd == NULL) {
+				return NULL;
+			}
+			term = termEnd + 1;
+		}
+	}
+
+	return entry;
+}
+
+// Reads the whole log from an open descriptor. Returns it, or NULL if it is empty
+static char* readLog(int logFD, size_t* size) {
+	struct stat logStat;
+	*size = 0;
+
+	if (fstat(logFD, &logStat) != 0 || logStat.st_size == 0) {
+		return NULL;
+	}
+
+	char* log = malloc(logStat.st_size);
+	size_t total = 0;
+
+	while (total < logStat.st_size) {
+		ssize_t bytesRead = pread(logFD, log + total, logStat.st_size - total, total);
+
+		if (bytesRead < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytesRead <= 0) {
+			break;
+		}
+		total += bytesRead;
+	}
+	*size = total;
+
+	return log;
+}
+
+// A mapped segment
+typedef struct segmentMap {
+	void* map;
+	size_t size;
+	const searchIndexHeader* header;
+	const searchDoc* docs;
+	const searchTermEntry* terms;
+	const uint8_t* postings;
+} segmentMap;
+
+// Returns 0 on success, -1 if there is no segment or it is not valid
+static int mapSegment(const char* indexPath, segmentMap* segment) {
+	memset(segment, 0, sizeof(segmentMap));
+
+	int indexFD = open(indexPath, O_RDONLY | O_CLOEXEC);
+	if (indexFD < 0) {
+		return -1;
+	}
+
+	struct stat indexStat;
+	if (fstat(indexFD, &indexStat) != 0 || indexStat.st_size < sizeof(searchIndexHeader)) {
+		close(indexFD);
+		return -1;
+	}
+
+	segment->size = indexStat.st_size;
+	segment->map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, indexFD, 0);
+	close(indexFD);
+
+	if (segment->map == MAP_FAILED) {
+		segment->map = NULL;
+		return -1;
+	}
+
+	const searchIndexHeader* header = segment->map;
+	uint64_t expected = sizeof(searchIndexHeader) + (uint64_t) header->numDocs * sizeof(searchDoc)
+		+ (uint64_t) header->numTerms * sizeof(searchTermEntry) + header->postingsBytes;
+
+	if (header->magic != SEARCH_INDEX_MAGIC || header->version != SEARCH_INDEX_VERSION || expected != segment->size) {
+		munmap(segment->map, segment->size);
+		segment->map = NULL;
+		return -1;
+	}
+
+	segment->header = header;
+	segment->docs = (const searchDoc*) (header + 1);
+	segment->terms = (const searchTermEntry*) (segment->docs + header->numDocs);
+	segment->postings = (const uint8_t*) (segment->terms + header->numTerms);
+
+	return 0;
+}
+
+static void unmapSegment(segmentMap* segment) {
+	if (segment->map != NULL) {
+		munmap(segment->map, segment->size);
+	}
+	memset(segment, 0, sizeof(segmentMap));
+}
+
+// Decodes a term's list of message numbers. Returns it, or NULL if it is damaged
+static uint32_t* decodePostings(const segmentMap* segment, const searchTermEntry* term) {
+	if (term->postingsOffset > segment->header->postingsBytes
+			|| term->postingsBytes > segment->header->postingsBytes - term->postingsOffset) {
+		return NULL;
+	}
+
+	const uint8_t* position = segment->postings + term->postingsOffset;
+	const uint8_t* end = position + term->postingsBytes;
+	uint32_t* ids = malloc((term->numPostings > 0 ? term->numPostings : 1) * sizeof(uint32_t));
+	uint32_t last = 0;
+
+	for (uint32_t i = 0; i < term->numPostings; i++) {
+		uint32_t delta = 0;
+		int shift = 0;
+
+		while (position < end && shift < 35) {
+			uint8_t byte = *position++;
+			delta |= (uint32_t) (byte & 0x7f) << shift;
+			shift += 7;
+			if (!(byte & 0x80)) {
+				break;
+			}
+		}
+
+		last += delta;
+		if (last >= segment->header->numDocs) {
+			free(ids);
+			return NULL;
+		}
+		ids[i] = last;
+	}
+
+	return ids;
+}
+
+// Message numbers are kept in the order docs were added, so every list stays sorted
+typedef struct postingList {
+	uint32_t* ids;
+	uint32_t count;
+	uint32_t capacity;
+} postingList;
+
+// A segment being put together in memory
+typedef struct indexBuilder {
+	searchDoc* docs;
+	size_t numDocs;
+	size_t docCapacity;
+	stringTable names;
+	stringTable terms;
+	postingList* postings;
+	size_t postingsCapacity;
+} indexBuilder;
+
+static void initBuilder(indexBuilder* builder) {
+	memset(builder, 0, sizeof(indexBuilder));
+	initTable(&builder->names, MESSAGE_NAME_LENGTH, 1024);
+	initTable(&builder->terms, SEARCH_TERM_LENGTH, 4096);
+}
+
+static void freeBuilder(indexBuilder* builder) {
+	for (size_t i = 0; i < builder->terms.count; i++) {
+		free(builder->postings[i].ids);
+	}
+	free(builder->postings);
+	free(builder->docs);
+	freeTable(&builder->names);
+	freeTable(&builder->terms);
+}
+
+// Returns the posting list of a term, adding an empty one if it is new
+static postingList* termPostings(indexBuilder* builder, const char* term) {
+	bool inserted;
+	uint32_t listIndex = *findOrInsert(&builder->terms, term, builder->terms.count, &inserted);
+
+	if (inserted) {
+		if (listIndex >= builder->postingsCapacity) {
+			builder->postingsCapacity = builder->postingsCapacity * 2 + 1024;
+			builder->postings = realloc(builder->postings, builder->postingsCapacity * sizeof(postingList));
+		}
+		memset(&builder->postings[listIndex], 0, sizeof(postingList));
+	}
+
+	return &builder->postings[listIndex];
+}
+
+static void addPosting(postingList* list, uint32_t docId) {
+	if (list->count > 0 && list->ids[list->count - 1] == docId) {
+		return;
+	}
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity * 2 + 4;
+		list->ids = realloc(list->ids, list->capacity * sizeof(uint32_t));
+	}
+	list->ids[list->count++] = docId;
+}
+
+// Adds a doc and returns its number. A message indexed again replaces its older doc
+static uint32_t addDoc(indexBuilder* builder, char folder, const messageRecord* record) {
+	if (builder->numDocs == builder->docCapacity) {
+		builder->docCapacity = builder->docCapacity * 2 + 1024;
+		builder->docs = realloc(builder->docs, builder->docCapacity * sizeof(searchDoc));
+	}
+
+	uint32_t docId = builder->numDocs++;
+	searchDoc* doc = &builder->docs[docId];
+
+	memset(doc, 0, sizeof(searchDoc));
+	doc->folder = folder;
+	doc->record = *record;
+
+	bool inserted;
+	uint32_t* existing = findOrInsert(&builder->names, record->name, docId, &inserted);
+	if (!inserted) {
+		builder->docs[*existing].flags |= SEARCH_DOC_REMOVED;
+		*existing = docId;
+	}
+
+	return docId;
+}
+
+static void addDocTerms(indexBuilder* builder, uint32_t docId, const char* terms, uint32_t numTerms) {
+	for (uint32_t i = 0; i < numTerms; i++) {
+		addPosting(termPostings(builder, terms), docId);
+		terms += strlen(terms) + 1;
+	}
+}
+
+// Brings the docs and posting lists of a valid segment into an empty builder
+static void loadSegment(indexBuilder* builder, const segmentMap* segment) {
+	for (uint32_t i = 0; i < segment->header->numDocs; i++) {
+		addDoc(builder, segment->docs[i].folder, &segment->docs[i].record);
+	}
+
+	for (uint32_t i = 0; i < segment->header->numTerms; i++) {
+		const searchTermEntry* term = &segment->terms[i];
+		uint32_t* ids = decodePostings(segment, term);
+
+		if (ids != NULL && memchr(term->term, '\0', SEARCH_TERM_LENGTH) != NULL && term->term[0] != '\0') {
+			postingList* list = termPostings(builder, term->term);
+
+			for (uint32_t j = 0; j < term->numPostings; j++) {
+				addPosting(list, ids[j]);
+			}
+		}
+		free(ids);
+	}
+}
+
+static void applyLog(indexBuilder* builder, const char* log, size_t size) {
+	const searchLogEntry* entry;
+
+	for (size_t offset = 0; (entry = logEntryAt(log, size, offset)) != NULL; offset += entry->length) {
+		uint32_t* docId;
+
+		switch (entry->op) {
+			case SEARCH_ADD:
+				addDocTerms(builder, addDoc(builder, entry->folder, &entry->record), (const char*) (entry + 1), entry->numTerms);
+				break;
+			case SEARCH_MOVE:
+				if ((docId = findKey(&builder->names, entry->record.name)) != NULL) {
+					builder->docs[*docId].folder = entry->folder;
+				}
+				break;
+			case SEARCH_REMOVE:
+				if ((docId = findKey(&builder->names, entry->record.name)) != NULL) {
+					builder->docs[*docId].flags |= SEARCH_DOC_REMOVED;
+				}
+				break;
+		}
+	}
+}
+
+// Indexes every message in a mailbox's folders
+static void indexFolders(indexBuilder* builder, const paths* userPaths) {
+	const char folders[] = {'u', 'r', 's'};
+
+	for (int f = 0; f < 3; f++) {
+		const char* folderPaths[2] = {NULL, NULL};
+
+		if (folders[f] == 'u') {
+			folderPaths[0] = userPaths->unreadPath;
+			folderPaths[1] = userPaths->newPath;
+		}
+		else {
+			folderPaths[0] = folders[f] == 'r' ? userPaths->readPath : userPaths->sentPath;
+		}
+
+		size_t count;
+		messageRecord* records = readFolder(userPaths, folders[f], &count);
+
+		pathBuilder messagePaths[2];
+		for (int p = 0; p < 2 && folderPaths[p] != NULL; p++) {
+			setPathFolder(&messagePaths[p], folderPaths[p]);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			searchTerms terms;
+			int status = -1;
+
+			// Archived messages are read from their segment
+			int archivedFD = openArchivedPart(folderPaths[0], &records[i], ARCHIVE_PART_MESSAGE);
+
+			if (archivedFD >= 0) {
+				extractTermsFrom(archivedFD, &records[i], &terms);
+				close(archivedFD);
+				status = 0;
+			}
+
+			for (int p = 0; p < 2 && status != 0 && folderPaths[p] != NULL; p++) {
+				const char* messagePath = buildPath(&messagePaths[p], records[i].name, NULL);
+
+				if (messagePath != NULL) {
+					status = extractSearchTerms(messagePath, &records[i], &terms);
+				}
+			}
+
+			if (status == 0) {
+				addDocTerms(builder, addDoc(builder, folders[f], &records[i]), terms.buffer, terms.count);
+				freeSearchTerms(&terms);
+			}
+		}
+		free(records);
+	}
+}
+
+// Slot of a term in the builder's table, for sorting terms
+typedef struct termSlot {
+	const char* term;
+	uint32_t listIndex;
+} termSlot;
+
+static int compareTermSlots(const void* a, const void* b) {
+	return strncmp(((const termSlot*) a)->term, ((const termSlot*) b)->term, SEARCH_TERM_LENGTH);
+}
+
+static void appendVarint(uint8_t** buffer, size_t* length, size_t* capacity, uint32_t value) {
+	if (*length + 5 > *capacity) {
+		*capacity = *capacity * 2 + 4096;
+		*buffer = realloc(*buffer, *capacity);
+	}
+
+	while (value >= 0x80) {
+		(*buffer)[(*length)++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	(*buffer)[(*length)++] = value;
+}
+
+// Writes the builder's live docs and their terms as a new segment.
+// Returns 0 on success, -1 on failure
+static int writeSegment(const indexBuilder* builder, const char* indexPath) {
+	// Deleted docs are dropped and the rest renumbered in order
+	uint32_t* newIds = malloc((builder->numDocs > 0 ? builder->numDocs : 1) * sizeof(uint32_t));
+	uint32_t numLive = 0;
+
+	for (size_t i = 0; i < builder->numDocs; i++) {
+		newIds[i] = numLive;
+		if (!(builder->docs[i].flags & SEARCH_DOC_REMOVED)) {
+			numLive++;
+		}
+	}
+
+	termSlot* slots = malloc((builder->terms.count > 0 ? builder->terms.count : 1) * sizeof(termSlot));
+	size_t numSlots = 0;
+
+	for (size_t i = 0; i < builder->terms.capacity; i++) {
+		const char* term = &builder->terms.keys[i * builder->terms.keyLength];
+
+		if (*term != '\0') {
+			slots[numSlots].term = term;
+			slots[numSlots].listIndex = builder->terms.values[i];
+			numSlots++;
+		}
+	}
+	qsort(slots, numSlots, sizeof(termSlot), compareTermSlots);
+
+	searchTermEntry* terms = calloc(numSlots > 0 ? numSlots : 1, sizeof(searchTermEntry));
+	uint32_t numTerms = 0;
+	uint8_t* postings = NULL;
+	size_t postingsLength = 0;
+	size_t postingsCapacity = 0;
+
+	for (size_t i = 0; i < numSlots; i++) {
+		const postingList* list = &builder->postings[slots[i].listIndex];
+		searchTermEntry* entry = &terms[numTerms];
+		uint32_t last = 0;
+
+		entry->postingsOffset = postingsLength;
+		entry->numPostings = 0;
+
+		for (uint32_t j = 0; j < list->count; j++) {
+			if (builder->docs[list->ids[j]].flags & SEARCH_DOC_REMOVED) {
+				continue;
+			}
+
+			uint32_t docId = newIds[list->ids[j]];
+			appendVarint(&postings, &postingsLength, &postingsCapacity, docId - last);
+			last = docId;
+			entry->numPostings++;
+		}
+
+		// Terms only deleted messages had are dropped
+		if (entry->numPostings > 0) {
+			strncpy(entry->term, slots[i].term, SEARCH_TERM_LENGTH - 1);
+			entry->postingsBytes = postingsLength - entry->postingsOffset;
+			numTerms++;
+		}
+	}
+
+	searchIndexHeader header = {SEARCH_INDEX_MAGIC, SEARCH_INDEX_VERSION, numLive, numTerms, postingsLength};
+
+	char* tempPath = malloc(strlen(indexPath) + strlen(".tmp") + 1);
+	sprintf(tempPath, "%s.tmp", indexPath);
+
+	int status = -1;
+	FILE* indexFile = fopen(tempPath, "wb");
+
+	if (indexFile != NULL) {
+		bool written = fwrite(&header, sizeof(header), 1, indexFile) == 1;
+
+		for (size_t i = 0; i < builder->numDocs && written; i++) {
+			if (!(builder->docs[i].flags & SEARCH_DOC_REMOVED)) {
+				written = fwrite(&builder->docs[i], sizeof(searchDoc), 1, indexFile) == 1;
+			}
+		}
+		written = written && fwrite(terms, sizeof(searchTermEntry), numTerms, indexFile) == numTerms;
+		written = written && fwrite(postings, 1, postingsLength, indexFile) == postingsLength;
+
+		if (fclose(indexFile) == 0 && written && rename(tempPath, indexPath) == 0) {
+			status = 0;
+		}
+		else {
+			remove(tempPath);
+		}
+	}
+
+	free(tempPath);
+	free(postings);
+	free(terms);
+	free(slots);
+	free(newIds);
+
+	return status;
+}
+
+// Replaces the log with an empty one. Appenders waiting on the old log find
+// it is no longer current and move to the new one
+static int resetLog(const paths* userPaths) {
+	char* tempPath = malloc(strlen(userPaths->searchLog) + strlen(".tmp") + 1);
+	sprintf(tempPath, "%s.tmp", userPaths->searchLog);
+
+	int status = -1;
+	int logFD = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (logFD >= 0) {
+		if (close(logFD) == 0 && rename(tempPath, userPaths->searchLog) == 0) {
+			status = 0;
+		}
+		else {
+			remove(tempPath);
+		}
+	}
+	free(tempPath);
+
+	return status;
+}
+
+int compactSearchIndex(const paths* userPaths) {
+	uint64_t lockedAt;
+	int logFD = openLockedIndex(userPaths->searchLog, O_RDONLY, LOCK_EX, &lockedAt);
+	if (logFD < 0) {
+		return -1;
+	}
+
+	indexBuilder builder;
+	initBuilder(&builder);
+
+	segmentMap segment;
+	if (mapSegment(userPaths->searchIndex, &segment) == 0) {
+		loadSegment(&builder, &segment);
+		unmapSegment(&segment);
+
+		size_t logSize;
+		char* log = readLog(logFD, &logSize);
+		applyLog(&builder, log, logSize);
+		free(log);
+	}
+	else {
+		// The folders already hold everything the log could add
+		indexFolders(&builder, userPaths);
+	}
+
+	int status = writeSegment(&builder, userPaths->searchIndex);
+	if (status == 0) {
+		status = resetLog(userPaths);
+	}
+
+	closeLockedIndex(logFD, lockedAt);
+	freeBuilder(&builder);
+
+	return status;
+}
+
+static int compareTermEntries(const void* key, const void* entry) {
+	return strncmp(key, ((const searchTermEntry*) entry)->term, SEARCH_TERM_LENGTH);
+}
+
+static int compareTermCounts(const void* a, const void* b) {
+	uint32_t first = (*(const searchTermEntry**) a)->numPostings;
+	uint32_t second = (*(const searchTermEntry**) b)->numPostings;
+
+	return (first > second) - (first < second);
+}
+
+// Finds the segment docs holding every query term.
+// Returns their numbers in order, or NULL if there are none
+static uint32_t* matchSegment(const segmentMap* segment, const searchTerms* query, size_t* count) {
+	const searchTermEntry** entries = malloc(query->count * sizeof(searchTermEntry*));
+	const char* term = query->buffer;
+	*count = 0;
+
+	for (uint32_t i = 0; i < query->count; i++) {
+		entries[i] = bsearch(term, segment->terms, segment->header->numTerms, sizeof(searchTermEntry), compareTermEntries);
+		if (entries[i] == NULL) {
+			free(entries);
+			return NULL;
+		}
+		term += strlen(term) + 1;
+	}
+
+	// The rarest term is decoded first so intersections only shrink it
+	qsort(entries, query->count, sizeof(searchTermEntry*), compareTermCounts);
+
+	uint32_t* matches = decodePostings(segment, entries[0]);
+	size_t numMatches = matches != NULL ? entries[0]->numPostings : 0;
+
+	for (uint32_t i = 1; i < query->count && numMatches > 0; i++) {
+		uint32_t* ids = decodePostings(segment, entries[i]);
+		size_t kept = 0;
+
+		for (size_t a = 0, b = 0; ids != NULL && a < numMatches && b < entries[i]->numPostings; ) {
+			if (matches[a] < ids[b]) {
+				a++;
+			}
+			else if (matches[a] > ids[b]) {
+				b++;
+			}
+			else {
+				matches[kept++] = matches[a];
+				a++;
+				b++;
+			}
+		}
+		numMatches = kept;
+		free(ids);
+	}
+	free(entries);
+
+	if (numMatches == 0) {
+		free(matches);
+		return NULL;
+	}
+	*count = numMatches;
+
+	return matches;
+}
+
+// True if a logged message has every query term
+static bool entryMatches(const searchLogEntry* entry, const searchTerms* query) {
+	const char* queryTerm = query->buffer;
+
+	for (uint32_t i = 0; i < query->count; i++) {
+		const char* term = (const char*) (entry + 1);
+		bool found = false;
+
+		for (uint32_t j = 0; j < entry->numTerms && !found; j++) {
+			found = !strcmp(term, queryTerm);
+			term += strlen(term) + 1;
+		}
+		if (!found) {
+			return false;
+		}
+		queryTerm += strlen(queryTerm) + 1;
+	}
+
+	return true;
+}
+
+// What the log says about one message
+typedef struct logState {
+	const searchLogEntry* added;
+	char folder;
+	bool moved;
+	bool removed;
+} logState;
+
+static int compareDocTimes(const void* a, const void* b) {
+	int64_t first = ((const searchDoc*) a)->record.timestamp;
+	int64_t second = ((const searchDoc*) b)->record.timestamp;
+
+	return (first > second) - (first < second);
+}
+
+static void addResult(searchDoc** results, size_t* count, size_t* capacity, char folder, const messageRecord* record) {
+	if (*count == *capacity) {
+		*capacity = *capacity * 2 + 64;
+		*results = realloc(*results, *capacity * sizeof(searchDoc));
+	}
+
+	searchDoc* result = &(*results)[(*count)++];
+	memset(result, 0, sizeof(searchDoc));
+	result->folder = folder;
+	result->record = *record;
+}
+
+searchDoc* searchMailbox(const paths* userPaths, const char* query, size_t* count) {
+	*count = 0;
+
+	searchTerms queryTerms;
+	memset(&queryTerms, 0, sizeof(queryTerms));
+
+	stringTable seen;
+	size_t capacity = 0;
+	initTable(&seen, SEARCH_TERM_LENGTH, 64);
+	addTerms(query, strlen(query), &seen, &queryTerms, &capacity);
+	freeTable(&seen);
+
+	if (queryTerms.count == 0) {
+		return NULL;
+	}
+
+	// A mailbox is indexed in full on its first search, and a long log is merged first
+	struct stat indexStat, logStat;
+	if (stat(userPaths->searchIndex, &indexStat) != 0
+			|| (stat(userPaths->searchLog, &logStat) == 0 && logStat.st_size >= SEARCH_COMPACT_BYTES)) {
+		compactSearchIndex(userPaths);
+	}
+
+	// The shared lock keeps the segment and log from being swapped between the two reads
+	uint64_t lockedAt;
+	int logFD = openLockedIndex(userPaths->searchLog, O_RDONLY, LOCK_SH, &lockedAt);
+
+	segmentMap segment;
+	bool haveSegment = mapSegment(userPaths->searchIndex, &segment) == 0;
+
+	size_t logSize = 0;
+	char* log = NULL;
+	if (logFD >= 0) {
+		log = readLog(logFD, &logSize);
+		closeLockedIndex(logFD, lockedAt);
+	}
+
+	// Log entries are replayed in order, the last word on each message wins
+	stringTable logNames;
+	initTable(&logNames, MESSAGE_NAME_LENGTH, 256);
+	logState* states = NULL;
+	size_t numStates = 0;
+	size_t statesCapacity = 0;
+
+	const searchLogEntry* entry;
+	for (size_t offset = 0; (entry = logEntryAt(log, logSize, offset)) != NULL; offset += entry->length) {
+		bool inserted;
+		uint32_t stateIndex = *findOrInsert(&logNames, entry->record.name, numStates, &inserted);
+
+		if (inserted) {
+			if (numStates == statesCapacity) {
+				statesCapacity = statesCapacity * 2 + 64;
+				states = realloc(states, statesCapacity * sizeof(logState));
+			}
+			memset(&states[numStates++], 0, sizeof(logState));
+		}
+
+		logState* state = &states[stateIndex];
+
+		if (entry->op == SEARCH_ADD) {
+			state->added = entry;
+			state->folder = entry->folder;
+			state->moved = false;
+			state->removed = false;
+		}
+		else if (entry->op == SEARCH_MOVE) {
+			state->folder = entry->folder;
+			state->moved = true;
+		}
+		else if (entry->op == SEARCH_REMOVE) {
+			state->removed = true;
+		}
+	}
+
+	searchDoc* results = NULL;
+	size_t resultsCapacity = 0;
+
+	if (haveSegment) {
+		size_t numMatches;
+		uint32_t* matches = matchSegment(&segment, &queryTerms, &numMatches);
+
+		for (size_t i = 0; i < numMatches; i++) {
+			const searchDoc* doc = &segment.docs[matches[i]];
+			char folder = doc->folder;
+			uint32_t* stateIndex = findKey(&logNames, doc->record.name);
+
+			if (stateIndex != NULL) {
+				const logState* state = &states[*stateIndex];
+
+				// Deleted, or indexed again in the log and matched from there
+				if (state->removed || state->added != NULL) {
+					continue;
+				}
+				if (state->moved) {
+					folder = state->folder;
+				}
+			}
+			addResult(&results, count, &resultsCapacity, folder, &doc->record);
+		}
+		free(matches);
+		unmapSegment(&segment);
+	}
+
+	for (size_t i = 0; i < numStates; i++) {
+		if (states[i].added != NULL && !states[i].removed && entryMatches(states[i].added, &queryTerms)) {
+			addResult(&results, count, &resultsCapacity, states[i].folder, &states[i].added->record);
+		}
+	}
+
+	qsort(results, *count, sizeof(searchDoc), compareDocTimes);
+
+	free(states);
+	freeTable(&logNames);
+	free(log);
+	freeSearchTerms(&queryTerms);
+
+	return results;
+}
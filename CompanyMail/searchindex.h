@@ -0,0 +1,110 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mailbox.h"
+#include "mailindex.h"
+
+// Each mailbox has a full-text index of the words in its messages' senders,
+// subjects, attachment names and bodies. It is a sorted segment (search.idx)
+// of term -> compressed list of messages, plus a log (search.log) of messages
+// added, moved and deleted since the segment was written. Searches read the
+// segment and the log and never open a message.
+// Appends to the log share its lock, rewriting the segment takes it exclusively.
+
+#define SEARCH_INDEX_MAGIC 0x58444953
+#define SEARCH_INDEX_VERSION 1
+
+// Longest term kept, including its NUL. Longer words are cut short
+#define SEARCH_TERM_LENGTH 32
+
+// Shorter words are not indexed
+#define SEARCH_MIN_TERM_LENGTH 2
+
+// Only this much of a message is read for terms
+#define SEARCH_MAX_SCAN_BYTES (4 << 20)
+
+// Size the log may reach before it is merged into the segment
+#define SEARCH_COMPACT_BYTES (1 << 20)
+
+// Log operations
+#define SEARCH_ADD 1
+#define SEARCH_MOVE 2
+#define SEARCH_REMOVE 3
+
+// Distinct terms of one message, each NUL terminated, one after another
+typedef struct searchTerms {
+	char* buffer;
+	size_t length;
+	uint32_t count;
+} searchTerms;
+
+// One log entry. A SEARCH_ADD is followed by numTerms terms and length
+// covers them. Moves and removals only use folder and record.name
+typedef struct searchLogEntry {
+	uint32_t length;
+	uint32_t numTerms;
+	uint8_t op;
+	char folder;
+	uint16_t reserved;
+	uint32_t reserved2;
+	messageRecord record;
+} searchLogEntry;
+
+// A message in the segment. folder is 'u', 'r' or 's'
+typedef struct searchDoc {
+	char folder;
+	uint8_t flags;
+	uint8_t reserved[6];
+	messageRecord record;
+} searchDoc;
+
+// A term in the segment. Its list of message numbers is numPostings
+// ascending numbers, each stored as the varint difference from the last
+typedef struct searchTermEntry {
+	char term[SEARCH_TERM_LENGTH];
+	uint64_t postingsOffset;
+	uint32_t numPostings;
+	uint32_t postingsBytes;
+} searchTermEntry;
+
+// The segment is this header, numDocs docs, numTerms terms sorted by term,
+// then postingsBytes bytes of posting lists
+typedef struct searchIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numDocs;
+	uint32_t numTerms;
+	uint64_t postingsBytes;
+} searchIndexHeader;
+
+// Finds the terms of a message from its record and the body of its file.
+// terms must be freed with freeSearchTerms().
+// Returns 0 on success, -1 if the message could not be read
+int extractSearchTerms(const char* messagePath, const messageRecord* record, searchTerms* terms);
+
+void freeSearchTerms(searchTerms* terms);
+
+// Log a message added to a folder, moved to another folder, or deleted.
+// Each returns 0 on success, -1 on failure
+int addToSearchIndex(const paths* userPaths, char folder, const messageRecord* record, const searchTerms* terms);
+int moveInSearchIndex(const paths* userPaths, const char* name, char folder);
+int removeFromSearchIndex(const paths* userPaths, const char* name);
+
+// Merges the log into the segment. A mailbox with no segment yet is
+// indexed from scratch from its folders instead.
+// Returns 0 on success, -1 on failure
+int compactSearchIndex(const paths* userPaths);
+
+// Finds the messages holding every word of query, oldest first.
+// The mailbox is indexed first if it never has been.
+// Returns the matches, which must be freed, or NULL if there are none
+searchDoc* searchMailbox(const paths* userPaths, const char* query, size_t* count);
+
+#endif
@@ -0,0 +1,223 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "terminal.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void clearScreen(void) {
+	fputs("\033[H\033[2J", stdout);
+	fflush(stdout);
+}
+
+void terminalSize(int* rows, int* columns) {
+	struct winsize size;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+		*rows = size.ws_row;
+		*columns = size.ws_col;
+	}
+	else {
+		*rows = DEFAULT_TERMINAL_ROWS;
+		*columns = DEFAULT_TERMINAL_COLUMNS;
+	}
+}
+
+// Length of the well formed UTF-8 character starting at text, with its code
+// point in codePoint. Returns 0 for a stray, overlong or truncated sequence
+static size_t utf8Length(const unsigned char* text, size_t available, uint32_t* codePoint) {
+	size_t length = text[0] >= 0xf0 ? 4 : text[0] >= 0xe0 ? 3 : 2;
+	uint32_t minimum = length == 4 ? 0x10000 : length == 3 ? 0x800 : 0x80;
+
+	if (text[0] < 0xc0 || text[0] > 0xf4 || length > available) {
+		return 0;
+	}
+
+	*codePoint = text[0] & (0x7f >> length);
+	for (size_t i = 1; i < length; i++) {
+		if ((text[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+		*codePoint = *codePoint << 6 | (text[i] & 0x3f);
+	}
+
+	// Surrogates and code points past Unicode's range are not characters
+	if (*codePoint < minimum || *codePoint > 0x10ffff || (*codePoint >= 0xd800 && *codePoint <= 0xdfff)) {
+		return 0;
+	}
+
+	return length;
+}
+
+// Prints as much of text from offset as fits in rows, wrapping long lines.
+// Only printable ASCII and well formed UTF-8 outside the C0 and C1 control
+// ranges reach the terminal. Anything else, such as an 8-bit CSI, is shown as '?'.
+// Returns the offset the next screen starts at
+static size_t showScreen(const char* text, size_t size, size_t offset, int rows, int columns) {
+	int row = 0;
+
+	while (row < rows && offset < size) {
+		int column = 0;
+
+		while (offset < size && text[offset] != '\n') {
+			unsigned char c = text[offset];
+			size_t length = 1;
+			bool printable = c >= 0x20 && c < 0x7f;
+
+			if (c >= 0x80) {
+				uint32_t codePoint;
+				length = utf8Length((const unsigned char*) text + offset, size - offset, &codePoint);
+				printable = length > 0 && codePoint >= 0xa0;
+
+				// A bad byte is replaced alone, so the text after it still shows
+				if (length == 0) {
+					length = 1;
+				}
+			}
+
+			// Tabs stop every 8 columns and every other character takes one.
+			// Carriage returns of CRLF lines take none
+			int width = c == '\t' ? 8 - column % 8 : c == '\r' ? 0 : 1;
+
+			if (column > 0 && column + width > columns) {
+				break;
+			}
+
+			if (c == '\t') {
+				printf("%*s", width, "");
+			}
+			else if (printable) {
+				fwrite(text + offset, 1, length, stdout);
+			}
+			else if (c != '\r') {
+				putchar('?');
+			}
+			column += width;
+			offset += length;
+		}
+
+		// A wrapped line carries on in the next row
+		if (offset < size && text[offset] == '\n') {
+			offset++;
+		}
+		putchar('\n');
+		row++;
+	}
+
+	// Keeps the prompt on the bottom row
+	for (; row < rows; row++) {
+		putchar('\n');
+	}
+
+	return offset;
+}
+
+int pageFile(const char* path) {
+	int fileFD = open(path, O_RDONLY | O_CLOEXEC);
+	if (fileFD < 0) {
+		perror("Error opening message");
+		return -1;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileFD, &fileStat) != 0) {
+		perror("Error opening message");
+		close(fileFD);
+		return -1;
+	}
+
+	size_t size = fileStat.st_size;
+	const char* text = "";
+
+	if (size > 0) {
+		void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileFD, 0);
+
+		if (map == MAP_FAILED) {
+			perror("Error opening message");
+			close(fileFD);
+			return -1;
+		}
+		text = map;
+	}
+	close(fileFD);
+
+	// Where each screen seen so far starts, so the user can go back
+	size_t* screenStarts = malloc(16 * sizeof(size_t));
+	size_t numScreens = 1;
+	size_t screenCapacity = 16;
+	size_t screen = 0;
+	char input[16];
+
+	screenStarts[0] = 0;
+
+	while (true) {
+		int rows, columns;
+		terminalSize(&rows, &columns);
+
+		clearScreen();
+		size_t next = showScreen(text, size, screenStarts[screen], rows > 1 ? rows - 1 : 1, columns);
+		bool atEnd = next >= size;
+
+		if (atEnd) {
+			printf("-- End --  Back: B  Quit: Q or Enter ");
+		}
+		else {
+			printf("-- %d%% --  Next Page: Enter  Back: B  Quit: Q ", (int) (next * 100 / size));
+		}
+		fflush(stdout);
+
+		if (fgets(input, sizeof(input), stdin) == NULL) {
+			break;
+		}
+
+		// Rest of an overlong line is thrown away
+		if (input[0] != '\0' && input[strlen(input) - 1] != '\n') {
+			int discard;
+			while ((discard = getchar()) != '\n' && discard != EOF);
+		}
+
+		char c = tolower(input[0]);
+
+		if (c == 'q') {
+			break;
+		}
+		else if (c == 'b') {
+			if (screen > 0) {
+				screen--;
+			}
+		}
+		else if (atEnd) {
+			break;
+		}
+		else {
+			if (screen + 1 == numScreens) {
+				if (numScreens == screenCapacity) {
+					screenCapacity *= 2;
+					screenStarts = realloc(screenStarts, screenCapacity * sizeof(size_t));
+				}
+				screenStarts[numScreens++] = next;
+			}
+			screen++;
+		}
+	}
+
+	free(screenStarts);
+	if (size > 0) {
+		munmap((void*) text, size);
+	}
+
+	clearScreen();
+
+	return 0;
+}
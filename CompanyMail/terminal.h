@@ -0,0 +1,26 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+// Screen handling done in process with escape sequences, so changing screens
+// or viewing a message never forks
+
+// Screen size used when the terminal cannot be asked
+#define DEFAULT_TERMINAL_ROWS 24
+#define DEFAULT_TERMINAL_COLUMNS 80
+
+// Clears the screen and moves the cursor to the top left
+void clearScreen(void);
+
+// Gets the size of the terminal on stdout, or the defaults if it has none
+void terminalSize(int* rows, int* columns);
+
+// Shows a file a screen at a time straight from a memory mapping of it.
+// Control characters are shown as '?' so a message can never send commands
+// to the terminal. Returns 0 once the user leaves, -1 if the file could not be read
+int pageFile(const char* path);
+
+#endif
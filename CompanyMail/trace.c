@@ -0,0 +1,196 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "trace.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+const char* traceNames[NUM_TRACE_NAMES] = {
+	"lock_wait",
+	"lock_held",
+	"index_append",
+	"link",
+	"copy",
+	"editor",
+	"send",
+	"delivery",
+	"uring_batch"
+};
+
+bool traceEnabled = false;
+
+static traceEvent* traceRing = NULL;
+static uint64_t traceNext = 0;
+static traceHeader traceStart;
+
+static __thread uint32_t traceTid = 0;
+
+static uint64_t monotonicNanos(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// The cycle counter where there is one, otherwise the monotonic clock
+static inline uint64_t traceTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return monotonicNanos();
+#endif
+}
+
+void traceRecord(traceName name, char phase) {
+	if (traceTid == 0) {
+		traceTid = syscall(SYS_gettid);
+	}
+
+	uint64_t slot = __atomic_fetch_add(&traceNext, 1, __ATOMIC_RELAXED) & (TRACE_RING_SIZE - 1);
+	traceEvent* event = &traceRing[slot];
+
+	event->ticks = traceTicks();
+	event->tid = traceTid;
+	event->name = name;
+	event->phase = phase;
+}
+
+// Writes all of a buffer using only async-signal-safe calls
+static int writeAll(int fd, const void* buffer, size_t length) {
+	const char* position = buffer;
+
+	while (length > 0) {
+		ssize_t written = write(fd, position, length);
+
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return -1;
+		}
+		position += written;
+		length -= written;
+	}
+
+	return 0;
+}
+
+int dumpTrace(void) {
+	if (!traceEnabled) {
+		return -1;
+	}
+
+	int savedErrno = errno;
+
+	// The path is built by hand since snprintf is not safe in a signal handler
+	char path[sizeof(TRACE_DIRECTORY) + 32];
+	char digits[16];
+	int numDigits = 0;
+
+	for (pid_t pid = getpid(); pid > 0 && numDigits < sizeof(digits); pid /= 10) {
+		digits[numDigits++] = '0' + pid % 10;
+	}
+
+	size_t length = sizeof(TRACE_DIRECTORY) - 1;
+	memcpy(path, TRACE_DIRECTORY, length);
+	path[length++] = '/';
+	while (numDigits > 0) {
+		path[length++] = digits[--numDigits];
+	}
+	memcpy(path + length, ".trace", sizeof(".trace"));
+
+	mkdir(TRACE_DIRECTORY, 0700);
+
+	int traceFD = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (traceFD < 0) {
+		errno = savedErrno;
+		return -1;
+	}
+
+	uint64_t next = __atomic_load_n(&traceNext, __ATOMIC_ACQUIRE);
+	uint64_t first = next > TRACE_RING_SIZE ? next - TRACE_RING_SIZE : 0;
+
+	traceHeader header = traceStart;
+	header.pid = getpid();
+	header.numEvents = next - first;
+	header.endTicks = traceTicks();
+	header.endNanos = monotonicNanos();
+
+	// The ring is written oldest first, in at most two pieces
+	size_t firstSlot = first & (TRACE_RING_SIZE - 1);
+	size_t firstPiece = header.numEvents < TRACE_RING_SIZE - firstSlot ? header.numEvents : TRACE_RING_SIZE - firstSlot;
+
+	int status = writeAll(traceFD, &header, sizeof(header));
+	if (status == 0) {
+		status = writeAll(traceFD, &traceRing[firstSlot], firstPiece * sizeof(traceEvent));
+	}
+	if (status == 0 && firstPiece < header.numEvents) {
+		status = writeAll(traceFD, traceRing, (header.numEvents - firstPiece) * sizeof(traceEvent));
+	}
+	close(traceFD);
+
+	errno = savedErrno;
+
+	return status;
+}
+
+static void dumpTraceAtExit(void) {
+	dumpTrace();
+}
+
+// SIGUSR1 dumps and carries on, anything else dumps and then takes its usual course
+static void dumpTraceOnSignal(int signum) {
+	dumpTrace();
+
+	if (signum != SIGUSR1) {
+		signal(signum, SIG_DFL);
+		raise(signum);
+	}
+}
+
+void openTrace(const char* label) {
+	struct stat flagStat;
+
+	if (traceEnabled || stat(TRACE_FLAG_FILENAME, &flagStat) != 0) {
+		return;
+	}
+
+	traceRing = calloc(TRACE_RING_SIZE, sizeof(traceEvent));
+	if (traceRing == NULL) {
+		return;
+	}
+
+	memset(&traceStart, 0, sizeof(traceStart));
+	traceStart.magic = TRACE_MAGIC;
+	traceStart.version = TRACE_VERSION;
+	snprintf(traceStart.label, sizeof(traceStart.label), "%s", label);
+	traceStart.startTicks = traceTicks();
+	traceStart.startNanos = monotonicNanos();
+
+	traceEnabled = true;
+
+	atexit(dumpTraceAtExit);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = dumpTraceOnSignal;
+	sigemptyset(&action.sa_mask);
+
+	sigaction(SIGUSR1, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+}
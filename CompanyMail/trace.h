@@ -0,0 +1,86 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mailroot.h"
+
+// Tracing is on for every mail process while this file exists
+#define TRACE_FLAG_FILENAME MAIL_ROOT "/Config/trace"
+
+// Each process dumps its events to <pid>.trace in here
+#define TRACE_DIRECTORY MAIL_ROOT "/traces"
+
+#define TRACE_MAGIC 0x45434154
+#define TRACE_VERSION 1
+
+// Events kept per process. Older events are overwritten once it fills
+#define TRACE_RING_SIZE (1 << 16)
+
+#define TRACE_LABEL_LENGTH 48
+
+// Spans that are traced
+typedef enum traceName {
+	TRACE_LOCK_WAIT,
+	TRACE_LOCK_HELD,
+	TRACE_INDEX_APPEND,
+	TRACE_LINK,
+	TRACE_COPY,
+	TRACE_EDITOR,
+	TRACE_SEND,
+	TRACE_DELIVERY,
+	TRACE_URING_BATCH,
+	NUM_TRACE_NAMES
+} traceName;
+
+extern const char* traceNames[NUM_TRACE_NAMES];
+
+// One begin ('B') or end ('E') of a span. ticks are converted to
+// nanoseconds with the calibration in the dump's header
+typedef struct traceEvent {
+	uint64_t ticks;
+	uint32_t tid;
+	uint8_t name;
+	char phase;
+	uint16_t reserved;
+} traceEvent;
+
+// A dump is this header followed by numEvents events, oldest first.
+// Two readings of the tick counter and the monotonic clock, taken when tracing
+// started and when it was dumped, convert ticks to time shared by every process
+typedef struct traceHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint32_t numEvents;
+	uint64_t startTicks;
+	uint64_t startNanos;
+	uint64_t endTicks;
+	uint64_t endNanos;
+	char label[TRACE_LABEL_LENGTH];
+} traceHeader;
+
+extern bool traceEnabled;
+
+// Turns tracing on for this process if TRACE_FLAG_FILENAME exists.
+// The ring is dumped when the process exits, on SIGUSR1, and before SIGINT
+// or SIGTERM end it. label names the process in the merged trace
+void openTrace(const char* label);
+
+// Records one event. Use TRACE_BEGIN and TRACE_END, which cost only a
+// branch while tracing is off
+void traceRecord(traceName name, char phase);
+
+#define TRACE_BEGIN(name) do { if (__builtin_expect(traceEnabled, 0)) traceRecord(name, 'B'); } while (0)
+#define TRACE_END(name) do { if (__builtin_expect(traceEnabled, 0)) traceRecord(name, 'E'); } while (0)
+
+// Writes the ring to this process's dump file. Safe to call from a signal handler.
+// Returns 0 on success, -1 on failure
+int dumpTrace(void);
+
+#endif
@@ -0,0 +1,119 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "trace.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Merges the trace dumps of any number of mail processes into one
+// Chrome/Perfetto JSON trace on stdout. With no arguments every dump in
+// TRACE_DIRECTORY is merged.
+
+static bool firstEvent = true;
+
+// Prints a string as a JSON string literal
+static void printJsonString(const char* string) {
+	putchar('"');
+	for (const char* c = string; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			printf("\\%c", *c);
+		}
+		else if ((unsigned char) *c < 0x20) {
+			printf("\\u%04x", *c);
+		}
+		else {
+			putchar(*c);
+		}
+	}
+	putchar('"');
+}
+
+// Adds one dump's events to the output. Returns 0 on success, -1 on failure
+static int mergeDump(const char* path) {
+	FILE* dump = fopen(path, "rb");
+	if (dump == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	traceHeader header;
+	if (fread(&header, sizeof(header), 1, dump) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+		fprintf(stderr, "%s is not a mail trace\n", path);
+		fclose(dump);
+		return -1;
+	}
+	header.label[TRACE_LABEL_LENGTH - 1] = '\0';
+
+	// Ticks are placed on the monotonic clock every process shares
+	double nanosPerTick = 1.0;
+	if (header.endTicks > header.startTicks && header.endNanos > header.startNanos) {
+		nanosPerTick = (double) (header.endNanos - header.startNanos) / (header.endTicks - header.startTicks);
+	}
+
+	printf("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":", firstEvent ? "" : ",", header.pid);
+	printJsonString(header.label);
+	printf("}}");
+	firstEvent = false;
+
+	traceEvent event;
+	for (uint32_t i = 0; i < header.numEvents && fread(&event, sizeof(event), 1, dump) == 1; i++) {
+		if (event.name >= NUM_TRACE_NAMES || (event.phase != 'B' && event.phase != 'E')) {
+			continue;
+		}
+
+		double nanos = header.startNanos + ((double) event.ticks - (double) header.startTicks) * nanosPerTick;
+
+		printf(",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+			traceNames[event.name], event.phase, nanos / 1000, header.pid, event.tid);
+	}
+	fclose(dump);
+
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int status = 0;
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			if (mergeDump(argv[i]) != 0) {
+				status = 1;
+			}
+		}
+	}
+	else {
+		DIR* traceDir = opendir(TRACE_DIRECTORY);
+		if (traceDir == NULL) {
+			perror(TRACE_DIRECTORY);
+			status = 1;
+		}
+
+		struct dirent* entry;
+		while (traceDir != NULL && (entry = readdir(traceDir)) != NULL) {
+			size_t length = strlen(entry->d_name);
+
+			if (length > strlen(".trace") && !strcmp(entry->d_name + length - strlen(".trace"), ".trace")) {
+				char* path = malloc(strlen(TRACE_DIRECTORY) + strlen("/") + length + 1);
+				sprintf(path, "%s/%s", TRACE_DIRECTORY, entry->d_name);
+
+				if (mergeDump(path) != 0) {
+					status = 1;
+				}
+				free(path);
+			}
+		}
+		if (traceDir != NULL) {
+			closedir(traceDir);
+		}
+	}
+
+	printf("\n]}\n");
+
+	return status;
+}
@@ -0,0 +1,170 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "uring.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __NR_io_uring_setup
+
+int uringInit(uring* ring, unsigned int entries, unsigned int numFiles) {
+	struct io_uring_params params;
+
+	memset(ring, 0, sizeof(uring));
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		int error = errno;
+		uringClose(ring);
+		errno = error;
+		return -1;
+	}
+
+	ring->sqHead = (unsigned int*) ((char*) ring->sqRing + params.sq_off.head);
+	ring->sqTail = (unsigned int*) ((char*) ring->sqRing + params.sq_off.tail);
+	ring->sqMask = *(unsigned int*) ((char*) ring->sqRing + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned int*) ((char*) ring->sqRing + params.sq_off.array);
+
+	ring->cqHead = (unsigned int*) ((char*) ring->cqRing + params.cq_off.head);
+	ring->cqTail = (unsigned int*) ((char*) ring->cqRing + params.cq_off.tail);
+	ring->cqMask = *(unsigned int*) ((char*) ring->cqRing + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) ((char*) ring->cqRing + params.cq_off.cqes);
+
+	// Empty slots that opens can place files into directly
+	if (numFiles > 0) {
+		int* files = malloc(numFiles * sizeof(int));
+
+		for (unsigned int i = 0; i < numFiles; i++) {
+			files[i] = -1;
+		}
+
+		int status = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, files, numFiles);
+		free(files);
+
+		if (status != 0) {
+			int error = errno;
+			uringClose(ring);
+			errno = error;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+struct io_uring_sqe* uringGetSqe(uring* ring) {
+	unsigned int head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	unsigned int tail = *ring->sqTail + ring->queued;
+
+	if (tail - head >= ring->entries) {
+		return NULL;
+	}
+
+	unsigned int slot = tail & ring->sqMask;
+	struct io_uring_sqe* sqe = &ring->sqes[slot];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sqArray[slot] = slot;
+	ring->queued++;
+
+	return sqe;
+}
+
+int uringSubmitAndWait(uring* ring, void (*handler)(void* context, uint64_t userData, int32_t result), void* context) {
+	unsigned int total = ring->queued;
+	unsigned int unsubmitted = total;
+	unsigned int completed = 0;
+
+	// The kernel sees every queued entry once the tail moves
+	__atomic_store_n(ring->sqTail, *ring->sqTail + total, __ATOMIC_RELEASE);
+	ring->queued = 0;
+
+	while (completed < total) {
+		// Normally a single call submits everything and waits for all of it
+		int entered = syscall(__NR_io_uring_enter, ring->fd, unsubmitted, total - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (entered < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		unsubmitted -= entered;
+
+		unsigned int head = *ring->cqHead;
+		unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+		while (head != tail) {
+			struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+
+			handler(context, cqe->user_data, cqe->res);
+			head++;
+			completed++;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+void uringClose(uring* ring) {
+	if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+		munmap(ring->sqRing, ring->sqRingSize);
+	}
+	if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED) {
+		munmap(ring->cqRing, ring->cqRingSize);
+	}
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+		munmap(ring->sqes, ring->sqesSize);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(uring));
+	ring->fd = -1;
+}
+
+#else
+
+// Built without io_uring, so callers always take their synchronous path
+
+int uringInit(uring* ring, unsigned int entries, unsigned int numFiles) {
+	memset(ring, 0, sizeof(uring));
+	ring->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+struct io_uring_sqe* uringGetSqe(uring* ring) {
+	return NULL;
+}
+
+int uringSubmitAndWait(uring* ring, void (*handler)(void* context, uint64_t userData, int32_t result), void* context) {
+	errno = ENOSYS;
+	return -1;
+}
+
+void uringClose(uring* ring) {
+}
+
+#endif
@@ -0,0 +1,54 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring made directly with the system calls.
+// Entries are queued with uringGetSqe() and all sent to the kernel with one
+// uringSubmitAndWait(), which also waits for every one of them to complete.
+typedef struct uring {
+	int fd;
+	unsigned int entries;
+
+	unsigned int* sqHead;
+	unsigned int* sqTail;
+	unsigned int sqMask;
+	unsigned int* sqArray;
+	struct io_uring_sqe* sqes;
+	unsigned int queued;
+
+	unsigned int* cqHead;
+	unsigned int* cqTail;
+	unsigned int cqMask;
+	struct io_uring_cqe* cqes;
+
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+} uring;
+
+// Sets up a ring of at least the given number of entries with numFiles
+// empty fixed file slots. Returns 0 on success, -1 with errno set if the
+// kernel has no io_uring or refuses one
+int uringInit(uring* ring, unsigned int entries, unsigned int numFiles);
+
+// Returns a cleared submission entry, or NULL if the ring is full
+struct io_uring_sqe* uringGetSqe(uring* ring);
+
+// Submits every queued entry and waits for all of them to complete.
+// handler is called once per completion.
+// Returns 0 on success, -1 if the kernel rejected the submission
+int uringSubmitAndWait(uring* ring, void (*handler)(void* context, uint64_t userData, int32_t result), void* context);
+
+// Tears the ring down
+void uringClose(uring* ring);
+
+#endif
@@ -0,0 +1,290 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#include "userindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE_LENGTH 1024
+
+// FNV-1a hash of a username
+static uint32_t hashName(const char* username) {
+	uint32_t hash = 2166136261u;
+
+	while (*username) {
+		hash ^= (unsigned char) *username++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Multiplicative hash of a UID
+static uint32_t hashUid(uint32_t uid) {
+	return uid * 2654435761u;
+}
+
+// Number of hash slots for n users. Always a power of two at least twice n
+static uint32_t bucketsFor(uint32_t numUsers) {
+	uint32_t numBuckets = 16;
+
+	while (numBuckets < numUsers * 2) {
+		numBuckets *= 2;
+	}
+
+	return numBuckets;
+}
+
+// Records the mtime and size of a file, or zeros if it does not exist
+static void statSignature(const char* filename, int64_t* mtimeSec, int64_t* mtimeNsec, int64_t* size) {
+	struct stat fileStat;
+
+	if (stat(filename, &fileStat) != 0) {
+		*mtimeSec = 0;
+		*mtimeNsec = 0;
+		*size = -1;
+		return;
+	}
+
+	*mtimeSec = fileStat.st_mtim.tv_sec;
+	*mtimeNsec = fileStat.st_mtim.tv_nsec;
+	*size = fileStat.st_size;
+}
+
+// True if neither source file changed since the index was built
+static bool sourcesUnchanged(const userIndexHeader* header, const char* usersFilename, const char* adminFilename) {
+	int64_t mtimeSec, mtimeNsec, size;
+
+	statSignature(usersFilename, &mtimeSec, &mtimeNsec, &size);
+	if (mtimeSec != header->usersMtimeSec || mtimeNsec != header->usersMtimeNsec || size != header->usersSize) {
+		return false;
+	}
+
+	statSignature(adminFilename, &mtimeSec, &mtimeNsec, &size);
+	return mtimeSec == header->adminsMtimeSec && mtimeNsec == header->adminsMtimeNsec && size == header->adminsSize;
+}
+
+int buildUserIndex(const char* usersFilename, const char* adminFilename, const char* indexFilename) {
+	FILE* users = fopen(usersFilename, "r");
+	if (users == NULL) {
+		return -1;
+	}
+
+	userIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = USER_INDEX_MAGIC;
+	header.version = USER_INDEX_VERSION;
+
+	// Signatures are taken before reading so a concurrent rewrite makes the index stale
+	statSignature(usersFilename, &header.usersMtimeSec, &header.usersMtimeNsec, &header.usersSize);
+	statSignature(adminFilename, &header.adminsMtimeSec, &header.adminsMtimeNsec, &header.adminsSize);
+
+	uint32_t capacity = 256;
+	userRecord* records = malloc(capacity * sizeof(userRecord));
+	char line[MAX_LINE_LENGTH];
+
+	// Users file lines are username:uid
+	while (fgets(line, sizeof(line), users) != NULL) {
+		char* username = strtok(line, ":");
+		char* uidStr = strtok(NULL, "\n");
+
+		if (username == NULL || uidStr == NULL || strlen(username) >= USERNAME_LENGTH) {
+			continue;
+		}
+
+		if (header.numUsers == capacity) {
+			capacity *= 2;
+			records = realloc(records, capacity * sizeof(userRecord));
+		}
+
+		userRecord* record = &records[header.numUsers++];
+		memset(record, 0, sizeof(userRecord));
+		strcpy(record->username, username);
+		record->uid = (uint32_t) strtoul(uidStr, NULL, 10);
+	}
+	fclose(users);
+
+	header.numBuckets = bucketsFor(header.numUsers);
+
+	uint32_t* uidTable = calloc(header.numBuckets, sizeof(uint32_t));
+	uint32_t* nameTable = calloc(header.numBuckets, sizeof(uint32_t));
+	uint32_t mask = header.numBuckets - 1;
+
+	// Linear probing. The first entry for a duplicate name or UID wins
+	for (uint32_t i = 0; i < header.numUsers; i++) {
+		uint32_t slot = hashUid(records[i].uid) & mask;
+		while (uidTable[slot] != 0 && records[uidTable[slot] - 1].uid != records[i].uid) {
+			slot = (slot + 1) & mask;
+		}
+		if (uidTable[slot] == 0) {
+			uidTable[slot] = i + 1;
+		}
+
+		slot = hashName(records[i].username) & mask;
+		while (nameTable[slot] != 0 && strcmp(records[nameTable[slot] - 1].username, records[i].username) != 0) {
+			slot = (slot + 1) & mask;
+		}
+		if (nameTable[slot] == 0) {
+			nameTable[slot] = i + 1;
+		}
+	}
+
+	// Admins file holds whitespace separated usernames
+	FILE* admins = fopen(adminFilename, "r");
+	if (admins != NULL) {
+		char adminName[MAX_LINE_LENGTH];
+
+		while (fscanf(admins, "%1023s", adminName) != EOF) {
+			uint32_t slot = hashName(adminName) & mask;
+
+			while (nameTable[slot] != 0) {
+				if (!strcmp(records[nameTable[slot] - 1].username, adminName)) {
+					records[nameTable[slot] - 1].isAdmin = 1;
+					break;
+				}
+				slot = (slot + 1) & mask;
+			}
+		}
+		fclose(admins);
+	}
+
+	// Written to a temporary file and renamed so readers never see a partial index
+	char* tempFilename = malloc(strlen(indexFilename) + strlen(".tmp.") + 11 + 1);
+	sprintf(tempFilename, "%s.tmp.%d", indexFilename, getpid());
+
+	int status = -1;
+	FILE* indexFile = fopen(tempFilename, "wb");
+
+	if (indexFile != NULL) {
+		bool written = fwrite(&header, sizeof(header), 1, indexFile) == 1
+			&& fwrite(records, sizeof(userRecord), header.numUsers, indexFile) == header.numUsers
+			&& fwrite(uidTable, sizeof(uint32_t), header.numBuckets, indexFile) == header.numBuckets
+			&& fwrite(nameTable, sizeof(uint32_t), header.numBuckets, indexFile) == header.numBuckets;
+
+		if (fclose(indexFile) == 0 && written && rename(tempFilename, indexFilename) == 0) {
+			status = 0;
+		}
+		else {
+			remove(tempFilename);
+		}
+	}
+
+	free(tempFilename);
+	free(records);
+	free(uidTable);
+	free(nameTable);
+
+	return status;
+}
+
+int openUserIndex(userIndex* index, const char* usersFilename, const char* adminFilename, const char* indexFilename) {
+	memset(index, 0, sizeof(userIndex));
+
+	int indexFD = open(indexFilename, O_RDONLY);
+	if (indexFD < 0) {
+		return -1;
+	}
+
+	struct stat indexStat;
+	if (fstat(indexFD, &indexStat) != 0 || indexStat.st_size < sizeof(userIndexHeader)) {
+		close(indexFD);
+		return -1;
+	}
+
+	void* map = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, indexFD, 0);
+	close(indexFD);
+
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	const userIndexHeader* header = map;
+	size_t expectedSize = sizeof(userIndexHeader) + (size_t) header->numUsers * sizeof(userRecord)
+		+ 2 * (size_t) header->numBuckets * sizeof(uint32_t);
+
+	bool valid = header->magic == USER_INDEX_MAGIC && header->version == USER_INDEX_VERSION
+		&& header->numBuckets != 0 && (header->numBuckets & (header->numBuckets - 1)) == 0
+		&& expectedSize == indexStat.st_size && sourcesUnchanged(header, usersFilename, adminFilename);
+
+	if (!valid) {
+		munmap(map, indexStat.st_size);
+		return -1;
+	}
+
+	index->map = map;
+	index->mapSize = indexStat.st_size;
+	index->header = header;
+	index->records = (const userRecord*) (header + 1);
+	index->uidTable = (const uint32_t*) (index->records + header->numUsers);
+	index->nameTable = index->uidTable + header->numBuckets;
+
+	return 0;
+}
+
+int loadUserIndex(userIndex* index, const char* usersFilename, const char* adminFilename, const char* indexFilename) {
+	if (openUserIndex(index, usersFilename, adminFilename, indexFilename) == 0) {
+		return 0;
+	}
+
+	if (buildUserIndex(usersFilename, adminFilename, indexFilename) != 0) {
+		return -1;
+	}
+
+	return openUserIndex(index, usersFilename, adminFilename, indexFilename);
+}
+
+bool userIndexIsCurrent(const userIndex* index, const char* usersFilename, const char* adminFilename) {
+	return index->map != NULL && sourcesUnchanged(index->header, usersFilename, adminFilename);
+}
+
+void closeUserIndex(userIndex* index) {
+	if (index->map != NULL) {
+		munmap(index->map, index->mapSize);
+	}
+	memset(index, 0, sizeof(userIndex));
+}
+
+const userRecord* findUserByUid(const userIndex* index, uint32_t uid) {
+	if (index->map == NULL) {
+		return NULL;
+	}
+
+	uint32_t mask = index->header->numBuckets - 1;
+	uint32_t slot = hashUid(uid) & mask;
+
+	while (index->uidTable[slot] != 0) {
+		const userRecord* record = &index->records[index->uidTable[slot] - 1];
+		if (record->uid == uid) {
+			return record;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return NULL;
+}
+
+const userRecord* findUserByName(const userIndex* index, const char* username) {
+	if (index->map == NULL || strlen(username) >= USERNAME_LENGTH) {
+		return NULL;
+	}
+
+	uint32_t mask = index->header->numBuckets - 1;
+	uint32_t slot = hashName(username) & mask;
+
+	while (index->nameTable[slot] != 0) {
+		const userRecord* record = &index->records[index->nameTable[slot] - 1];
+		if (!strcmp(record->username, username)) {
+			return record;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,76 @@
+// Secure Centralized Asynchronous Communications
+// Reese Myers (rsmyers)
+// CPSC 6240 - Fall 2024
+
+#ifndef USERINDEX_H
+#define USERINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define USER_INDEX_MAGIC 0x58444955
+#define USER_INDEX_VERSION 1
+#define USERNAME_LENGTH 33
+
+// One account in the index. Usernames are NUL padded
+typedef struct userRecord {
+	char username[USERNAME_LENGTH];
+	uint8_t isAdmin;
+	uint16_t reserved;
+	uint32_t uid;
+} userRecord;
+
+// The index file is this header, then numUsers records, then a UID hash
+// table and a username hash table of numBuckets slots each.
+// Slots hold a record number plus one, zero marks an empty slot.
+// The mtimes and sizes of the users and admins files the index was built
+// from are kept so a stale index can be detected.
+typedef struct userIndexHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numUsers;
+	uint32_t numBuckets;
+	int64_t usersMtimeSec;
+	int64_t usersMtimeNsec;
+	int64_t usersSize;
+	int64_t adminsMtimeSec;
+	int64_t adminsMtimeNsec;
+	int64_t adminsSize;
+} userIndexHeader;
+
+// A read only mapping of an index file
+typedef struct userIndex {
+	void* map;
+	size_t mapSize;
+	const userIndexHeader* header;
+	const userRecord* records;
+	const uint32_t* uidTable;
+	const uint32_t* nameTable;
+} userIndex;
+
+// Builds the index from the users and admins files.
+// The new index atomically replaces any existing one.
+// Returns 0 on success, -1 on failure
+int buildUserIndex(const char* usersFilename, const char* adminFilename, const char* indexFilename);
+
+// Maps an existing index read only.
+// Returns 0 on success, -1 if the index is missing, corrupt, or stale
+int openUserIndex(userIndex* index, const char* usersFilename, const char* adminFilename, const char* indexFilename);
+
+// Maps the index, rebuilding it first if it is missing or stale.
+// Returns 0 on success, -1 if no usable index could be produced
+int loadUserIndex(userIndex* index, const char* usersFilename, const char* adminFilename, const char* indexFilename);
+
+// True if a mapped index still matches the users and admins files.
+// Long running processes use this to notice they should reload it
+bool userIndexIsCurrent(const userIndex* index, const char* usersFilename, const char* adminFilename);
+
+// Unmaps an index
+void closeUserIndex(userIndex* index);
+
+// Constant time lookups. Return NULL if there is no such account
+const userRecord* findUserByUid(const userIndex* index, uint32_t uid);
+const userRecord* findUserByName(const userIndex* index, const char* username);
+
+#endif